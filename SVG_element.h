@@ -38,7 +38,7 @@ namespace SVG {
 		}
 
 		static wstring to_wide(string s) {
-			const wstring cyrillic = L"АБВГДЕЖЗИЙКЛМНОПРСТУФХЦЧШЩЪЫЬЭЮЯ ";
+			static const wstring cyrillic = L"АБВГДЕЖЗИЙКЛМНОПРСТУФХЦЧШЩЪЫЬЭЮЯ ";
 			using uc = unsigned char;
 			const int cyrillicA = 224;
 			wstring res;
@@ -0,0 +1,220 @@
+#pragma once
+/*
+* Minimal benchmark harness shared by the suites in bench/.
+* Every benchmark is calibrated until a sample takes at least minSampleSeconds, then timed over a few samples.
+* Results are printed as a table and can be written as JSON in the layout of Google Benchmark's --benchmark_out,
+* so the usual comparison scripts work on them. Only wall time is measured: cpu_time repeats it.
+*/
+#include <inttypes.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace bench
+{
+	/* Keeps the compiler from dropping a computation whose result is unused */
+	template <typename T>
+	inline void doNotOptimize(const T& value)
+	{
+#if defined(_MSC_VER)
+		static volatile const void* sink;
+		sink = &value;
+#else
+		asm volatile("" : : "r,m"(value) : "memory");
+#endif
+	}
+
+	/* Highest resident set of the process so far, in bytes. 0 where it is not available. */
+	inline uint64_t peakRssBytes()
+	{
+#if defined(_WIN32)
+		PROCESS_MEMORY_COUNTERS counters;
+		return GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) ? uint64_t(counters.PeakWorkingSetSize) : 0;
+#else
+		rusage usage;
+		if (getrusage(RUSAGE_SELF, &usage) != 0)
+			return 0;
+#if defined(__APPLE__)
+		return uint64_t(usage.ru_maxrss); // Bytes on macOS
+#else
+		return uint64_t(usage.ru_maxrss) * 1024; // Kilobytes elsewhere
+#endif
+#endif
+	}
+
+	struct Result
+	{
+		std::string name;
+		uint64_t iterations = 0; // Per sample
+		double medianNs = 0; // Per iteration
+		double minNs = 0;
+		double maxNs = 0;
+		double itemsPerIteration = 0; // Gives items_per_second when set
+		std::vector<std::pair<std::string, double>> counters;
+
+		Result& counter(std::string counterName, double value) { counters.emplace_back(std::move(counterName), value); return *this; }
+		Result& items(double perIteration) { itemsPerIteration = perIteration; return *this; }
+	};
+
+	class Runner
+	{
+	public:
+
+		struct Options
+		{
+			double minSampleSeconds = 0.05;
+			uint32_t samples = 5;
+			std::string filter; // Only benchmarks whose name contains it are run
+		};
+
+	public:
+
+		Runner() = default;
+		explicit Runner(Options options) : _options(std::move(options)) {}
+
+		bool enabled(const std::string& name) const { return _options.filter.empty() || name.find(_options.filter) != std::string::npos; }
+
+		/* Times op() and returns the result to attach counters to. Skipped benchmarks return a result which is not reported. */
+		template <typename Op>
+		Result& run(std::string name, Op&& op, uint32_t samples = 0)
+		{
+			if (!enabled(name))
+			{
+				_skipped = Result();
+				return _skipped;
+			}
+			samples = samples ? samples : _options.samples;
+
+			uint64_t iterations = 1;
+			while (true)
+			{
+				const double seconds = time(op, iterations);
+				if (seconds >= _options.minSampleSeconds || iterations >= (uint64_t(1) << 40))
+					break;
+				// Aim a bit over the minimum so the next round usually ends the calibration
+				const double scale = seconds > 0 ? _options.minSampleSeconds * 1.4 / seconds : 100.0;
+				iterations = std::max(iterations + 1, uint64_t(double(iterations) * std::min(scale, 100.0)));
+			}
+
+			std::vector<double> perIteration(samples);
+			for (auto& ns : perIteration)
+				ns = time(op, iterations) * 1e9 / double(iterations);
+			std::sort(perIteration.begin(), perIteration.end());
+
+			Result result;
+			result.name = std::move(name);
+			result.iterations = iterations;
+			result.medianNs = perIteration[perIteration.size() / 2];
+			result.minNs = perIteration.front();
+			result.maxNs = perIteration.back();
+			_results.push_back(std::move(result));
+			return _results.back();
+		}
+
+		/* Reports a measurement taken outside the harness, like a one-off load */
+		Result& record(std::string name, double nsPerIteration, uint64_t iterations = 1)
+		{
+			Result result;
+			result.name = std::move(name);
+			result.iterations = iterations;
+			result.medianNs = result.minNs = result.maxNs = nsPerIteration;
+			_results.push_back(std::move(result));
+			return _results.back();
+		}
+
+		const std::vector<Result>& getResults() const { return _results; }
+
+		void printTable(std::FILE* out = stdout) const
+		{
+			std::fprintf(out, "%-48s %14s %14s %12s\n", "benchmark", "median", "min", "iterations");
+			for (const auto& result : _results)
+			{
+				std::fprintf(out, "%-48s %14s %14s %12" PRIu64, result.name.c_str(), formatNs(result.medianNs).c_str(), formatNs(result.minNs).c_str(), result.iterations);
+				if (result.itemsPerIteration > 0)
+					std::fprintf(out, "  %.3g items/s", result.itemsPerIteration * 1e9 / result.medianNs);
+				for (const auto& counter : result.counters)
+					std::fprintf(out, "  %s=%.6g", counter.first.c_str(), counter.second);
+				std::fprintf(out, "\n");
+			}
+		}
+
+		void writeJson(std::ostream& out, const std::string& executable) const
+		{
+			const auto precision = out.precision(15); // Byte counts keep every digit
+			out << "{\n  \"context\": {\n    \"executable\": \"" << escape(executable) << "\",\n"
+				<< "    \"samples\": " << _options.samples << ",\n"
+				<< "    \"peak_rss_bytes\": " << peakRssBytes() << "\n  },\n  \"benchmarks\": [";
+			for (size_t i = 0; i < _results.size(); ++i)
+			{
+				const auto& result = _results[i];
+				out << (i ? ",\n" : "\n") << "    {\"name\": \"" << escape(result.name) << "\", \"run_type\": \"iteration\", \"iterations\": " << result.iterations
+					<< ", \"real_time\": " << result.medianNs << ", \"cpu_time\": " << result.medianNs << ", \"time_unit\": \"ns\""
+					<< ", \"min_time\": " << result.minNs << ", \"max_time\": " << result.maxNs;
+				if (result.itemsPerIteration > 0)
+					out << ", \"items_per_second\": " << result.itemsPerIteration * 1e9 / result.medianNs;
+				for (const auto& counter : result.counters)
+					out << ", \"" << escape(counter.first) << "\": " << counter.second;
+				out << "}";
+			}
+			out << "\n  ]\n}\n";
+			out.precision(precision);
+		}
+
+	private:
+
+		template <typename Op>
+		static double time(Op& op, uint64_t iterations)
+		{
+			const auto start = std::chrono::steady_clock::now();
+			for (uint64_t i = 0; i < iterations; ++i)
+				op();
+			return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		}
+
+		static std::string formatNs(double ns)
+		{
+			char text[32];
+			if (ns < 1e3)
+				std::snprintf(text, sizeof(text), "%.1f ns", ns);
+			else if (ns < 1e6)
+				std::snprintf(text, sizeof(text), "%.2f us", ns / 1e3);
+			else if (ns < 1e9)
+				std::snprintf(text, sizeof(text), "%.2f ms", ns / 1e6);
+			else
+				std::snprintf(text, sizeof(text), "%.3f s", ns / 1e9);
+			return text;
+		}
+
+		static std::string escape(const std::string& text)
+		{
+			std::string res;
+			for (const char c : text)
+			{
+				if (c == '"' || c == '\\')
+					res += '\\';
+				res += c;
+			}
+			return res;
+		}
+
+	private:
+
+		Options _options;
+		std::vector<Result> _results;
+		Result _skipped;
+	};
+}
@@ -0,0 +1,93 @@
+/*
+* Throughput of the code page kernels in crosswordutils.hpp.
+* Usage: codepagebench [file] [repeats]
+* Converts `file` (an explanation dump, read into memory once) or 256 MiB of generated dos text with every available kernel.
+*/
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../crosswordutils.hpp"
+
+static std::vector<uint8_t> generateText(size_t size)
+{
+	// Mostly dos cyrillic with spaces, punctuation and an occasional box character, like the explanation files
+	std::mt19937 rng(42);
+	std::vector<uint8_t> text(size);
+	for (auto& c : text)
+	{
+		const uint32_t r = rng() % 100;
+		if (r < 80)
+			c = uint8_t(utils::CYRILLIC_A - 96 + rng() % 64);
+		else if (r < 95)
+			c = ' ';
+		else if (r < 99)
+			c = uint8_t(',' + rng() % 3);
+		else
+			c = utils::DOS_BOX_CHAR;
+	}
+	return text;
+}
+
+int main(int argc, char** argv)
+{
+	std::vector<uint8_t> input;
+	if (argc > 1)
+	{
+		std::ifstream fin(argv[1], std::ios::binary);
+		input.assign(std::istreambuf_iterator<char>(fin), std::istreambuf_iterator<char>());
+		if (input.empty())
+		{
+			std::fprintf(stderr, "Could not read %s\n", argv[1]);
+			return 1;
+		}
+	}
+	else
+	{
+		input = generateText(256ull << 20);
+	}
+	const int repeats = argc > 2 ? std::atoi(argv[2]) : 5;
+
+	const struct { utils::codepage::Isa isa; const char* name; } isas[] = {
+		{ utils::codepage::Isa::TABLE, "table" },
+		{ utils::codepage::Isa::SSE2, "sse2" },
+		{ utils::codepage::Isa::AVX2, "avx2" },
+		{ utils::codepage::Isa::NEON, "neon" },
+	};
+
+	std::vector<uint8_t> output(input.size());
+	std::vector<uint8_t> reference(input.size());
+	for (size_t i = 0; i < input.size(); ++i)
+		reference[i] = utils::dosToWinCode(input[i]);
+
+	std::printf("%zu bytes, best of %d runs\n", input.size(), repeats);
+	for (const auto& isa : isas)
+	{
+		for (int direction = 0; direction < 2; ++direction)
+		{
+			auto kernel = direction == 0 ? utils::codepage::getDosToWinKernel(isa.isa) : utils::codepage::getWinToDosKernel(isa.isa);
+			if (!kernel)
+				continue;
+
+			const uint8_t* source = direction == 0 ? input.data() : reference.data();
+			double best = 1e100;
+			for (int run = 0; run < repeats; ++run)
+			{
+				const auto start = std::chrono::steady_clock::now();
+				kernel(source, output.data(), input.size());
+				best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+			}
+
+			const bool correct = std::memcmp(output.data(), direction == 0 ? reference.data() : input.data(), input.size()) == 0;
+			std::printf("%-6s %s: %8.1f MB/s%s\n", isa.name, direction == 0 ? "dos->win" : "win->dos", input.size() / best / 1e6, correct ? "" : " WRONG");
+		}
+	}
+	return 0;
+}
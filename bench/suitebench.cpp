@@ -0,0 +1,382 @@
+/*
+* Benchmarks of the dictionary, the crossword files, the grid generator and the filler.
+* Usage: suitebench [--json out.json] [--filter text] [--config config.ini] [--work dir] [--samples n] [grid.ctb ...]
+* The synthetic dictionary and grid are generated with a fixed seed in --work (default: the current directory) and
+* always measured. --config adds the real dictionary it names, and the grids are filled with it (or with the
+* synthetic dictionary without --config) to time the end-to-end fill.
+*/
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "benchharness.hpp"
+#include "../crossword.hpp"
+#include "../crosswordfiller.hpp"
+#include "../crosswordgenerator.hpp"
+#include "../dictionary.hpp"
+#include "../logger.hpp"
+
+static const uint64_t SEED = 42;
+
+struct Arguments
+{
+	std::string jsonPath;
+	std::string configPath;
+	std::string workDirectory = ".";
+	std::vector<std::string> grids;
+	bench::Runner::Options runner;
+};
+
+static bool parseArguments(int argc, char** argv, Arguments& arguments)
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		const std::string argument = argv[i];
+		const bool hasValue = i + 1 < argc;
+		if (argument == "--json" && hasValue)
+			arguments.jsonPath = argv[++i];
+		else if (argument == "--filter" && hasValue)
+			arguments.runner.filter = argv[++i];
+		else if (argument == "--config" && hasValue)
+			arguments.configPath = argv[++i];
+		else if (argument == "--work" && hasValue)
+			arguments.workDirectory = argv[++i];
+		else if (argument == "--samples" && hasValue)
+			arguments.runner.samples = uint32_t(std::max(1, std::atoi(argv[++i])));
+		else if (argument.size() > 2 && argument.compare(0, 2, "--") == 0)
+			return false;
+		else
+			arguments.grids.push_back(argument);
+	}
+	return true;
+}
+
+/* Dos code letters with roughly the frequencies of bulgarian text, so the bitmaps are as uneven as the real ones */
+static uint8_t randomDosLetter(std::mt19937_64& rng)
+{
+	static const uint8_t common[] = { 0, 4, 8, 14, 13, 18, 17, 19, 2, 10, 11, 15, 3, 12 }; // А Д И О Н Т С У В К Л П Г М
+	const uint32_t r = uint32_t(rng() % 100);
+	const uint8_t letter = r < 70 ? common[rng() % sizeof(common)] : uint8_t(rng() % 30);
+	return uint8_t(utils::CYRILLIC_A - 96 + letter);
+}
+
+/* `numWords` dos code lines `word<TAB>explanation` with lengths 2..15 */
+static bool writeSyntheticDictionary(const std::string& path, size_t numWords)
+{
+	std::mt19937_64 rng(SEED);
+	std::string text;
+	text.reserve(numWords * 32);
+	for (size_t i = 0; i < numWords; ++i)
+	{
+		const size_t length = 2 + (rng() % 6) + (rng() % 9); // Peaks around 6..10 letters
+		for (size_t j = 0; j < length; ++j)
+			text += char(randomDosLetter(rng));
+		text += '\t';
+		const size_t explanationLength = 8 + rng() % 24;
+		for (size_t j = 0; j < explanationLength; ++j)
+			text += rng() % 6 == 0 ? ' ' : char(randomDosLetter(rng));
+		text += '\n';
+	}
+
+	std::ofstream fout(path, std::ios::binary);
+	fout.write(text.data(), std::streamsize(text.size()));
+	return bool(fout);
+}
+
+static bool writeConfig(const std::string& path, const std::string& dictionaryPath)
+{
+	std::ofstream fout(path);
+	fout << "[dictionary]\ndictionary_file_path=" << dictionaryPath << "\n";
+	return bool(fout);
+}
+
+/* .ctb image of a rows x cols grid with about `boxPercent` box cells and random letters elsewhere */
+static std::vector<uint8_t> makeSyntheticGrid(uint8_t rows, uint8_t cols, uint32_t boxPercent, uint64_t seed)
+{
+	std::mt19937_64 rng(seed);
+	std::vector<uint8_t> image(2 + size_t(rows) * cols);
+	image[0] = rows;
+	image[1] = cols;
+	for (size_t i = 2; i < image.size(); ++i)
+		image[i] = rng() % 100 < boxPercent ? utils::DOS_BOX_CHAR : randomDosLetter(rng);
+	return image;
+}
+
+/* Patterns of words of `length` with each letter kept with `density` percent and the others ANY_CHAR */
+static std::vector<std::string> makePatterns(const std::vector<std::string_view>& words, uint32_t density, size_t count, uint64_t seed)
+{
+	std::mt19937_64 rng(seed);
+	std::vector<std::string> patterns(count);
+	for (auto& pattern : patterns)
+	{
+		pattern = std::string(words[rng() % words.size()]);
+		for (auto& c : pattern)
+			if (rng() % 100 >= density)
+				c = char(utils::Dictionary::ANY_CHAR);
+	}
+	return patterns;
+}
+
+static void benchLoad(bench::Runner& runner, const std::string& name, const std::string& configPath)
+{
+	size_t numWords = 0;
+	runner.run(name, [&]()
+	{
+		utils::Dictionary dictionary(configPath);
+		numWords = dictionary.getNumWords();
+		bench::doNotOptimize(numWords);
+	}, 3).counter("words", double(numWords)).counter("peak_rss_bytes", double(bench::peakRssBytes()));
+}
+
+static void benchFindPossible(bench::Runner& runner, const std::string& prefix, utils::Dictionary& dictionary)
+{
+	std::vector<std::vector<std::string_view>> wordsByLength(utils::Dictionary::LONGEST_WORD + 1);
+	for (const auto word : dictionary.getAllWords())
+		if (word.size() <= utils::Dictionary::LONGEST_WORD)
+			wordsByLength[word.size()].push_back(word);
+
+	const size_t budget = dictionary.getCacheStats().budgetBytes;
+	for (const uint32_t length : { 4u, 6u, 8u, 12u })
+	{
+		if (wordsByLength[length].empty())
+			continue;
+		for (const uint32_t density : { 0u, 25u, 50u, 75u })
+		{
+			const auto patterns = makePatterns(wordsByLength[length], density, 256, SEED + length * 100 + density);
+			const std::string name = prefix + "/len" + std::to_string(length) + "/fill" + std::to_string(density);
+			size_t next = 0;
+			const auto query = [&]()
+			{
+				auto pattern = dictionary.findPossible(patterns[next++ & 255]);
+				bench::doNotOptimize(pattern.size);
+			};
+
+			dictionary.setCacheBudget(0); // Every query is computed from the index
+			runner.run(name + "/cold", query);
+			dictionary.setCacheBudget(budget);
+			for (const auto& pattern : patterns)
+				dictionary.findPossible(pattern);
+			runner.run(name + "/cached", query);
+
+			runner.run(prefix + "/count/len" + std::to_string(length) + "/fill" + std::to_string(density), [&]()
+			{
+				bench::doNotOptimize(dictionary.countPossible(patterns[next++ & 255]));
+			});
+		}
+	}
+}
+
+static void benchLevenstein(bench::Runner& runner, const utils::Dictionary& dictionary)
+{
+	const auto& words = dictionary.getAllWords();
+	if (words.empty())
+		return;
+
+	std::mt19937_64 rng(SEED);
+	std::vector<std::pair<std::string_view, std::string_view>> pairs(1024);
+	for (auto& pair : pairs)
+		pair = { words[rng() % words.size()], words[rng() % words.size()] };
+
+	size_t next = 0;
+	runner.run("levenstein/full", [&]()
+	{
+		const auto& pair = pairs[next++ & 1023];
+		bench::doNotOptimize(utils::Dictionary::levenstein(pair.first, pair.second));
+	}).items(1);
+	runner.run("levenstein/bounded2", [&]()
+	{
+		const auto& pair = pairs[next++ & 1023];
+		bench::doNotOptimize(utils::Dictionary::levenstein(pair.first, pair.second, 2));
+	}).items(1);
+}
+
+static void benchCrosswordFiles(bench::Runner& runner, const std::string& workDirectory)
+{
+	const auto image = makeSyntheticGrid(20, 30, 15, SEED);
+	const std::string path = workDirectory + "/suitebench_grid.ctb";
+	{
+		std::ofstream fout(path, std::ios::binary);
+		fout.write(reinterpret_cast<const char*>(image.data()), std::streamsize(image.size()));
+	}
+
+	Crossword crossword;
+	runner.run("ctb/parse/20x30", [&]() { bench::doNotOptimize(crossword.parse(image.data(), image.size(), "suitebench_grid")); }).items(double(image.size()));
+
+	std::vector<uint8_t> out;
+	runner.run("ctb/serialize/20x30", [&]()
+	{
+		out.clear();
+		crossword.serialize(out);
+		bench::doNotOptimize(out.data());
+	}).items(double(image.size()));
+
+	runner.run("ctb/load/20x30", [&]() { bench::doNotOptimize(crossword.tryLoad(path)); });
+	runner.run("ctb/save/20x30", [&]() { bench::doNotOptimize(crossword.save(path)); });
+
+	Crossword other;
+	const auto otherImage = makeSyntheticGrid(20, 30, 15, SEED + 1);
+	other.parse(otherImage.data(), otherImage.size(), "suitebench_other");
+	crossword.parse(image.data(), image.size(), "suitebench_grid");
+	runner.run("crossword/generateReport/20x30", [&]() { bench::doNotOptimize(crossword.generateReport().numWords); });
+	runner.run("crossword/compare/20x30", [&]() { bench::doNotOptimize(Crossword::compare(crossword, other).size()); });
+	runner.run("crossword/compare/self/20x30", [&]() { bench::doNotOptimize(Crossword::compare(crossword, crossword).size()); });
+}
+
+static void benchFill(bench::Runner& runner, const utils::Dictionary& dictionary, const std::vector<std::string>& grids)
+{
+	CrosswordFiller filler(dictionary);
+	CrosswordFiller::Options options;
+	options.deterministic = true;
+	options.seed = SEED;
+
+	for (const auto& path : grids)
+	{
+		Crossword grid;
+		if (!grid.tryLoad(path))
+		{
+			std::fprintf(stderr, "Could not load %s\n", path.c_str());
+			continue;
+		}
+
+		CrosswordFiller::Result result;
+		runner.run("fill/" + grid.getName(), [&]()
+		{
+			Crossword crossword(grid);
+			result = filler.fill(crossword, options);
+		}, 3).counter("solved", result.solved).counter("nodes", double(result.nodes)).counter("backtracks", double(result.backtracks));
+	}
+}
+
+/*
+* Fills with a small node budget on a generated grid. The synthetic dictionary cannot fill it, so every fill has to
+* stop on the budget. Returns false if one placed more words than the budget allows.
+*/
+static bool benchFillBudget(bench::Runner& runner, const utils::Dictionary& dictionary)
+{
+	utils::ThreadPool pool;
+	CrosswordGenerator generator(dictionary);
+	CrosswordGenerator::Options layout;
+	layout.rows = 8;
+	layout.cols = 10;
+	layout.count = 1;
+	layout.seed = SEED;
+	const auto grids = generator.generate(layout, pool);
+	if (grids.empty())
+		return true;
+
+	CrosswordFiller filler(dictionary);
+	CrosswordFiller::Options options;
+	options.maxNodes = 2000;
+	options.seed = SEED;
+
+	bool withinBudget = true;
+	const auto check = [&](const std::string& name, const CrosswordFiller::Result& result)
+	{
+		if (result.nodes <= options.maxNodes)
+			return;
+		std::fprintf(stderr, "%s placed %llu words with a budget of %llu\n", name.c_str(), (unsigned long long)result.nodes, (unsigned long long)options.maxNodes);
+		withinBudget = false;
+	};
+
+	CrosswordFiller::Result result;
+	runner.run("fill/budget/8x10", [&]()
+	{
+		Crossword crossword(grids[0]);
+		result = filler.fill(crossword, options);
+	}, 3).counter("solved", result.solved).counter("nodes", double(result.nodes));
+	check("fill/budget/8x10", result);
+
+	for (const uint32_t splitDepth : { 0u, 1u, 2u })
+	{
+		options.splitDepth = splitDepth;
+		const std::string name = "fillParallel/budget/8x10/split" + std::to_string(splitDepth);
+		runner.run(name, [&]()
+		{
+			Crossword crossword(grids[0]);
+			result = filler.fillParallel(crossword, pool, options);
+		}, 3).counter("solved", result.solved).counter("nodes", double(result.nodes)).counter("threads", double(pool.size()));
+		check(name, result);
+	}
+	return withinBudget;
+}
+
+static void benchGenerate(bench::Runner& runner, const utils::Dictionary& dictionary)
+{
+	utils::ThreadPool pool;
+	CrosswordGenerator generator(dictionary);
+	CrosswordGenerator::Options options;
+	options.rows = 15;
+	options.cols = 20;
+	options.candidates = 16;
+	options.count = 16;
+	options.seed = SEED;
+
+	size_t numLayouts = 0;
+	runner.run("generate/15x20", [&]()
+	{
+		numLayouts = generator.generate(options, pool).size();
+		bench::doNotOptimize(numLayouts);
+	}, 3).counter("layouts", double(numLayouts)).counter("threads", double(pool.size()));
+}
+
+int main(int argc, char** argv)
+{
+	Arguments arguments;
+	if (!parseArguments(argc, argv, arguments))
+	{
+		std::fprintf(stderr, "Usage: %s [--json out.json] [--filter text] [--config config.ini] [--work dir] [--samples n] [grid.ctb ...]\n", argv[0]);
+		return 1;
+	}
+	utils::Logger::getInstance().setLevel(utils::LOG_LEVEL_WARN);
+
+	const std::string dictionaryPath = arguments.workDirectory + "/suitebench_dictionary.txt";
+	const std::string configPath = arguments.workDirectory + "/suitebench_config.ini";
+	if (!writeSyntheticDictionary(dictionaryPath, 200000) || !writeConfig(configPath, dictionaryPath))
+	{
+		std::fprintf(stderr, "Could not write the synthetic dictionary in %s\n", arguments.workDirectory.c_str());
+		return 1;
+	}
+
+	bench::Runner runner(arguments.runner);
+
+	// Loads first, so their peak RSS is not raised by the other benchmarks
+	benchLoad(runner, "dictionary/load/synthetic", configPath);
+	if (!arguments.configPath.empty())
+		benchLoad(runner, "dictionary/load/config", arguments.configPath);
+
+	utils::Dictionary synthetic(configPath);
+	synthetic.shuffle(SEED);
+	benchFindPossible(runner, "findPossible/synthetic", synthetic);
+	benchLevenstein(runner, synthetic);
+	benchCrosswordFiles(runner, arguments.workDirectory);
+	benchGenerate(runner, synthetic);
+	const bool withinBudget = benchFillBudget(runner, synthetic);
+
+	std::unique_ptr<utils::Dictionary> real;
+	if (!arguments.configPath.empty())
+	{
+		real = std::make_unique<utils::Dictionary>(arguments.configPath);
+		real->shuffle(SEED);
+		benchFindPossible(runner, "findPossible/config", *real);
+	}
+	benchFill(runner, real ? *real : synthetic, arguments.grids);
+
+	VLOG_FLUSH();
+	runner.printTable();
+	if (!arguments.jsonPath.empty())
+	{
+		std::ofstream fout(arguments.jsonPath);
+		runner.writeJson(fout, argv[0]);
+		if (!fout)
+		{
+			std::fprintf(stderr, "Could not write %s\n", arguments.jsonPath.c_str());
+			return 1;
+		}
+	}
+	return withinBudget ? 0 : 1;
+}
@@ -0,0 +1,113 @@
+#include "bktree.hpp"
+#include "editdistance.hpp"
+
+#include <algorithm>
+#include <queue>
+
+namespace utils
+{
+
+void BKTree::build(const StringTable& words)
+{
+	_words = &words;
+	_nodes.clear();
+	_nodes.reserve(words.size());
+	for (WordId id = 0; id < words.size(); ++id)
+		insert(id);
+}
+
+void BKTree::insert(WordId word)
+{
+	const std::string_view text = (*_words)[word];
+	if (_nodes.empty())
+	{
+		_nodes.push_back({ word, 0 });
+		return;
+	}
+
+	uint32_t node = 0;
+	while (true)
+	{
+		const uint32_t distance = editDistance(text, (*_words)[_nodes[node].word]);
+
+		uint32_t child = _nodes[node].firstChild;
+		while (child != NO_NODE && _nodes[child].distance != distance)
+			child = _nodes[child].nextSibling;
+
+		if (child == NO_NODE)
+		{
+			// Equal words end up as a chain of children at distance 0
+			const uint32_t added = uint32_t(_nodes.size());
+			_nodes.push_back({ word, distance, NO_NODE, _nodes[node].firstChild });
+			_nodes[node].firstChild = added;
+			return;
+		}
+		node = child;
+	}
+}
+
+std::vector<BKTree::Match> BKTree::findNearest(std::string_view word, size_t k, uint32_t maxDistance) const
+{
+	std::vector<Match> result;
+	if (_nodes.empty() || k == 0)
+		return result;
+
+	auto worse = [](const Match& a, const Match& b) { return a.distance == b.distance ? a.id < b.id : a.distance < b.distance; };
+	std::priority_queue<Match, std::vector<Match>, decltype(worse)> best(worse); // The worst of the k best matches on top
+
+	// Best first: a node is entered in order of the smallest distance its subtree can have to the query
+	struct Pending
+	{
+		uint32_t lowerBound;
+		uint32_t node;
+		bool operator<(const Pending& other) const { return lowerBound > other.lowerBound; }
+	};
+	std::priority_queue<Pending> pending;
+	pending.push({ 0, 0 });
+
+	while (!pending.empty())
+	{
+		const Pending next = pending.top();
+		pending.pop();
+
+		// Radius of the search: the worst match once there are k of them
+		uint32_t radius = best.size() == k ? best.top().distance : maxDistance;
+		if (next.lowerBound > radius)
+			break; // Every other pending node is at least as far
+
+		const Node& node = _nodes[next.node];
+
+		// Past radius + the longest edge neither the node nor any child can be within the radius, so the exact distance is not needed
+		uint32_t longestEdge = 0;
+		for (uint32_t child = node.firstChild; child != NO_NODE; child = _nodes[child].nextSibling)
+			longestEdge = std::max(longestEdge, _nodes[child].distance);
+		const uint32_t bound = radius > UINT32_MAX - 1 - longestEdge ? UINT32_MAX : radius + longestEdge;
+		const uint32_t distance = editDistance(word, (*_words)[node.word], bound);
+		const Match match = { node.word, distance };
+		if (distance <= maxDistance && (best.size() < k || worse(match, best.top())))
+		{
+			best.push(match);
+			if (best.size() > k)
+				best.pop();
+			radius = best.size() == k ? best.top().distance : maxDistance;
+		}
+
+		for (uint32_t child = node.firstChild; child != NO_NODE; child = _nodes[child].nextSibling)
+		{
+			const uint32_t edge = _nodes[child].distance;
+			const uint32_t lowerBound = std::max(next.lowerBound, edge > distance ? edge - distance : distance - edge); // Triangle inequality
+			if (lowerBound <= radius)
+				pending.push({ lowerBound, child });
+		}
+	}
+
+	result.resize(best.size());
+	for (size_t i = best.size(); i > 0; --i)
+	{
+		result[i - 1] = best.top();
+		best.pop();
+	}
+	return result;
+}
+
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <inttypes.h>
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+#include "stringtable.hpp"
+
+namespace utils
+{
+	/*
+	* Burkhard-Keller tree over a word table, for nearest neighbour queries by edit distance.
+	* Every child hangs under its parent at their edit distance, so by the triangle inequality a query within distance `tau`
+	* of its answers only has to enter children whose edge is in [d - tau, d + tau], d being the query's distance to the parent.
+	* Nodes are 16 bytes in one array, children are linked as siblings.
+	*/
+	class BKTree
+	{
+	public:
+
+		using WordId = uint32_t;
+
+		struct Match
+		{
+			WordId id;
+			uint32_t distance;
+		};
+
+	public:
+
+		void build(const StringTable& words); // Word ids are indices in `words`. The table has to outlive the tree.
+
+		// The (at most) k words closest to `word` within maxDistance, by increasing distance and then id
+		std::vector<Match> findNearest(std::string_view word, size_t k, uint32_t maxDistance) const;
+
+		size_t size() const { return _nodes.size(); }
+		size_t memoryUsage() const { return _nodes.capacity() * sizeof(Node); }
+
+	private:
+
+		const static uint32_t NO_NODE = UINT32_MAX;
+
+		struct Node
+		{
+			WordId word;
+			uint32_t distance; // To the parent
+			uint32_t firstChild = NO_NODE;
+			uint32_t nextSibling = NO_NODE;
+		};
+
+		void insert(WordId word);
+
+	private:
+
+		const StringTable* _words = nullptr;
+		std::vector<Node> _nodes; // _nodes[0] is the root
+	};
+}
@@ -1,12 +1,11 @@
 #include "crossword.hpp"
 #include "dictionary.hpp"
 #include "logger.hpp"
+#include "mappedfile.hpp"
 
 #include <algorithm>
 #include <iostream>
 #include <fstream>
-#include <map>
-#include <set>
 
 Crossword::Crossword()
 {
@@ -21,16 +20,6 @@ Crossword::~Crossword()
 {
 }
 
-Crossword& Crossword::operator=(const Crossword& cpy)
-{
-	_name = cpy._name;
-	_numRows = cpy._numRows;
-	_numCols = cpy._numCols;
-	_board = cpy._board;
-	loadWords();
-	return *this;
-}
-
 void Crossword::loadWords()
 {
 	_crosswordWords.clear();
@@ -49,12 +38,10 @@ void Crossword::loadWords()
 			}
 			CrosswordWord word;
 			word.isHor = 1;
-			for (; start < j; ++start)
-			{
-				word.letters.push_back(&_board[i][start]);
-				word.letterIndices.push_back(i * _numCols + start);
-			}
-			_crosswordWords.emplace_back(std::move(word));
+			word.offset = i * _numCols + start;
+			word.stride = 1;
+			word.length = j - start;
+			_crosswordWords.push_back(word);
 		}
 	}
 
@@ -73,15 +60,24 @@ void Crossword::loadWords()
 			}
 			CrosswordWord word;
 			word.isHor = 0;
-			for (; start < i; ++start)
-			{
-				word.letters.push_back(&_board[start][j]); 
-				word.letterIndices.push_back(start * _numCols + j);
-			}
-			_crosswordWords.emplace_back(std::move(word));
+			word.offset = start * _numCols + j;
+			word.stride = _numCols;
+			word.length = i - start;
+			_crosswordWords.push_back(word);
 		}
 	}
 	std::sort(_crosswordWords.begin(), _crosswordWords.end(), CrosswordWord::sortHelpIndices);
+
+	_cellSlots.assign(_board.size(), CellSlots());
+	for (uint32_t slot = 0; slot < _crosswordWords.size(); ++slot)
+	{
+		const auto& word = _crosswordWords[slot];
+		for (uint32_t i = 0; i < word.length; ++i)
+		{
+			auto& cellSlots = _cellSlots[word.cell(i)];
+			(word.isHor ? cellSlots.horizontal : cellSlots.vertical) = int32_t(slot);
+		}
+	}
 }
 
 void Crossword::printASCII()
@@ -94,20 +90,23 @@ void Crossword::printASCII()
 	{
 		return;
 	}
+	// One message per row, the cell colors are switched inside it
+	std::ostringstream line;
 	for (int i = 0; i < _numRows; i++)
 	{
+		line.str(std::string());
 		for (int j = 0; j < _numCols; j++)
 		{
 			if (isBox(i, j))
 			{
-				VLOG_CUSTOM(0, "  ");
+				line << utils::LogColor{ 0 } << "  ";
 			}
 			else
 			{
-				VLOG_CUSTOM(240," " << _board[i][j]);
+				line << utils::LogColor{ 240 } << " " << _board[i * _numCols + j];
 			}
 		}
-		VLOG_TRACE(std::endl);
+		VLOG_CUSTOM(7, line.str() << utils::LogColor{ 7 } << std::endl);
 	}
 }
 
@@ -117,82 +116,105 @@ void Crossword::load(std::string path)
 	while (path.size() < 5)
 	{
 		VLOG_ERROR("[ERROR]: Invalid path. Try again:" << std::endl);
+		VLOG_FLUSH();
 		std::cin >> path;
 	}
+	while (!tryLoad(path))
+	{
+		VLOG_ERROR("[ERROR]: Invalid path " << normalizePath(path) << ". Try again:" << std::endl);
+		VLOG_FLUSH();
+		std::cin >> path;
+	}
+	printASCII();
+}
+
+bool Crossword::tryLoad(std::string path)
+{
+	path = normalizePath(std::move(path));
+
+	utils::MappedFile file;
+	if (!file.open(path))
+	{
+		*this = Crossword();
+		return false;
+	}
+	return parse(file.data(), file.size(), path.substr(0, path.size() - 4));
+}
+
+std::string Crossword::normalizePath(std::string path)
+{
 	for (size_t i = 0; i < path.size(); i++)
 	{
 		path[i] = tolower(path[i]);
 	}
-	if (path.substr(path.size() - 4, 4) != ".ctb")
+	if (path.size() < 4 || path.substr(path.size() - 4, 4) != ".ctb")
 	{
 		path += ".ctb";
 	}
-	std::ifstream fin(path, std::ios::binary);
-	while (!fin.good())
+	return path;
+}
+
+/* .ctb layout: number of rows, number of columns, then the board row by row in the dos code page */
+bool Crossword::parse(const uint8_t* data, size_t size, std::string name)
+{
+	const size_t numCells = size >= 2 ? size_t(data[0]) * data[1] : 0;
+	if (size < 2 || size - 2 < numCells)
 	{
-		VLOG_ERROR("[ERROR]: Invalid path " << path << ". Try again:" << std::endl);
-		std::cin >> path;
-		if (path.substr(path.size() - 4, 4) != ".ctb")
-		{
-			path += ".ctb";
-		}
-		fin.open(path, std::ios::binary);
+		*this = Crossword();
+		return false;
 	}
-	_name = path.substr(0, path.size() - 4);
 
-	readCrosswordFile(fin);
+	_name = std::move(name);
+	_numRows = data[0];
+	_numCols = data[1];
+	_board.resize(numCells);
+	utils::dosToWinCode(data + 2, _board.data(), numCells);
+
 	loadWords();
-	printASCII();
+	return true;
 }
 
-void Crossword::readCrosswordFile(std::istream& in)
+void Crossword::serialize(std::vector<uint8_t>& out) const
 {
-	in.get(_numRows);
-	in.get(_numCols);
-
-	_board = std::vector<std::vector<uc>>(_numRows, std::vector<uc>(_numCols));
-	
-	for (int i = 0; i < _numRows; i++)
-	{
-		for (int j = 0; j < _numCols; j++)
-		{
-			_board[i][j] = utils::dosToWinCode(in.get());
-		}
-	}
+	const size_t start = out.size();
+	out.resize(start + 2 + _board.size());
+	out[start] = _numRows;
+	out[start + 1] = _numCols;
+	utils::winToDosCode(_board.data(), out.data() + start + 2, _board.size());
 }
 
-void Crossword::save(std::string path)
+bool Crossword::save(std::string path)
 {
 	if (path.empty())
 		path = _name + ".ctb";
 	
-	std::ofstream fout(path, std::ios::binary);
+	std::vector<uint8_t> image;
+	serialize(image);
 
-	fout << _numRows << _numCols;
-	for (int i = 0; i < _numRows; i++)
+	std::ofstream fout(path, std::ios::binary);
+	fout.write(reinterpret_cast<const char*>(image.data()), image.size());
+	if (!fout)
 	{
-		for (int j = 0; j < _numCols; j++)
-		{
-			fout << utils::winToDosCode(_board[i][j]);
-		}
+		VLOG_ERROR("[ERROR]: Crossword::save: Could not write " << path << std::endl);
+		return false;
 	}
 	_name = path;
 	VLOG_INFO("[INFO]: Saved successfully at " << _name << "." << std::endl);
+	return true;
 }
 
 Crossword::CrosswordReport Crossword::generateReport() const
 {
 	CrosswordReport report;
 
-	std::vector<std::string> strWords;
-	std::set<std::string> uniqueWords;
+	robin_hood::unordered_set<BoardWord, BoardWord::Hash> uniqueWords;
+	uniqueWords.reserve(_crosswordWords.size());
 	double lengthSum = 0.0;
 	for (const auto& word : _crosswordWords)
 	{
-		strWords.emplace_back(word.toString());
-		lengthSum += strWords.back().size();
+		lengthSum += word.length;
 	
-		if (!uniqueWords.insert(strWords.back()).second)
+		if (!uniqueWords.insert(BoardWord{ getBoard(), &word }).second)
 		{
 			report.repeatingWords.push_back(&word);
 		}
@@ -218,23 +240,32 @@ Crossword::CrosswordReport Crossword::generateReport() const
 
 bool Crossword::isValid(const Crossword& crossword)
 {
-	auto report = crossword.generateReport();
-	return report.repeatingWords.empty();
+	robin_hood::unordered_set<BoardWord, BoardWord::Hash> uniqueWords;
+	uniqueWords.reserve(crossword._crosswordWords.size());
+	for (const auto& word : crossword._crosswordWords)
+	{
+		if (!uniqueWords.insert(BoardWord{ crossword.getBoard(), &word }).second)
+		{
+			return false;
+		}
+	}
+	return true;
 }
 
 const std::vector<const CrosswordWord*> Crossword::compare(const Crossword& crosswordA, const Crossword& crosswordB)
 {
-	std::map<std::string, const CrosswordWord*> wordsFromCrosswordA;
+	robin_hood::unordered_map<BoardWord, const CrosswordWord*, BoardWord::Hash> wordsFromCrosswordA;
+	wordsFromCrosswordA.reserve(crosswordA._crosswordWords.size());
 	for(const auto& word : crosswordA._crosswordWords)
 	{
-		wordsFromCrosswordA.emplace(word.toString(), &word);
+		wordsFromCrosswordA.emplace(BoardWord{ crosswordA.getBoard(), &word }, &word);
 	}
 
 	std::vector<const CrosswordWord*> res;
 
 	for(const auto& word : crosswordB._crosswordWords)
 	{
-		auto it = wordsFromCrosswordA.find(word.toString());
+		auto it = wordsFromCrosswordA.find(BoardWord{ crosswordB.getBoard(), &word });
 		if(it != wordsFromCrosswordA.end())
 		{
 			res.push_back(it->second);
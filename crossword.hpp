@@ -1,60 +1,179 @@
 #pragma once
 #include <vector>
 #include <string>
+#include <string_view>
 #include <cassert>
 
 #include "crosswordutils.hpp"
+#include "robin_hood.h"
 
 using uc = unsigned char;
 
+/*
+* A slot of the crossword stored as a record over the flat row-major board: cell `i` of the word is board[offset + i * stride].
+* Records hold no pointers, so copying a crossword does not invalidate them.
+*/
 class CrosswordWord
 {
 public: // member variables
-	std::vector<uc*> letters;
-	std::vector<uint32_t> letterIndices;
+	uint32_t offset; // Index of the first letter in the board
+	uint32_t stride; // 1 for horizontal words, number of columns for vertical ones
+	uint32_t length;
 	bool isHor;
 
 public: // member functions
-	std::string toString() const
+	uint32_t cell(uint32_t i) const { return offset + i * stride; } // Board index of the i-th letter
+	std::string toString(const uc* board) const
 	{
-		std::string res(letters.size(), 0);
-		for (size_t i = 0; i < letters.size(); i++)
-			res[i] = *letters[i];
+		std::string res(length, 0);
+		for (uint32_t i = 0; i < length; i++)
+			res[i] = board[cell(i)];
 		return res;
 	}
-	bool fill(const std::string& newWord)
+	bool fill(uc* board, std::string_view newWord) const
 	{
-		assert(newWord.size() == letters.size() && "[LOGICAL ERROR]: The new word has to have the same length as the crossword word!");
-		for (uint32_t i = 0; i < letters.size(); ++i)
-			*letters[i] = newWord[i];
+		assert(newWord.size() == length && "[LOGICAL ERROR]: The new word has to have the same length as the crossword word!");
+		for (uint32_t i = 0; i < length; ++i)
+			board[cell(i)] = newWord[i];
+		return true;
 	}
 
-public: // operators
-	explicit operator std::string() const
+	// Compares the letters in place like std::string::compare, without building strings. The words can be on different boards.
+	int compare(const uc* board, const CrosswordWord& other, const uc* otherBoard) const
 	{
-		return toString();
+		const uint32_t common = length < other.length ? length : other.length;
+		for (uint32_t i = 0; i < common; ++i)
+		{
+			const uc a = board[cell(i)], b = otherBoard[other.cell(i)];
+			if (a != b)
+				return a < b ? -1 : 1;
+		}
+		return length == other.length ? 0 : (length < other.length ? -1 : 1);
 	}
-	bool operator<(const CrosswordWord& other) const
+	bool equals(const uc* board, std::string_view word) const
 	{
-		return toString() < other.toString();
+		if (word.size() != length)
+			return false;
+		for (uint32_t i = 0; i < length; ++i)
+			if (board[cell(i)] != uc(word[i]))
+				return false;
+		return true;
+	}
+	uint64_t hash(const uc* board) const // FNV-1a of the letters. Equal to hashing the string with utils::hashLetter.
+	{
+		uint64_t res = utils::FNV_OFFSET_BASIS;
+		for (uint32_t i = 0; i < length; ++i)
+			res = utils::hashLetter(res, board[cell(i)]);
+		return res;
 	}
 
 public: // static functions
 	// first word to appear in crossword. If they both start in the same square, than the horizontal has priority.
 	static bool sortHelpIndices(const CrosswordWord &A, const CrosswordWord &B)
 	{
-		return A.letterIndices[0] == B.letterIndices[0] ? A.isHor : A.letterIndices[0] < B.letterIndices[0];
+		return A.offset == B.offset ? A.isHor && !B.isHor : A.offset < B.offset;
+	}
+};
+
+/* A slot together with the board holding its letters. Hashed and compared by content, so it can key hash containers. */
+struct BoardWord
+{
+	const uc* board;
+	const CrosswordWord* word;
+
+	bool operator==(const BoardWord& other) const { return word->compare(board, *other.word, other.board) == 0; }
+
+	struct Hash
+	{
+		size_t operator()(const BoardWord& boardWord) const { return size_t(boardWord.word->hash(boardWord.board)); }
+	};
+};
+
+/*
+* The pattern of a slot extracted into a fixed buffer, so it can be passed to Dictionary::findPossible without allocating.
+* Letters are upper case and every other cell becomes ANY_CHAR (0).
+*/
+class SlotPattern
+{
+public:
+	const static uint32_t CAPACITY = 256; // The board is at most 255 cells wide
+
+	void extract(const uc* board, const CrosswordWord& word)
+	{
+		assert(word.length <= CAPACITY && "[LOGICAL ERROR]: Slot is longer than the pattern buffer!");
+		_size = word.length;
+		_numEmpty = 0;
+		for (uint32_t i = 0; i < _size; ++i)
+		{
+			const uc c = board[word.cell(i)];
+			if (utils::isCyrillicChar(c))
+			{
+				_letters[i] = char(c >= utils::CYRILLIC_A ? c - 32 : c);
+			}
+			else
+			{
+				_letters[i] = 0;
+				++_numEmpty;
+			}
+		}
+	}
+
+	std::string_view view() const { return std::string_view(_letters, _size); }
+	bool isComplete() const { return _numEmpty == 0; }
+
+private:
+	char _letters[CAPACITY];
+	uint32_t _size = 0;
+	uint32_t _numEmpty = 0; // Cells which are not letters
+};
+
+/*
+* Counts how many times every word is placed in a crossword, so adding or removing a word and checking for repeats
+* is O(word length). Keys are views: the words have to outlive the tracker.
+*/
+class DuplicateTracker
+{
+public:
+	void add(std::string_view word)
+	{
+		if (++_counts[word] > 1)
+			++_numRepeats;
 	}
-	static bool sortHelpString(const CrosswordWord& A, const CrosswordWord& B)
+	void remove(std::string_view word) // Has to be added before
 	{
-		return A.toString() < B.toString();
+		auto it = _counts.find(word);
+		assert(it != _counts.end() && "[LOGICAL ERROR]: Removing a word which is not tracked!");
+		if (--it->second == 0)
+			_counts.erase(it);
+		else
+			--_numRepeats;
 	}
+	void clear()
+	{
+		_counts.clear();
+		_numRepeats = 0;
+	}
+
+	bool contains(std::string_view word) const { return _counts.find(word) != _counts.end(); }
+	uint32_t numRepeats() const { return _numRepeats; } // Placements of words which were already placed
+
+private:
+	robin_hood::unordered_map<std::string_view, uint32_t> _counts;
+	uint32_t _numRepeats = 0;
 };
 
 class Crossword
 {
 public:
 
+	constexpr static int32_t NO_SLOT = -1;
+
+	struct CellSlots
+	{
+		int32_t horizontal = NO_SLOT; // Index in getWords() of the horizontal word through the cell
+		int32_t vertical = NO_SLOT;
+	};
+
 	struct CrosswordReport
 	{
 		std::vector<const CrosswordWord*> repeatingWords; // words which are counted twice or more in the same crossword
@@ -70,24 +189,36 @@ public:
 private:
 
 	std::string _name;
-	char _numRows = 0;
-	char _numCols = 0;
+	uint8_t _numRows = 0;
+	uint8_t _numCols = 0;
 
-	std::vector<std::vector<uc>> _board;
+	std::vector<uc> _board; // Row-major, _numRows * _numCols cells
 	std::vector<CrosswordWord> _crosswordWords;
+	std::vector<CellSlots> _cellSlots; // For every cell the slots going through it
 
 private:
 
 	void loadWords();
-	void readCrosswordFile(std::istream& inStream);
+	static std::string normalizePath(std::string path); // Lower case with the .ctb extension
 
 public:
 
-	bool isBox(int i, int j) const { return utils::isBox(_board[i][j]); }
+	bool isBox(int i, int j) const { return utils::isBox(_board[i * getNumCols() + j]); }
+	const std::string& getName() const { return _name; }
+	uint32_t getNumRows() const { return _numRows; }
+	uint32_t getNumCols() const { return _numCols; }
+	const std::vector<CrosswordWord>& getWords() const { return _crosswordWords; } // Sorted by CrosswordWord::sortHelpIndices
+	const CellSlots& getCellSlots(uint32_t cell) const { return _cellSlots[cell]; }
+	uc* getBoard() { return _board.data(); }
+	const uc* getBoard() const { return _board.data(); }
+	std::string toString(const CrosswordWord& word) const { return word.toString(_board.data()); }
 
 	void printASCII();
-	void load(std::string path);
-	void save(std::string path = "");
+	void load(std::string path); // Asks for another path on std::cin until a crossword is loaded. Prints the loaded grid.
+	bool tryLoad(std::string path); // Headless load: no prompts, no printing. Leaves the crossword empty and returns false on failure.
+	bool save(std::string path = ""); // Writes the .ctb file in one call. Returns false if it could not be written.
+	bool parse(const uint8_t* data, size_t size, std::string name); // Reads a .ctb image from memory (a mapped file, a network payload). Leaves the crossword empty and returns false if it is truncated.
+	void serialize(std::vector<uint8_t>& out) const; // Appends the .ctb image of the crossword
 	CrosswordReport generateReport() const;
 	bool isValid() { return Crossword::isValid(*this); }
 
@@ -95,10 +226,6 @@ public:
 	Crossword(std::string path);
 	~Crossword();
 
-public:
-
-	Crossword& operator=(const Crossword& cpy);
-
 public:
 
 	static bool isValid(const Crossword& crossword);
@@ -0,0 +1,112 @@
+#include "crosswordbatch.hpp"
+#include "logger.hpp"
+
+#include <algorithm>
+
+void CrosswordBatch::load(const std::vector<std::string>& paths, utils::ThreadPool& pool)
+{
+	std::vector<Crossword> crosswords(paths.size());
+	std::vector<char> loaded(paths.size(), 0); // Not vector<bool>: every task writes its own element
+
+	for (size_t i = 0; i < paths.size(); ++i)
+	{
+		pool.submit([&crosswords, &loaded, &paths, i]() { loaded[i] = crosswords[i].tryLoad(paths[i]); });
+	}
+	pool.wait();
+
+	_crosswords.clear();
+	_reports.clear();
+	_failedPaths.clear();
+	_crosswords.reserve(paths.size());
+	for (size_t i = 0; i < paths.size(); ++i)
+	{
+		if (loaded[i])
+		{
+			_crosswords.push_back(std::move(crosswords[i]));
+		}
+		else
+		{
+			_failedPaths.push_back(paths[i]);
+		}
+	}
+
+	// The reports point into _crosswords, so they are generated once it does not move anymore
+	_reports.resize(_crosswords.size());
+	for (size_t i = 0; i < _crosswords.size(); ++i)
+	{
+		pool.submit([this, i]() { _reports[i] = _crosswords[i].generateReport(); });
+	}
+	pool.wait();
+
+	buildIndex();
+	VLOG_INFO("[INFO]: CrosswordBatch::load: Loaded " << _crosswords.size() << " crosswords with " << _answers.size() << " different answers (" << _failedPaths.size() << " failed)" << std::endl);
+}
+
+void CrosswordBatch::buildIndex()
+{
+	_answers.clear();
+	for (uint32_t crossword = 0; crossword < _crosswords.size(); ++crossword)
+	{
+		const auto& words = _crosswords[crossword].getWords();
+		for (uint32_t slot = 0; slot < words.size(); ++slot)
+		{
+			SlotPattern answer;
+			answer.extract(_crosswords[crossword].getBoard(), words[slot]);
+			if (!answer.isComplete())
+			{
+				continue; // Unfilled slots are not answers
+			}
+			_answers[std::string(answer.view())].push_back({ crossword, slot });
+		}
+	}
+}
+
+const std::vector<CrosswordBatch::SlotRef>& CrosswordBatch::findAnswer(const std::string& answer) const
+{
+	static const std::vector<SlotRef> none;
+
+	auto it = _answers.find(answer);
+	return it == _answers.end() ? none : it->second;
+}
+
+std::vector<CrosswordBatch::Repeat> CrosswordBatch::findRepeats() const
+{
+	std::vector<Repeat> repeats;
+	for (const auto& answer : _answers)
+	{
+		const auto& occurrences = answer.second;
+		if (occurrences.front().crossword != occurrences.back().crossword) // Occurrences are in load order
+		{
+			repeats.push_back({ answer.first, occurrences });
+		}
+	}
+
+	std::sort(repeats.begin(), repeats.end(), [](const Repeat& a, const Repeat& b) { return a.occurrences.front() < b.occurrences.front(); });
+	return repeats;
+}
+
+void CrosswordBatch::report() const
+{
+	for (const auto& report : _reports)
+	{
+		VLOG_INFO("[INFO]: " << report.crosswordName << ": " << report.rows << "x" << report.cols << ", " << report.numWords << " words, average length "
+			<< report.averageWordLength << ", boxed area " << report.boxedAreaCoef << ", " << report.repeatingWords.size() << " repeats inside" << std::endl);
+	}
+
+	for (const auto& repeat : findRepeats())
+	{
+		// One message per repeat, so lines of other threads cannot end up inside it
+		std::string names;
+		for (const auto& occurrence : repeat.occurrences)
+		{
+			names += ' ';
+			names += _crosswords[occurrence.crossword].getName();
+		}
+		VLOG_WARN("[WARN]: " << repeat.answer << " is used in" << names << std::endl);
+	}
+
+	for (const auto& path : _failedPaths)
+	{
+		VLOG_ERROR("[ERROR]: Could not load " << path << std::endl);
+	}
+}
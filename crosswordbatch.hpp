@@ -0,0 +1,57 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <string_view>
+
+#include "crossword.hpp"
+#include "threadpool.hpp"
+#include "robin_hood.h"
+
+/*
+* Headless validation of many .ctb files at once.
+* The files are loaded and reported in parallel, then every answer goes into one inverted index
+* from answer to the slots using it, so repeats between crosswords are found in a single pass instead of a compare per pair.
+*/
+class CrosswordBatch
+{
+public:
+
+	struct SlotRef
+	{
+		uint32_t crossword; // Index in getCrosswords()
+		uint32_t slot; // Index in Crossword::getWords()
+
+		bool operator<(const SlotRef& other) const { return crossword == other.crossword ? slot < other.slot : crossword < other.crossword; }
+	};
+
+	struct Repeat
+	{
+		std::string answer;
+		std::vector<SlotRef> occurrences; // In load order. Spans at least two crosswords.
+	};
+
+public:
+
+	// Loads every path with Crossword::tryLoad. Files which cannot be loaded are skipped and listed in getFailedPaths().
+	void load(const std::vector<std::string>& paths, utils::ThreadPool& pool);
+
+	const std::vector<Crossword>& getCrosswords() const { return _crosswords; }
+	const std::vector<Crossword::CrosswordReport>& getReports() const { return _reports; } // Indexed like getCrosswords()
+	const std::vector<std::string>& getFailedPaths() const { return _failedPaths; }
+
+	const std::vector<SlotRef>& findAnswer(const std::string& answer) const; // Every slot holding `answer` (upper case). Only complete slots are indexed.
+	std::vector<Repeat> findRepeats() const; // Answers used in more than one crossword, ordered by first occurrence
+	void report() const; // Logs the reports and the repeats
+
+private:
+
+	void buildIndex();
+
+private:
+
+	std::vector<Crossword> _crosswords;
+	std::vector<Crossword::CrosswordReport> _reports;
+	std::vector<std::string> _failedPaths;
+
+	robin_hood::unordered_map<std::string, std::vector<SlotRef>> _answers; // Inverted index over all loaded crosswords
+};
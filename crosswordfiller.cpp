@@ -0,0 +1,598 @@
+#include "crosswordfiller.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+
+#include <algorithm>
+
+/* Tells a dictionary-bound fill (dictionaryNanoseconds close to the fill time) from a search-bound one */
+struct FillerMetrics
+{
+	utils::Metrics& metrics = utils::Metrics::getInstance();
+	utils::Counter& solved = metrics.counter("filler_fills_total", "Finished fills by outcome", "result=\"solved\"");
+	utils::Counter& failed = metrics.counter("filler_fills_total", "Finished fills by outcome", "result=\"failed\"");
+	utils::Histogram& fillSeconds = metrics.histogram("filler_fill_seconds", "Duration of a fill", utils::Histogram::exponentialBounds(1e-4, 4, 12));
+	utils::Counter& nodes = metrics.counter("filler_nodes_total", "Words placed by the search");
+	utils::Counter& backtracks = metrics.counter("filler_backtracks_total", "Words undone by the search");
+	utils::Histogram& backtrackDepth = metrics.histogram("filler_backtrack_depth", "Assigned slots (fixed ones included) when a word was undone", utils::Histogram::linearBounds(0, 8, 24));
+	utils::Histogram& slotSeconds = metrics.histogram("filler_slot_seconds", "Time to choose a slot and get its candidates", utils::Histogram::exponentialBounds(1e-7, 2, 20));
+	utils::Counter& dictionaryNanoseconds = metrics.counter("filler_dictionary_nanoseconds_total", "Time the search spent in dictionary calls, estimated from samples");
+	utils::Counter& backjumps = metrics.counter("filler_backjumps_total", "Search levels skipped by conflict-directed backjumping");
+	utils::Counter& nogoodHits = metrics.counter("filler_nogood_hits_total", "Slots rejected by the nogood store");
+};
+
+static FillerMetrics& getMetrics()
+{
+	static FillerMetrics metrics;
+	return metrics;
+}
+
+CrosswordFiller::CrosswordFiller(const utils::Dictionary& dictionary) :
+	_dictionary(dictionary)
+{
+}
+
+void CrosswordFiller::prepare(Crossword& crossword)
+{
+	const auto& words = crossword.getWords();
+
+	_board = crossword.getBoard();
+	_slots = words.data();
+	_numSlots = uint32_t(words.size());
+	_crossings.assign(words.size(), {});
+	_assigned.assign(words.size(), false);
+	_candidateCounts.assign(words.size(), 0);
+	_numAssigned = 0;
+	_writeTrail.clear();
+	_countTrail.clear();
+	_usedWords.clear();
+	_fixedWords.clear();
+
+	_searchStack.clear();
+	_searched.assign(words.size(), false);
+	_conflictWords = (words.size() + 63) / 64;
+	_conflicts.assign((words.size() + 1) * _conflictWords, 0); // The search is at most one level per slot deep
+	_failedConflict.assign(_conflictWords, 0);
+	_stopped = false;
+
+	for (uint32_t slot = 0; slot < _numSlots; ++slot)
+	{
+		const auto& word = _slots[slot];
+		for (uint32_t i = 0; i < word.length; ++i)
+		{
+			const auto& cellSlots = crossword.getCellSlots(word.cell(i));
+			const int32_t crossing = word.isHor ? cellSlots.vertical : cellSlots.horizontal;
+			if (crossing != Crossword::NO_SLOT)
+			{
+				const auto& other = _slots[crossing];
+				_crossings[slot].push_back({ uint32_t(crossing), i, (word.cell(i) - other.offset) / other.stride });
+			}
+		}
+	}
+
+	_fixedWords.reserve(_numSlots); // The tracker keeps views into the fixed words
+	for (uint32_t slot = 0; slot < _numSlots; ++slot)
+	{
+		const SlotPattern pattern = getPattern(slot);
+		if (pattern.isComplete())
+		{
+			// Complete words are kept as they are, even if they are not in the dictionary
+			_assigned[slot] = true;
+			++_numAssigned;
+			_fixedWords.emplace_back(pattern.view());
+			_usedWords.add(_fixedWords.back());
+			continue;
+		}
+		_candidateCounts[slot] = countCandidates(slot);
+	}
+}
+
+/* Builds the pattern of a slot from the board. Every cell which is not a letter matches any letter. */
+SlotPattern CrosswordFiller::getPattern(uint32_t slot) const
+{
+	SlotPattern pattern;
+	pattern.extract(_board, _slots[slot]);
+	return pattern;
+}
+
+void CrosswordFiller::place(uint32_t slot, std::string_view word)
+{
+	const auto& slotWord = _slots[slot];
+	for (uint32_t i = 0; i < slotWord.length; ++i)
+	{
+		const uint32_t cell = slotWord.cell(i);
+		if (_board[cell] != uc(word[i]))
+		{
+			_writeTrail.push_back({ cell, _board[cell] });
+			_board[cell] = uc(word[i]);
+		}
+	}
+}
+
+bool CrosswordFiller::forwardCheck(uint32_t slot)
+{
+	for (const auto& crossing : _crossings[slot])
+	{
+		if (_assigned[crossing.slot])
+			continue;
+
+		_countTrail.push_back({ crossing.slot, _candidateCounts[crossing.slot] });
+		_candidateCounts[crossing.slot] = countCandidates(crossing.slot);
+
+		if (_candidateCounts[crossing.slot] == 0)
+		{
+			_wipedOut = crossing.slot;
+			return false;
+		}
+	}
+	return true;
+}
+
+void CrosswordFiller::undo(size_t writeMark, size_t countMark)
+{
+	while (_writeTrail.size() > writeMark)
+	{
+		_board[_writeTrail.back().cell] = _writeTrail.back().oldValue;
+		_writeTrail.pop_back();
+	}
+	while (_countTrail.size() > countMark)
+	{
+		_candidateCounts[_countTrail.back().slot] = _countTrail.back().oldCount;
+		_countTrail.pop_back();
+	}
+}
+
+/* FNV-1a, so the deterministic order does not depend on the standard library's hash */
+static uint64_t hashPattern(std::string_view pattern)
+{
+	uint64_t hash = utils::FNV_OFFSET_BASIS;
+	for (char c : pattern)
+		hash = utils::hashLetter(hash, uint8_t(c));
+	return hash;
+}
+
+uint32_t CrosswordFiller::chooseSlot() const
+{
+	uint32_t slot = 0;
+	size_t fewestCandidates = SIZE_MAX;
+	for (uint32_t i = 0; i < _numSlots; ++i)
+	{
+		if (!_assigned[i] && _candidateCounts[i] < fewestCandidates)
+		{
+			slot = i;
+			fewestCandidates = _candidateCounts[i];
+		}
+	}
+	return slot;
+}
+
+utils::Dictionary::Pattern CrosswordFiller::getCandidates(uint32_t slot) const
+{
+	VMETRIC_TIME_SAMPLED(getMetrics().dictionaryNanoseconds);
+	const SlotPattern pattern = getPattern(slot);
+	if (_options.deterministic)
+	{
+		const uint64_t seed = _options.seed ^ hashPattern(pattern.view());
+		return _options.overlay ? _dictionary.findPossible(pattern.view(), seed, *_options.overlay) : _dictionary.findPossible(pattern.view(), seed);
+	}
+	return findPossible(pattern.view());
+}
+
+utils::Dictionary::Pattern CrosswordFiller::findPossible(std::string_view pattern) const
+{
+	return _options.overlay ? _dictionary.findPossible(pattern, *_options.overlay) : _dictionary.findPossible(pattern);
+}
+
+/* Counting straight from the index is cheaper than building a Pattern. The overlay can only be applied to the words themselves. */
+size_t CrosswordFiller::countCandidates(uint32_t slot) const
+{
+	VMETRIC_TIME_SAMPLED(getMetrics().dictionaryNanoseconds);
+	const SlotPattern pattern = getPattern(slot);
+	return _options.overlay ? findPossible(pattern.view()).size : _dictionary.countPossible(pattern.view());
+}
+
+/*
+* The support ignores the overlay, so it can only let through candidates which forwardCheck then rejects,
+* never skip one which it would accept.
+*/
+void CrosswordFiller::getSupports(uint32_t slot, std::vector<Support>& supports) const
+{
+	VMETRIC_TIME_SAMPLED(getMetrics().dictionaryNanoseconds);
+	supports.clear();
+	const SlotPattern own = getPattern(slot);
+	for (const auto& crossing : _crossings[slot])
+	{
+		if (_assigned[crossing.slot] || own.view()[crossing.position] != utils::Dictionary::ANY_CHAR)
+			continue; // A filled cell already constrains the candidates of `slot` itself
+
+		const SlotPattern pattern = getPattern(crossing.slot);
+		supports.push_back({ crossing.slot, crossing.position, _dictionary.getLetterSupport(pattern.view(), crossing.crossingPosition) });
+	}
+}
+
+int32_t CrosswordFiller::findUnsupported(std::string_view word, const std::vector<Support>& supports)
+{
+	for (size_t i = 0; i < supports.size(); ++i)
+	{
+		const int letter = utils::PatternIndex::letterIndex(uint8_t(word[supports[i].position]));
+		if (letter < 0 || !(supports[i].letters & (1u << letter)))
+			return int32_t(i);
+	}
+	return -1;
+}
+
+void CrosswordFiller::NogoodStore::reset(size_t capacity)
+{
+	size_t size = capacity ? 2 : 0;
+	while (size && size < capacity)
+		size <<= 1;
+	_entries.assign(size, Key{ 0, 0 });
+	_mask = size ? size / 2 - 1 : 0;
+}
+
+bool CrosswordFiller::NogoodStore::contains(Key key) const
+{
+	const size_t bucket = (key.hash & _mask) * 2;
+	return _entries[bucket] == key || _entries[bucket + 1] == key;
+}
+
+void CrosswordFiller::NogoodStore::insert(Key key)
+{
+	Key* bucket = &_entries[(key.hash & _mask) * 2];
+	if (bucket[0] == key || bucket[1] == key)
+		return;
+	if (bucket[0].check != 0 && bucket[1].check == 0)
+		bucket[1] = key;
+	else
+		bucket[(key.check >> 63) & (bucket[0].check != 0)] = key; // A full bucket replaces one of its entries at random
+}
+
+/* The slot and its pattern, then for every crossing slot a separator and its pattern unless it is placed */
+CrosswordFiller::NogoodStore::Key CrosswordFiller::getNogoodKey(uint32_t slot) const
+{
+	NogoodStore::Key key;
+	key.add(uint8_t(slot));
+	key.add(uint8_t(slot >> 8));
+	const SlotPattern own = getPattern(slot);
+	for (const char c : own.view())
+		key.add(uint8_t(c));
+	for (const auto& crossing : _crossings[slot])
+	{
+		key.add(0xFF);
+		if (_assigned[crossing.slot])
+			continue;
+		const SlotPattern pattern = getPattern(crossing.slot);
+		for (const char c : pattern.view())
+			key.add(uint8_t(c));
+	}
+	key.check |= 1;
+	return key;
+}
+
+void CrosswordFiller::addCulprits(uint32_t slot, uint64_t* conflict, uint32_t except) const
+{
+	for (const auto& crossing : _crossings[slot])
+	{
+		if (_searched[crossing.slot] && crossing.slot != except)
+			conflict[crossing.slot >> 6] |= uint64_t(1) << (crossing.slot & 63);
+	}
+}
+
+void CrosswordFiller::addLocalCulprits(uint32_t slot, uint64_t* conflict) const
+{
+	addCulprits(slot, conflict, slot);
+	for (const auto& crossing : _crossings[slot])
+	{
+		if (!_assigned[crossing.slot])
+			addCulprits(crossing.slot, conflict, slot);
+	}
+}
+
+/* Repeats are rare, so the slot is found by comparing the placed words */
+bool CrosswordFiller::addRepeatCulprit(std::string_view word, uint64_t* conflict) const
+{
+	for (const uint32_t placed : _searchStack)
+	{
+		if (_slots[placed].equals(_board, word))
+		{
+			conflict[placed >> 6] |= uint64_t(1) << (placed & 63);
+			return true;
+		}
+	}
+	return false;
+}
+
+bool CrosswordFiller::fail(const uint64_t* conflict)
+{
+	std::copy(conflict, conflict + _conflictWords, _failedConflict.begin());
+	return false;
+}
+
+bool CrosswordFiller::assign(uint32_t slot, std::string_view word)
+{
+	_assigned[slot] = true;
+	++_numAssigned;
+	place(slot, word);
+	_usedWords.add(word);
+	return forwardCheck(slot);
+}
+
+void CrosswordFiller::unassign(uint32_t slot, std::string_view word, size_t writeMark, size_t countMark)
+{
+	_usedWords.remove(word);
+	undo(writeMark, countMark);
+	_assigned[slot] = false;
+	--_numAssigned;
+}
+
+bool CrosswordFiller::isStopped()
+{
+	if (_parallel)
+	{
+		if (_parallel->shouldStop(*_rank))
+			return true;
+		// Claims a node of the shared budget. A claim past it is given back and cancels every task, so nodes never exceed maxNodes.
+		if (_parallel->nodes.fetch_add(1, std::memory_order_relaxed) < _options.maxNodes || !_options.maxNodes)
+			return false;
+		_parallel->nodes.fetch_sub(1, std::memory_order_relaxed);
+		_parallel->cancelled = true;
+		return true;
+	}
+	return _options.maxNodes && _result.nodes >= _options.maxNodes;
+}
+
+/*
+* The conflict set of a level starts with the slots which wrote its pattern, as they ruled out every other word.
+* Each rejected word adds the slots behind its rejection. When the words run out the set goes up: the levels whose slot
+* is not in it return at once, and the first one which is merges it into its own set and tries its next word.
+*/
+bool CrosswordFiller::search()
+{
+	if (_numAssigned == _numSlots)
+		return true;
+
+#if VMETRICS_ENABLED
+	utils::Stopwatch slotStopwatch;
+#endif
+	// Most constrained slot first
+	const uint32_t slot = chooseSlot();
+	const size_t level = _searchStack.size();
+	uint64_t* conflict = getConflict(level);
+	std::fill(conflict, conflict + _conflictWords, 0);
+	addCulprits(slot, conflict, slot);
+	if (_candidateCounts[slot] == 0)
+		return fail(conflict);
+
+	NogoodStore::Key nogood;
+	if (_nogoods.enabled())
+	{
+		nogood = getNogoodKey(slot);
+		if (_nogoods.contains(nogood))
+		{
+			++_result.nogoodHits;
+			addLocalCulprits(slot, conflict);
+			return fail(conflict);
+		}
+	}
+
+	std::vector<Support> supports;
+	getSupports(slot, supports);
+
+	auto possible = getCandidates(slot);
+	VMETRIC_OBSERVE(getMetrics().slotSeconds, slotStopwatch.lap());
+
+	bool local = true; // Every word failed without a deeper search or a repeat, so the patterns around the slot decided it
+	for (const auto candidate : possible)
+	{
+		const std::string_view word = candidate.word;
+		if (!_options.allowRepeats && isUsed(word))
+		{
+			if (addRepeatCulprit(word, conflict))
+				local = false; // Fixed words stay for the whole fill, words placed by search do not
+			continue;
+		}
+		const int32_t unsupported = findUnsupported(word, supports);
+		if (unsupported >= 0)
+		{
+			addCulprits(supports[unsupported].slot, conflict, slot); // A crossing slot would have no words left
+			continue;
+		}
+
+		if (isStopped())
+		{
+			_stopped = true;
+			return false;
+		}
+		++_result.nodes;
+
+		const size_t writeMark = _writeTrail.size();
+		const size_t countMark = _countTrail.size();
+
+		_searched[slot] = true;
+		_searchStack.push_back(slot);
+		if (assign(slot, word))
+		{
+			if (search())
+				return true;
+
+			local = false;
+			if (_stopped || (_options.backjumping && !hasSlot(_failedConflict.data(), slot)))
+			{
+				// This word had no part in the failure below, so neither would the next ones
+				_searchStack.pop_back();
+				_searched[slot] = false;
+				unassign(slot, word, writeMark, countMark);
+				_result.backjumps += !_stopped;
+				return false;
+			}
+			for (size_t i = 0; i < _conflictWords; ++i)
+				conflict[i] |= _failedConflict[i];
+			conflict[slot >> 6] &= ~(uint64_t(1) << (slot & 63));
+		}
+		else
+		{
+			addCulprits(_wipedOut, conflict, slot);
+		}
+
+		_searchStack.pop_back();
+		_searched[slot] = false;
+		unassign(slot, word, writeMark, countMark);
+		++_result.backtracks;
+		VMETRIC_OBSERVE(getMetrics().backtrackDepth, double(_numAssigned));
+	}
+
+	if (local && _nogoods.enabled())
+		_nogoods.insert(nogood);
+	return fail(conflict);
+}
+
+CrosswordFiller::Result CrosswordFiller::fill(Crossword& crossword, const Options& options)
+{
+	_options = options;
+	_result = Result();
+	_parallel = nullptr;
+
+	VMETRIC_TIME(getMetrics().fillSeconds);
+	prepare(crossword);
+	_nogoods.reset(_options.nogoodCapacity);
+	_result.solved = search();
+	VMETRIC_ADD(getMetrics().nodes, _result.nodes);
+	VMETRIC_ADD(getMetrics().backtracks, _result.backtracks);
+	VMETRIC_ADD(getMetrics().backjumps, _result.backjumps);
+	VMETRIC_ADD(getMetrics().nogoodHits, _result.nogoodHits);
+	VMETRIC_INC(_result.solved ? getMetrics().solved : getMetrics().failed);
+
+	if (!_result.solved)
+	{
+		undo(0, 0);
+		VLOG_WARN("[WARN]: CrosswordFiller::fill: Could not fill " << crossword.getName() << " (" << _result.nodes << " nodes, " << _result.backtracks << " backtracks)" << std::endl);
+	}
+	else
+	{
+		VLOG_INFO("[INFO]: CrosswordFiller::fill: Filled " << crossword.getName() << " (" << _result.nodes << " nodes, " << _result.backtracks << " backtracks)" << std::endl);
+	}
+	return _result;
+}
+
+/*
+* Every task stops once the node budget is spent. In deterministic mode only tasks which come after the best solution so
+* far stop, so the first solution in sequential order wins.
+*/
+bool CrosswordFiller::ParallelSearch::shouldStop(const std::vector<uint32_t>& rank)
+{
+	if (cancelled.load(std::memory_order_relaxed))
+		return true;
+	if (options.maxNodes && nodes.load(std::memory_order_relaxed) >= options.maxNodes)
+	{
+		cancelled = true;
+		return true;
+	}
+	if (!hasSolution.load(std::memory_order_acquire))
+		return false;
+
+	std::lock_guard<std::mutex> lock(solutionMutex);
+	return solutionRank < rank;
+}
+
+void CrosswordFiller::ParallelSearch::submitSolution(const std::vector<uint32_t>& rank, const Crossword& board)
+{
+	std::lock_guard<std::mutex> lock(solutionMutex);
+	if (hasSolution && !(rank < solutionRank))
+		return;
+
+	solutionRank = rank;
+	solution = board;
+	hasSolution = true;
+	if (!options.deterministic)
+		cancelled = true;
+}
+
+void CrosswordFiller::runTask(ParallelSearch& parallel, Task task)
+{
+	if (parallel.shouldStop(task.rank))
+		return;
+
+	Crossword board(*parallel.original);
+	CrosswordFiller filler(_dictionary);
+	filler._options = parallel.options;
+	filler._parallel = &parallel;
+	filler._rank = &task.rank;
+	filler.prepare(board);
+
+	auto finish = [&]()
+	{
+		parallel.backtracks.fetch_add(filler._result.backtracks, std::memory_order_relaxed);
+		parallel.backjumps.fetch_add(filler._result.backjumps, std::memory_order_relaxed);
+		parallel.nogoodHits.fetch_add(filler._result.nogoodHits, std::memory_order_relaxed);
+	};
+
+	for (const auto& placement : task.placements)
+	{
+		if (!filler.assign(placement.slot, placement.word))
+			return finish();
+	}
+
+	if (task.placements.size() >= parallel.options.splitDepth || filler._numAssigned == filler._numSlots)
+	{
+		filler._nogoods.reset(parallel.options.nogoodCapacity); // Only the tasks which search need one
+		if (filler.search())
+			parallel.submitSolution(task.rank, board);
+		return finish();
+	}
+
+	// Split this level into one task per candidate
+	const uint32_t slot = filler.chooseSlot();
+	if (filler._candidateCounts[slot] == 0)
+		return finish();
+
+	auto possible = filler.getCandidates(slot);
+	uint32_t rank = 0;
+	for (const auto candidate : possible)
+	{
+		const uint32_t i = rank++;
+		const std::string_view word = candidate.word;
+		if (!parallel.options.allowRepeats && filler.isUsed(word))
+			continue;
+		if (parallel.shouldStop(task.rank))
+			break;
+
+		Task subtask{ task.placements, task.rank };
+		subtask.placements.push_back({ slot, word });
+		subtask.rank.push_back(i);
+		parallel.pool->submit([this, &parallel, subtask = std::move(subtask)]() mutable { runTask(parallel, std::move(subtask)); });
+	}
+	finish();
+}
+
+CrosswordFiller::Result CrosswordFiller::fillParallel(Crossword& crossword, utils::ThreadPool& pool, const Options& options)
+{
+	ParallelSearch parallel;
+	parallel.original = &crossword;
+	parallel.options = options;
+	parallel.pool = &pool;
+
+	VMETRIC_TIME(getMetrics().fillSeconds);
+	pool.submit([this, &parallel]() { runTask(parallel, Task()); });
+	pool.wait();
+
+	_result = Result();
+	_result.solved = parallel.hasSolution;
+	_result.nodes = parallel.nodes;
+	_result.backtracks = parallel.backtracks;
+	_result.backjumps = parallel.backjumps;
+	_result.nogoodHits = parallel.nogoodHits;
+	VMETRIC_ADD(getMetrics().nodes, _result.nodes);
+	VMETRIC_ADD(getMetrics().backtracks, _result.backtracks);
+	VMETRIC_ADD(getMetrics().backjumps, _result.backjumps);
+	VMETRIC_ADD(getMetrics().nogoodHits, _result.nogoodHits);
+	VMETRIC_INC(_result.solved ? getMetrics().solved : getMetrics().failed);
+
+	if (!_result.solved)
+	{
+		VLOG_WARN("[WARN]: CrosswordFiller::fillParallel: Could not fill " << crossword.getName() << " (" << _result.nodes << " nodes, " << _result.backtracks << " backtracks)" << std::endl);
+		return _result;
+	}
+
+	crossword = parallel.solution;
+	VLOG_INFO("[INFO]: CrosswordFiller::fillParallel: Filled " << crossword.getName() << " on " << pool.size() << " threads (" << _result.nodes << " nodes, " << _result.backtracks << " backtracks)" << std::endl);
+	return _result;
+}
@@ -0,0 +1,220 @@
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <string>
+#include <string_view>
+
+#include "crossword.hpp"
+#include "dictionary.hpp"
+#include "threadpool.hpp"
+#include "robin_hood.h"
+
+/*
+* Backtracking crossword filler.
+* Picks the unfilled slot with the fewest possible words, tries its words in Pattern order and
+* forward checks every crossing slot after each placement. Board writes are undone from a trail.
+* Candidates whose letter on an empty crossing cell no word of the crossing slot has there are skipped without placing them.
+* A word is never placed twice in the same crossword (see Crossword::isValid).
+*
+* Dead ends are not undone one level at a time: every level collects the placed slots which caused its failures
+* (conflict-directed backjumping) and the search returns straight to the most recent of them.
+* A slot whose words all failed without a deeper search failed because of its own pattern and the patterns of its
+* crossing slots only. That combination goes in a bounded nogood store, so it is rejected at once when it comes back.
+*
+* fillParallel splits the top `splitDepth` levels of the search tree into tasks for a work-stealing ThreadPool.
+* Every task works on its own copy of the board and stops as soon as another task found a solution.
+*/
+class CrosswordFiller
+{
+public:
+
+	struct Options
+	{
+		uint64_t maxNodes = 0; // Gives up after this many placements (over all threads). 0 means no limit.
+		bool allowRepeats = false; // Allow the same word in multiple slots
+		uint32_t splitDepth = 2; // fillParallel: number of levels which are split into tasks
+		bool deterministic = false; // Candidates are ordered by `seed` and the pattern instead of the dictionary's shuffle seed. fillParallel returns the same solution as fill.
+		uint64_t seed = 0;
+		const utils::Dictionary::Overlay* overlay = nullptr; // Words to leave out, e.g. the ones already used in this issue. Has to outlive the fill.
+		bool backjumping = true; // false backtracks chronologically
+		size_t nogoodCapacity = 1 << 15; // Entries of the nogood store (rounded up to a power of two), per search task of fillParallel. 0 disables it.
+	};
+
+	struct Result
+	{
+		bool solved = false;
+		uint64_t nodes = 0; // Number of placed words
+		uint64_t backtracks = 0; // Number of undone words
+		uint64_t backjumps = 0; // Levels skipped because their slot had no part in the conflict below them
+		uint64_t nogoodHits = 0; // Slots rejected by the nogood store
+	};
+
+public:
+
+	CrosswordFiller(const utils::Dictionary& dictionary);
+
+	// Fills every slot of `crossword` which is not already complete. The crossword is left untouched if there is no solution.
+	Result fill(Crossword& crossword) { return fill(crossword, Options()); }
+	Result fill(Crossword& crossword, const Options& options);
+	Result fillParallel(Crossword& crossword, utils::ThreadPool& pool) { return fillParallel(crossword, pool, Options()); }
+	Result fillParallel(Crossword& crossword, utils::ThreadPool& pool, const Options& options);
+
+private:
+
+	using WordId = utils::Dictionary::WordId;
+
+	struct CellWrite
+	{
+		uint32_t cell; // Index in the board
+		uc oldValue;
+	};
+
+	struct CountChange
+	{
+		uint32_t slot;
+		size_t oldCount;
+	};
+
+	struct Crossing
+	{
+		uint32_t slot; // The crossing slot
+		uint32_t position; // Of the shared cell in this slot
+		uint32_t crossingPosition; // Of the shared cell in the crossing slot
+	};
+
+	struct Support
+	{
+		uint32_t slot; // The crossing slot
+		uint32_t position;
+		uint32_t letters; // Dictionary::getLetterSupport mask
+	};
+
+	/*
+	* Lossy set of local dead ends. The key hashes the slot, its pattern and the patterns of its crossing slots twice,
+	* with two different hashes, so a false hit (which would cut off a solution) needs both to collide.
+	* Two entries per bucket. A full bucket drops one of its entries.
+	*/
+	class NogoodStore
+	{
+	public:
+		struct Key
+		{
+			uint64_t hash = utils::FNV_OFFSET_BASIS;
+			uint64_t check = 0; // Never 0 once stored: 0 marks an empty entry
+
+			void add(uint8_t c)
+			{
+				hash = utils::hashLetter(hash, c);
+				check = (check + c + 1) * 0x9E3779B97F4A7C15ull;
+				check ^= check >> 29;
+			}
+			bool operator==(const Key& other) const { return hash == other.hash && check == other.check; }
+		};
+
+		void reset(size_t capacity);
+		bool enabled() const { return !_entries.empty(); }
+		bool contains(Key key) const;
+		void insert(Key key);
+
+	private:
+		std::vector<Key> _entries;
+		size_t _mask = 0;
+	};
+
+	struct Placement
+	{
+		uint32_t slot;
+		std::string_view word; // Points into the dictionary word table
+	};
+
+	struct Task
+	{
+		std::vector<Placement> placements; // Path from the root of the search tree
+		std::vector<uint32_t> rank; // Candidate index of every placement. Lower ranks come first in sequential order.
+	};
+
+	struct ParallelSearch
+	{
+		const Crossword* original;
+		Options options;
+		utils::ThreadPool* pool;
+
+		std::atomic<bool> cancelled{ false };
+		std::atomic<bool> hasSolution{ false };
+		std::atomic<uint64_t> nodes{ 0 };
+		std::atomic<uint64_t> backtracks{ 0 };
+		std::atomic<uint64_t> backjumps{ 0 };
+		std::atomic<uint64_t> nogoodHits{ 0 };
+
+		std::mutex solutionMutex;
+		std::vector<uint32_t> solutionRank;
+		Crossword solution;
+
+		bool shouldStop(const std::vector<uint32_t>& rank);
+		void submitSolution(const std::vector<uint32_t>& rank, const Crossword& board);
+	};
+
+private:
+
+	void prepare(Crossword& crossword);
+	bool search();
+	void runTask(ParallelSearch& parallel, Task task);
+
+	uint32_t chooseSlot() const; // Unassigned slot with the fewest candidates
+	utils::Dictionary::Pattern getCandidates(uint32_t slot) const;
+	utils::Dictionary::Pattern findPossible(std::string_view pattern) const; // Applies the overlay of the options
+	size_t countCandidates(uint32_t slot) const;
+	void getSupports(uint32_t slot, std::vector<Support>& supports) const; // Letters the empty crossing cells of `slot` can take
+	static int32_t findUnsupported(std::string_view word, const std::vector<Support>& supports); // Index of the first support the word breaks or -1
+	SlotPattern getPattern(uint32_t slot) const;
+	void place(uint32_t slot, std::string_view word);
+	bool assign(uint32_t slot, std::string_view word); // Places the word and forward checks. Has to be undone even if it fails.
+	bool forwardCheck(uint32_t slot); // Updates the candidate counts of the slots crossing `slot`. Returns false if one of them has no words left.
+	void unassign(uint32_t slot, std::string_view word, size_t writeMark, size_t countMark);
+	void undo(size_t writeMark, size_t countMark);
+	bool isStopped();
+
+	/* Conflict sets are bitsets over the slots. Only slots placed by search are added: the others are never undone. */
+	uint64_t* getConflict(size_t level) { return &_conflicts[level * _conflictWords]; }
+	static bool hasSlot(const uint64_t* conflict, uint32_t slot) { return (conflict[slot >> 6] >> (slot & 63)) & 1; }
+	void addCulprits(uint32_t slot, uint64_t* conflict, uint32_t except) const; // The searched slots which wrote letters of `slot`
+	void addLocalCulprits(uint32_t slot, uint64_t* conflict) const; // Everything a local dead end of `slot` depends on
+	bool addRepeatCulprit(std::string_view word, uint64_t* conflict) const; // Adds the searched slot which holds `word`. false if a fixed word holds it.
+	bool fail(const uint64_t* conflict); // Hands the conflict set to the level above. Returns false.
+	NogoodStore::Key getNogoodKey(uint32_t slot) const;
+
+	bool isUsed(std::string_view word) const { return _usedWords.contains(word); }
+
+private:
+
+	const utils::Dictionary& _dictionary;
+	Options _options;
+	Result _result;
+
+	ParallelSearch* _parallel = nullptr; // Set while running as a task of fillParallel
+	const std::vector<uint32_t>* _rank = nullptr; // Rank of the running task
+
+	uc* _board = nullptr; // Flat board of the crossword being filled
+	const CrosswordWord* _slots = nullptr; // Crossword::getWords()
+	uint32_t _numSlots = 0;
+	std::vector<std::vector<Crossing>> _crossings; // For every slot the slots sharing a cell with it
+	std::vector<bool> _assigned;
+	std::vector<size_t> _candidateCounts; // Pattern size of every unassigned slot
+	uint32_t _numAssigned = 0;
+
+	std::vector<CellWrite> _writeTrail;
+	std::vector<CountChange> _countTrail;
+
+	std::vector<uint32_t> _searchStack; // Slots placed by search, in order
+	std::vector<bool> _searched; // Set for the slots on _searchStack
+	size_t _conflictWords = 0; // uint64_t words per conflict set
+	std::vector<uint64_t> _conflicts; // One conflict set per search level
+	std::vector<uint64_t> _failedConflict; // Conflict set of the level which just failed
+	uint32_t _wipedOut = 0; // The crossing slot which had no words left in the last failed forwardCheck
+	bool _stopped = false; // maxNodes or another task ended the search
+	NogoodStore _nogoods;
+
+	DuplicateTracker _usedWords; // Placed words point into the dictionary word table, fixed ones into _fixedWords
+	std::vector<std::string> _fixedWords; // Complete words which were already in the crossword
+};
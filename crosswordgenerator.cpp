@@ -0,0 +1,234 @@
+#include "crosswordgenerator.hpp"
+#include "logger.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+static const double OUTSIDE_DENSITY_WEIGHT = 100.0;
+
+CrosswordGenerator::CrosswordGenerator(const utils::Dictionary& dictionary) :
+	_dictionary(dictionary)
+{
+}
+
+CrosswordGenerator::Evaluation CrosswordGenerator::evaluate(const Options& options, const std::vector<uint8_t>& boxes, Scratch& scratch) const
+{
+	const uint32_t rows = options.rows, cols = options.cols;
+	Evaluation evaluation;
+	std::fill(scratch.lengthCounts.begin(), scratch.lengthCounts.end(), 0);
+	scratch.covered.assign(boxes.size(), 0);
+
+	// Maximal runs of letters of at least two cells are the slots
+	uint32_t numSlots = 0;
+	auto addRun = [&](uint32_t start, uint32_t length, uint32_t stride)
+	{
+		if (length < 2)
+			return;
+		++numSlots;
+		++scratch.lengthCounts[length];
+		evaluation.violations += length < options.minLength || length > options.maxLength;
+		for (uint32_t k = 0; k < length; ++k)
+			scratch.covered[start + k * stride] = 1;
+	};
+	for (uint32_t i = 0; i < rows; ++i)
+	{
+		uint32_t start = 0;
+		for (uint32_t j = 0; j <= cols; ++j)
+		{
+			if (j == cols || boxes[i * cols + j])
+			{
+				addRun(i * cols + start, j - start, 1);
+				start = j + 1;
+			}
+		}
+	}
+	for (uint32_t j = 0; j < cols; ++j)
+	{
+		uint32_t start = 0;
+		for (uint32_t i = 0; i <= rows; ++i)
+		{
+			if (i == rows || boxes[i * cols + j])
+			{
+				addRun(start * cols + j, i - start, cols);
+				start = i + 1;
+			}
+		}
+	}
+
+	uint32_t numBoxes = 0;
+	for (uint32_t i = 0; i < rows; ++i)
+	{
+		for (uint32_t j = 0; j < cols; ++j)
+		{
+			const uint32_t cell = i * cols + j;
+			if (!boxes[cell])
+			{
+				evaluation.violations += !scratch.covered[cell]; // Nothing would ever fill it
+				continue;
+			}
+
+			++numBoxes;
+			if (options.clueBoxes && i > 0 && j > 0)
+			{
+				const bool startsRight = j + 2 < cols && !boxes[cell + 1] && !boxes[cell + 2];
+				const bool startsBelow = i + 2 < rows && !boxes[cell + cols] && !boxes[cell + 2 * cols];
+				evaluation.violations += !startsRight && !startsBelow;
+			}
+		}
+	}
+
+	// No word is placed twice, so a length needs at least as many words as it has slots
+	for (uint32_t length = 2; length < scratch.lengthCounts.size(); ++length)
+	{
+		if (scratch.lengthCounts[length] > _wordsByLength[length])
+			evaluation.violations += uint32_t(scratch.lengthCounts[length] - _wordsByLength[length]);
+	}
+
+	// Outside of maxDensityError every box counts much more than the lengths, so the search heads back into it first
+	evaluation.densityError = std::abs(double(numBoxes) / double(boxes.size()) - options.boxDensity);
+	evaluation.error = evaluation.densityError + OUTSIDE_DENSITY_WEIGHT * std::max(0.0, evaluation.densityError - options.maxDensityError);
+	if (!_targetDistribution.empty() && numSlots > 0)
+	{
+		double distance = 0;
+		for (uint32_t length = 0; length < scratch.lengthCounts.size(); ++length)
+		{
+			const double target = length < _targetDistribution.size() ? _targetDistribution[length] : 0.0;
+			distance += std::abs(double(scratch.lengthCounts[length]) / numSlots - target);
+		}
+		evaluation.error += distance / 2;
+	}
+	return evaluation;
+}
+
+/* Hill climbing from random boxes. Toggles which keep the layout as good are taken too, so it can cross plateaus. */
+CrosswordGenerator::Layout CrosswordGenerator::searchLayout(const Options& options, uint64_t seed) const
+{
+	const uint32_t rows = options.rows, cols = options.cols;
+	const uint32_t firstFree = options.clueBoxes ? 1 : 0; // Row and column
+	std::mt19937_64 rng(seed);
+
+	// The border boxes count towards the density
+	const double numCells = double(rows) * cols;
+	const double numFree = double(rows - firstFree) * (cols - firstFree);
+	std::bernoulli_distribution isBox(std::clamp((options.boxDensity * numCells - (numCells - numFree)) / numFree, 0.0, 1.0));
+
+	Layout layout;
+	layout.boxes.assign(size_t(rows) * cols, 0);
+	for (uint32_t i = 0; i < rows; ++i)
+	{
+		for (uint32_t j = 0; j < cols; ++j)
+		{
+			layout.boxes[i * cols + j] = i < firstFree || j < firstFree || isBox(rng);
+		}
+	}
+
+	Scratch scratch;
+	scratch.lengthCounts.assign(std::max(rows, cols) + 1, 0);
+	layout.evaluation = evaluate(options, layout.boxes, scratch);
+
+	std::uniform_int_distribution<uint32_t> row(firstFree, rows - 1), col(firstFree, cols - 1);
+	const uint32_t patience = std::max<uint32_t>(1, options.iterations / 4);
+	uint32_t sinceImprovement = 0;
+	for (uint32_t iteration = 0; iteration < options.iterations && sinceImprovement < patience; ++iteration)
+	{
+		const uint32_t cell = row(rng) * cols + col(rng);
+		layout.boxes[cell] ^= 1;
+		const Evaluation evaluation = evaluate(options, layout.boxes, scratch);
+		if (!(evaluation <= layout.evaluation))
+		{
+			layout.boxes[cell] ^= 1;
+			++sinceImprovement;
+			continue;
+		}
+
+		const bool improved = !(layout.evaluation <= evaluation);
+		sinceImprovement = improved ? 0 : sinceImprovement + 1;
+		layout.evaluation = evaluation;
+	}
+	return layout;
+}
+
+/* Builds the .ctb image, so the grid goes through the same parsing as a hand-drawn one */
+Crossword CrosswordGenerator::toCrossword(const Options& options, const std::vector<uint8_t>& boxes, std::string name)
+{
+	std::vector<uint8_t> image(2 + boxes.size());
+	image[0] = uint8_t(options.rows);
+	image[1] = uint8_t(options.cols);
+	for (size_t cell = 0; cell < boxes.size(); ++cell)
+		image[2 + cell] = boxes[cell] ? utils::DOS_BOX_CHAR : uint8_t(' ');
+
+	Crossword crossword;
+	crossword.parse(image.data(), image.size(), std::move(name));
+	return crossword;
+}
+
+std::vector<Crossword> CrosswordGenerator::generate(const Options& options, utils::ThreadPool& pool)
+{
+	_stats = Stats();
+	if (options.rows < 3 || options.cols < 3 || options.rows > UINT8_MAX || options.cols > UINT8_MAX || options.minLength > options.maxLength)
+	{
+		VLOG_ERROR("[ERROR]: CrosswordGenerator::generate: Invalid options: " << options.rows << "x" << options.cols << " grid with slots of " << options.minLength << " to " << options.maxLength << " letters" << std::endl);
+		return {};
+	}
+
+	const uint32_t longestSlot = std::max(options.rows, options.cols);
+	_wordsByLength.assign(longestSlot + 1, 0);
+	for (uint32_t length = 2; length <= longestSlot && length < utils::Dictionary::LONGEST_WORD; ++length)
+		_wordsByLength[length] = _dictionary.countPossible(std::string(length, char(utils::Dictionary::ANY_CHAR)));
+
+	_targetDistribution.clear();
+	double totalWeight = 0;
+	for (const double weight : options.lengthDistribution)
+		totalWeight += std::max(0.0, weight);
+	if (totalWeight > 0)
+	{
+		for (const double weight : options.lengthDistribution)
+			_targetDistribution.push_back(std::max(0.0, weight) / totalWeight);
+	}
+
+	std::vector<Layout> layouts(options.candidates);
+	for (uint32_t i = 0; i < options.candidates; ++i)
+	{
+		pool.submit([this, &options, &layouts, i]()
+		{
+			std::seed_seq seed{ uint32_t(options.seed), uint32_t(options.seed >> 32), i };
+			std::mt19937_64 seeder(seed);
+			layouts[i] = searchLayout(options, seeder());
+		});
+	}
+	pool.wait();
+
+	// Valid layouts, best first. Ties keep the candidate order, so the result is reproducible.
+	std::vector<uint32_t> order;
+	for (uint32_t i = 0; i < options.candidates; ++i)
+	{
+		const auto& evaluation = layouts[i].evaluation;
+		if (evaluation.violations)
+			++_stats.infeasible;
+		else if (evaluation.densityError > options.maxDensityError)
+			++_stats.tooFar;
+		else
+			order.push_back(i);
+	}
+	std::stable_sort(order.begin(), order.end(), [&layouts](uint32_t a, uint32_t b) { return layouts[a].evaluation.error < layouts[b].evaluation.error; });
+	_stats.candidates = options.candidates;
+
+	std::vector<Crossword> crosswords;
+	robin_hood::unordered_set<std::string> seen;
+	for (const uint32_t i : order)
+	{
+		if (crosswords.size() >= options.count)
+			break;
+		if (!seen.insert(std::string(layouts[i].boxes.begin(), layouts[i].boxes.end())).second)
+		{
+			++_stats.duplicates;
+			continue;
+		}
+		crosswords.push_back(toCrossword(options, layouts[i].boxes, options.namePrefix + "_" + std::to_string(crosswords.size())));
+	}
+
+	VLOG_INFO("[INFO]: CrosswordGenerator::generate: Generated " << crosswords.size() << " " << options.rows << "x" << options.cols << " layouts from " << _stats.candidates << " candidates ("
+		<< _stats.infeasible << " infeasible, " << _stats.tooFar << " too far from the box density, " << _stats.duplicates << " duplicates)" << std::endl);
+	return crosswords;
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include <vector>
+#include <string>
+
+#include "crossword.hpp"
+#include "dictionary.hpp"
+#include "threadpool.hpp"
+
+/*
+* Generates empty grids (box layouts) ready for the filler.
+* Every candidate starts from random boxes at the target density and toggles one cell at a time, keeping a toggle
+* if it does not make the layout worse. A layout is worse if it breaks more rules: slots outside the length bounds,
+* letter cells in no slot, boxes which hold no clue, or more slots of a length than the dictionary has words of it
+* (counted once per length with Dictionary::countPossible). Among layouts breaking the same number of rules, the one
+* closer to the box density and the slot length distribution is better.
+* Candidates are searched in parallel, each from its own seed, so the result does not depend on the number of threads.
+*/
+class CrosswordGenerator
+{
+public:
+
+	struct Options
+	{
+		uint32_t rows = 15;
+		uint32_t cols = 20;
+		double boxDensity = 0.2; // Target of Crossword::CrosswordReport::boxedAreaCoef
+		double maxDensityError = 0.02; // Layouts further from the target are not returned
+		uint32_t minLength = 2; // Of a slot
+		uint32_t maxLength = 12;
+		std::vector<double> lengthDistribution; // Relative weight of every slot length (the index). Empty means any distribution.
+		bool clueBoxes = true; // The clue of every slot is in the box left of or above it: the first row and column are boxes and every other box starts a slot
+		uint32_t count = 10; // Layouts to return
+		uint32_t candidates = 64; // Layouts to search
+		uint32_t iterations = 4000; // Toggles tried per candidate. A candidate also stops after iterations / 4 toggles without an improvement.
+		uint64_t seed = 0;
+		std::string namePrefix = "generated"; // Layout i is named `namePrefix_i`
+	};
+
+	struct Stats
+	{
+		uint32_t candidates = 0;
+		uint32_t infeasible = 0; // Still broke a rule when their search stopped
+		uint32_t tooFar = 0; // Further than maxDensityError from the box density
+		uint32_t duplicates = 0;
+	};
+
+public:
+
+	CrosswordGenerator(const utils::Dictionary& dictionary);
+
+	// The best layouts, best first. Fewer than options.count if not enough candidates were valid.
+	std::vector<Crossword> generate(const Options& options, utils::ThreadPool& pool);
+	const Stats& getStats() const { return _stats; }
+
+private:
+
+	struct Evaluation
+	{
+		uint32_t violations = 0; // Broken rules
+		double densityError = 0; // Distance of the box density from the target
+		double error = 0; // densityError (weighted up beyond maxDensityError) plus the total variation distance of the slot lengths from the target distribution
+
+		bool operator<=(const Evaluation& other) const { return violations != other.violations ? violations < other.violations : error <= other.error; }
+	};
+
+	struct Layout
+	{
+		std::vector<uint8_t> boxes; // 1 for a box, row-major
+		Evaluation evaluation;
+	};
+
+	/* Buffers of one evaluation, reused over the search of a candidate */
+	struct Scratch
+	{
+		std::vector<uint32_t> lengthCounts; // Slots of every length
+		std::vector<uint8_t> covered; // Letter cells in a slot
+	};
+
+	Layout searchLayout(const Options& options, uint64_t seed) const;
+	Evaluation evaluate(const Options& options, const std::vector<uint8_t>& boxes, Scratch& scratch) const;
+	static Crossword toCrossword(const Options& options, const std::vector<uint8_t>& boxes, std::string name);
+
+private:
+
+	const utils::Dictionary& _dictionary;
+	std::vector<size_t> _wordsByLength; // Dictionary words of every slot length. Filled by generate before the search.
+	std::vector<double> _targetDistribution; // Normalized options.lengthDistribution. Empty means any.
+	Stats _stats;
+};
@@ -0,0 +1,234 @@
+#include "crosswordrender.hpp"
+#include "logger.hpp"
+
+#include <algorithm>
+#include <fstream>
+
+/* Splits `text` into lines of at most maxChars, breaking at spaces where it can */
+static void wrapLines(std::string_view text, size_t maxChars, std::vector<std::string_view>& lines)
+{
+	lines.clear();
+	while (!text.empty())
+	{
+		while (!text.empty() && text.front() == ' ')
+			text.remove_prefix(1);
+		if (text.empty())
+			break;
+		if (text.size() <= maxChars)
+		{
+			lines.push_back(text);
+			break;
+		}
+
+		size_t end = text.rfind(' ', maxChars);
+		if (end == std::string_view::npos || end == 0)
+			end = maxChars; // A word longer than the line is cut
+		lines.push_back(text.substr(0, end));
+		text.remove_prefix(end);
+	}
+}
+
+/* The slot starting at `cell` in the given direction or NO_SLOT */
+static int32_t findSlotStartingAt(const Crossword& crossword, uint32_t cell, bool horizontal)
+{
+	const auto& cellSlots = crossword.getCellSlots(cell);
+	const int32_t slot = horizontal ? cellSlots.horizontal : cellSlots.vertical;
+	if (slot == Crossword::NO_SLOT || crossword.getWords()[slot].offset != cell)
+		return Crossword::NO_SLOT;
+	return slot;
+}
+
+std::string CrosswordRenderer::getOutputName(const Crossword& crossword)
+{
+	const std::string& name = crossword.getName();
+	const size_t slash = name.find_last_of("/\\");
+	return slash == std::string::npos ? name : name.substr(slash + 1);
+}
+
+void CrosswordRenderer::writeText(SVG::SVGWriter& out, double x, double y, double fontSize, std::string_view text) const
+{
+	out.beginTag("text");
+	out.attribute("font-size", fontSize);
+	out.attribute("text-anchor", "middle");
+	out.attribute("x", x);
+	out.attribute("y", y);
+	out.endTag();
+	out.winText(text);
+	out.close();
+}
+
+void CrosswordRenderer::render(const Crossword& crossword, const utils::Dictionary& dictionary, SVG::SVGWriter& out) const
+{
+	const double cell = _options.cellSize;
+	const uint32_t rows = crossword.getNumRows(), cols = crossword.getNumCols();
+	const uc* board = crossword.getBoard();
+
+	SVG::GetRoot(out, cols * cell, rows * cell);
+	for (uint32_t i = 0; i < rows; ++i)
+	{
+		for (uint32_t j = 0; j < cols; ++j)
+		{
+			const uc c = board[i * cols + j];
+			if (c == utils::SPECIAL_BOX_CHAR)
+			{
+				continue; // Covered by renderImages
+			}
+
+			SVG::GetBox(out, j * cell, i * cell, cell, cell, _options.strokeWidth);
+			if (c == utils::BOX_CHAR)
+			{
+				renderExplanations(crossword, dictionary, i, j, out);
+			}
+			else if (_options.drawLetters && utils::isCyrillicChar(c))
+			{
+				writeText(out, (j + 0.5) * cell, (i + 0.5) * cell + _options.letterSize * 0.35, _options.letterSize, std::string_view(reinterpret_cast<const char*>(&c), 1));
+			}
+		}
+	}
+	renderImages(crossword, out);
+	out.close();
+}
+
+/* The box is shared by the explanation of the word starting right of it and the one starting under it */
+void CrosswordRenderer::renderExplanations(const Crossword& crossword, const utils::Dictionary& dictionary, uint32_t row, uint32_t col, SVG::SVGWriter& out) const
+{
+	const uint32_t rows = crossword.getNumRows(), cols = crossword.getNumCols();
+
+	std::string_view explanations[2];
+	size_t numExplanations = 0;
+	const int32_t slots[2] = {
+		col + 1 < cols ? findSlotStartingAt(crossword, row * cols + col + 1, true) : Crossword::NO_SLOT,
+		row + 1 < rows ? findSlotStartingAt(crossword, (row + 1) * cols + col, false) : Crossword::NO_SLOT
+	};
+	for (const int32_t slot : slots)
+	{
+		if (slot == Crossword::NO_SLOT)
+			continue;
+
+		SlotPattern answer;
+		answer.extract(crossword.getBoard(), crossword.getWords()[slot]);
+		if (!answer.isComplete())
+			continue;
+
+		const std::string_view explanation = dictionary.getExplanation(answer.view());
+		if (!explanation.empty())
+			explanations[numExplanations++] = explanation;
+	}
+	if (numExplanations == 0)
+		return;
+
+	const double cell = _options.cellSize, fontSize = _options.explanationSize;
+	const double lineHeight = fontSize * 1.15;
+	const double partHeight = cell / numExplanations;
+	const size_t maxChars = std::max<size_t>(1, size_t(cell / (fontSize * 0.55)));
+	const size_t maxLines = std::max<size_t>(1, size_t(partHeight / lineHeight));
+
+	thread_local std::vector<std::string_view> lines;
+	for (size_t k = 0; k < numExplanations; ++k)
+	{
+		wrapLines(explanations[k], maxChars, lines);
+		const size_t numLines = std::min(lines.size(), maxLines);
+		const double top = row * cell + k * partHeight + (partHeight - numLines * lineHeight) / 2;
+		for (size_t line = 0; line < numLines; ++line)
+		{
+			writeText(out, (col + 0.5) * cell, top + (line + 0.8) * lineHeight, fontSize, lines[line]);
+		}
+	}
+}
+
+/* Every 4-connected group of SPECIAL_BOX_CHAR cells gets one image over its bounding rectangle. Groups are numbered in row-major order. */
+void CrosswordRenderer::renderImages(const Crossword& crossword, SVG::SVGWriter& out) const
+{
+	const uint32_t rows = crossword.getNumRows(), cols = crossword.getNumCols();
+	const uc* board = crossword.getBoard();
+	const double cell = _options.cellSize;
+	const std::string name = getOutputName(crossword);
+
+	std::vector<char> visited(size_t(rows) * cols, 0);
+	std::vector<uint32_t> stack;
+	uint32_t numImages = 0;
+	for (uint32_t start = 0; start < visited.size(); ++start)
+	{
+		if (visited[start] || board[start] != utils::SPECIAL_BOX_CHAR)
+			continue;
+
+		uint32_t top = rows, left = cols, bottom = 0, right = 0;
+		visited[start] = 1;
+		stack.assign(1, start);
+		while (!stack.empty())
+		{
+			const uint32_t current = stack.back();
+			stack.pop_back();
+			const uint32_t i = current / cols, j = current % cols;
+			top = std::min(top, i);
+			bottom = std::max(bottom, i);
+			left = std::min(left, j);
+			right = std::max(right, j);
+
+			const uint32_t neighbours[4] = { i > 0 ? current - cols : current, i + 1 < rows ? current + cols : current, j > 0 ? current - 1 : current, j + 1 < cols ? current + 1 : current };
+			for (const uint32_t next : neighbours)
+			{
+				if (!visited[next] && board[next] == utils::SPECIAL_BOX_CHAR)
+				{
+					visited[next] = 1;
+					stack.push_back(next);
+				}
+			}
+		}
+
+		out.beginTag("image");
+		out.attribute("height", (bottom - top + 1) * cell);
+		out.beginAttribute("href");
+		out.winText(name);
+		out.content("_");
+		out.content(std::to_string(numImages++));
+		out.winText(_options.imageExtension);
+		out.endAttribute();
+		out.attribute("preserveAspectRatio", "xMidYMid slice");
+		out.attribute("width", (right - left + 1) * cell);
+		out.attribute("x", left * cell);
+		out.attribute("y", top * cell);
+		out.endTag();
+		out.close();
+	}
+}
+
+bool CrosswordRenderer::renderToFile(const Crossword& crossword, const utils::Dictionary& dictionary, const std::string& path) const
+{
+	thread_local SVG::SVGWriter out; // Keeps its buffer between the crosswords a worker renders
+	out.clear();
+	render(crossword, dictionary, out);
+
+	std::ofstream fout(path, std::ios::binary);
+	out.writeTo(fout);
+	if (!fout)
+	{
+		VLOG_ERROR("[ERROR]: CrosswordRenderer::renderToFile: Could not write " << path << std::endl);
+		return false;
+	}
+	return true;
+}
+
+size_t CrosswordRenderer::renderAll(const std::vector<Crossword>& crosswords, const utils::Dictionary& dictionary, const std::string& directory, utils::ThreadPool& pool)
+{
+	std::vector<std::string> paths(crosswords.size());
+	std::vector<char> written(crosswords.size(), 0); // Not vector<bool>: every task writes its own element
+	for (size_t i = 0; i < crosswords.size(); ++i)
+	{
+		paths[i] = (directory.empty() ? std::string() : directory + "/") + getOutputName(crosswords[i]) + ".svg";
+		pool.submit([this, &crosswords, &dictionary, &paths, &written, i]() { written[i] = renderToFile(crosswords[i], dictionary, paths[i]); });
+	}
+	pool.wait();
+
+	_failedPaths.clear();
+	size_t numWritten = 0;
+	for (size_t i = 0; i < crosswords.size(); ++i)
+	{
+		if (written[i])
+			++numWritten;
+		else
+			_failedPaths.push_back(paths[i]);
+	}
+	VLOG_INFO("[INFO]: CrosswordRenderer::renderAll: Rendered " << numWritten << " crosswords in " << directory << " (" << _failedPaths.size() << " failed)" << std::endl);
+	return numWritten;
+}
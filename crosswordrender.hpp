@@ -0,0 +1,57 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <string_view>
+
+#include "crossword.hpp"
+#include "dictionary.hpp"
+#include "svgwriter.hpp"
+#include "threadpool.hpp"
+
+/*
+* Print layout of filled crosswords as SVG.
+* Letter cells become boxes, BOX_CHAR cells hold the explanations of the words starting right of and under them,
+* and every group of adjacent SPECIAL_BOX_CHAR cells is covered by one image.
+* Crosswords are rendered in parallel, each worker reusing its own SVGWriter buffer, and written with one call per file.
+*/
+class CrosswordRenderer
+{
+public:
+
+	struct Options
+	{
+		double cellSize = 10.0; // mm
+		double strokeWidth = 0.3;
+		double letterSize = 6.0; // Font size of the letters
+		double explanationSize = 1.6; // Font size of the explanations
+		bool drawLetters = true; // false leaves the letter cells empty for printing the puzzle itself
+		std::string imageExtension = ".png"; // Image i of crossword `name` is linked as `name_i` with this extension
+	};
+
+public:
+
+	CrosswordRenderer() = default;
+	explicit CrosswordRenderer(Options options) : _options(std::move(options)) {}
+
+	void render(const Crossword& crossword, const utils::Dictionary& dictionary, SVG::SVGWriter& out) const; // Appends the whole document to `out`
+	bool renderToFile(const Crossword& crossword, const utils::Dictionary& dictionary, const std::string& path) const;
+
+	// Writes every crossword as `directory/<name>.svg`. Returns how many were written, the others are listed in getFailedPaths().
+	size_t renderAll(const std::vector<Crossword>& crosswords, const utils::Dictionary& dictionary, const std::string& directory, utils::ThreadPool& pool);
+
+	const Options& getOptions() const { return _options; }
+	const std::vector<std::string>& getFailedPaths() const { return _failedPaths; }
+
+	static std::string getOutputName(const Crossword& crossword); // The crossword name without its directory
+
+private:
+
+	void renderExplanations(const Crossword& crossword, const utils::Dictionary& dictionary, uint32_t row, uint32_t col, SVG::SVGWriter& out) const;
+	void renderImages(const Crossword& crossword, SVG::SVGWriter& out) const;
+	void writeText(SVG::SVGWriter& out, double x, double y, double fontSize, std::string_view text) const;
+
+private:
+
+	Options _options;
+	std::vector<std::string> _failedPaths;
+};
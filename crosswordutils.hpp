@@ -1,7 +1,17 @@
 #pragma once
 #include <inttypes.h>
+#include <cstddef>
 #include <string>
 
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
 namespace utils
 {
 	const uint8_t CYRILLIC_A = 224; // The first letter of the cyrillic alphabet
@@ -12,21 +22,182 @@ namespace utils
 	const uint8_t BOX_CHAR = 17; // Used to place explanations in it
 	const uint8_t SPECIAL_BOX_CHAR = 16; // Used to place images over it
 
+	const uint64_t FNV_OFFSET_BASIS = 14695981039346656037ull;
+	const uint64_t FNV_PRIME = 1099511628211ull;
+
+	/* One FNV-1a step. Hashing letter by letter gives the same value for a string and for the board cells holding it. */
+	inline uint64_t hashLetter(uint64_t hash, uint8_t c) { return (hash ^ c) * FNV_PRIME; }
+
 	inline bool isBox(uint8_t c) { return c == BOX_CHAR || c == SPECIAL_BOX_CHAR; }
 	inline bool isDosBox(uint8_t c) { return c == DOS_BOX_CHAR || c == DOS_SPECIAL_BOX_CHAR; }
 
 	inline bool isCyrillicChar(uint8_t c) { return c >= CYRILLIC_A - 32 && c < CYRILLIC_A + 32; }
 	inline bool isDosCyrillicChar(uint8_t c) { return c >= CYRILLIC_A - 96 && c < CYRILLIC_A - 32; }
 
-	/* Converts the dos code page to win 1251 cyrillic code page */
-	inline std::string dosToWinCode(std::string winWord)
+	/* Lookup table of a one byte code page conversion */
+	class CodePageTable
 	{
-		for (auto& c : winWord)
-			if (isDosCyrillicChar(c) || isDosBox(c))
-				c += 64;
+	public:
+		explicit CodePageTable(uint8_t (*convert)(uint8_t))
+		{
+			for (int c = 0; c < 256; ++c)
+				_map[c] = convert(uint8_t(c));
+		}
 
-		return winWord;
+		uint8_t operator[](uint8_t c) const { return _map[c]; }
+
+		void convert(const uint8_t* in, uint8_t* out, size_t size) const // `in` and `out` may be the same buffer
+		{
+			for (size_t i = 0; i < size; ++i)
+				out[i] = _map[in[i]];
+		}
+
+	private:
+		uint8_t _map[256];
+	};
+
+	/*
+	* Bulk code page kernels. Both conversions move a 64 letter range and the two box characters by the same delta (mod 256):
+	* dos -> win adds 64 to [128, 192) and {208, 209}, win -> dos subtracts 64 from [192, 256) and {16, 17}.
+	* The vector kernels test both ranges with unsigned min and add the masked delta, the table handles the tails.
+	* The best kernel for the running CPU is picked once, on the first call.
+	*/
+	namespace codepage
+	{
+		using Kernel = void (*)(const uint8_t* in, uint8_t* out, size_t size);
+
+		enum class Isa
+		{
+			TABLE,
+			SSE2,
+			AVX2,
+			NEON
+		};
+
+		static_assert(DOS_BOX_CHAR == DOS_SPECIAL_BOX_CHAR + 1 && BOX_CHAR == SPECIAL_BOX_CHAR + 1, "The kernels expect the box characters to be adjacent");
+
+		template <uint8_t START, uint8_t SPAN, uint8_t BOX, uint8_t DELTA>
+		inline uint8_t convertOne(uint8_t c)
+		{
+			const bool inRange = uint8_t(c - START) < SPAN || uint8_t(c - BOX) < 2;
+			return inRange ? uint8_t(c + DELTA) : c;
+		}
+
+		template <uint8_t START, uint8_t SPAN, uint8_t BOX, uint8_t DELTA>
+		inline void convertTable(const uint8_t* in, uint8_t* out, size_t size)
+		{
+			static const CodePageTable table(convertOne<START, SPAN, BOX, DELTA>);
+			table.convert(in, out, size);
+		}
+
+#if defined(__x86_64__) || defined(_M_X64)
+		template <uint8_t START, uint8_t SPAN, uint8_t BOX, uint8_t DELTA>
+		inline void convertSse2(const uint8_t* in, uint8_t* out, size_t size)
+		{
+			const __m128i start = _mm_set1_epi8(char(START)), last = _mm_set1_epi8(char(SPAN - 1));
+			const __m128i box = _mm_set1_epi8(char(BOX)), lastBox = _mm_set1_epi8(1);
+			const __m128i delta = _mm_set1_epi8(char(DELTA));
+
+			size_t i = 0;
+			for (; i + 16 <= size; i += 16)
+			{
+				const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+				const __m128i rel = _mm_sub_epi8(c, start);
+				const __m128i relBox = _mm_sub_epi8(c, box);
+				const __m128i mask = _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(rel, last), rel), _mm_cmpeq_epi8(_mm_min_epu8(relBox, lastBox), relBox));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_add_epi8(c, _mm_and_si128(mask, delta)));
+			}
+			convertTable<START, SPAN, BOX, DELTA>(in + i, out + i, size - i);
+		}
+
+		template <uint8_t START, uint8_t SPAN, uint8_t BOX, uint8_t DELTA>
+#if !defined(_MSC_VER)
+		__attribute__((target("avx2")))
+#endif
+		inline void convertAvx2(const uint8_t* in, uint8_t* out, size_t size)
+		{
+			const __m256i start = _mm256_set1_epi8(char(START)), last = _mm256_set1_epi8(char(SPAN - 1));
+			const __m256i box = _mm256_set1_epi8(char(BOX)), lastBox = _mm256_set1_epi8(1);
+			const __m256i delta = _mm256_set1_epi8(char(DELTA));
+
+			size_t i = 0;
+			for (; i + 32 <= size; i += 32)
+			{
+				const __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+				const __m256i rel = _mm256_sub_epi8(c, start);
+				const __m256i relBox = _mm256_sub_epi8(c, box);
+				const __m256i mask = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(rel, last), rel), _mm256_cmpeq_epi8(_mm256_min_epu8(relBox, lastBox), relBox));
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_add_epi8(c, _mm256_and_si256(mask, delta)));
+			}
+			convertSse2<START, SPAN, BOX, DELTA>(in + i, out + i, size - i);
+		}
+
+		inline bool hasAvx2()
+		{
+#if defined(_MSC_VER)
+			int info[4];
+			__cpuid(info, 1);
+			const bool osSavesYmm = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6; // OSXSAVE, AVX and the OS saves the ymm registers
+			__cpuidex(info, 7, 0);
+			return osSavesYmm && (info[1] & (1 << 5));
+#else
+			return __builtin_cpu_supports("avx2");
+#endif
+		}
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+		template <uint8_t START, uint8_t SPAN, uint8_t BOX, uint8_t DELTA>
+		inline void convertNeon(const uint8_t* in, uint8_t* out, size_t size)
+		{
+			const uint8x16_t start = vdupq_n_u8(START), span = vdupq_n_u8(SPAN);
+			const uint8x16_t box = vdupq_n_u8(BOX), boxSpan = vdupq_n_u8(2);
+			const uint8x16_t delta = vdupq_n_u8(DELTA);
+
+			size_t i = 0;
+			for (; i + 16 <= size; i += 16)
+			{
+				const uint8x16_t c = vld1q_u8(in + i);
+				const uint8x16_t mask = vorrq_u8(vcltq_u8(vsubq_u8(c, start), span), vcltq_u8(vsubq_u8(c, box), boxSpan));
+				vst1q_u8(out + i, vaddq_u8(c, vandq_u8(mask, delta)));
+			}
+			convertTable<START, SPAN, BOX, DELTA>(in + i, out + i, size - i);
+		}
+#endif
+
+		/* Returns the kernel for `isa` or nullptr if it is not supported by this build or CPU */
+		template <uint8_t START, uint8_t SPAN, uint8_t BOX, uint8_t DELTA>
+		inline Kernel getKernel(Isa isa)
+		{
+			switch (isa)
+			{
+			case Isa::TABLE: return convertTable<START, SPAN, BOX, DELTA>;
+#if defined(__x86_64__) || defined(_M_X64)
+			case Isa::SSE2: return convertSse2<START, SPAN, BOX, DELTA>;
+			case Isa::AVX2: return hasAvx2() ? convertAvx2<START, SPAN, BOX, DELTA> : nullptr;
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+			case Isa::NEON: return convertNeon<START, SPAN, BOX, DELTA>;
+#endif
+			default: return nullptr;
+			}
+		}
+
+		template <uint8_t START, uint8_t SPAN, uint8_t BOX, uint8_t DELTA>
+		inline Kernel getBestKernel()
+		{
+			for (Isa isa : { Isa::AVX2, Isa::NEON, Isa::SSE2 })
+			{
+				if (Kernel kernel = getKernel<START, SPAN, BOX, DELTA>(isa))
+					return kernel;
+			}
+			return convertTable<START, SPAN, BOX, DELTA>;
+		}
+
+		inline Kernel getDosToWinKernel(Isa isa) { return getKernel<CYRILLIC_A - 96, 64, DOS_SPECIAL_BOX_CHAR, 64>(isa); }
+		inline Kernel getBestDosToWinKernel() { return getBestKernel<CYRILLIC_A - 96, 64, DOS_SPECIAL_BOX_CHAR, 64>(); }
+		inline Kernel getWinToDosKernel(Isa isa) { return getKernel<CYRILLIC_A - 32, 64, SPECIAL_BOX_CHAR, 256 - 64>(isa); }
+		inline Kernel getBestWinToDosKernel() { return getBestKernel<CYRILLIC_A - 32, 64, SPECIAL_BOX_CHAR, 256 - 64>(); }
 	}
+
+	/* Converts the dos code page to win 1251 cyrillic code page */
 	inline uint8_t dosToWinCode(uint8_t c)
 	{
 		if (isDosCyrillicChar(c) || isDosBox(c))
@@ -34,16 +205,20 @@ namespace utils
 
 		return c;
 	}
-
-	/* Converts the win 1251 code page to the dos code page */
-	inline std::string winToDosCode(std::string winWord)
+	inline void dosToWinCode(const uint8_t* in, uint8_t* out, size_t size) // `in` and `out` may be the same buffer
 	{
-		for (auto& c : winWord)
-			if (isCyrillicChar(c) || isBox(c))
-				c -= 64;
-
+		static const codepage::Kernel kernel = codepage::getBestDosToWinKernel();
+		kernel(in, out, size);
+	}
+	inline void dosToWinCode(uint8_t* data, size_t size) { dosToWinCode(data, data, size); }
+	inline void dosToWinInPlace(std::string& word) { dosToWinCode(reinterpret_cast<uint8_t*>(&word[0]), word.size()); }
+	inline std::string dosToWinCode(std::string winWord)
+	{
+		dosToWinInPlace(winWord);
 		return winWord;
 	}
+
+	/* Converts the win 1251 code page to the dos code page */
 	inline uint8_t winToDosCode(uint8_t c)
 	{
 		if (isCyrillicChar(c) || isBox(c))
@@ -51,4 +226,16 @@ namespace utils
 
 		return c;
 	}
-}
\ No newline at end of file
+	inline void winToDosCode(const uint8_t* in, uint8_t* out, size_t size) // `in` and `out` may be the same buffer
+	{
+		static const codepage::Kernel kernel = codepage::getBestWinToDosKernel();
+		kernel(in, out, size);
+	}
+	inline void winToDosCode(uint8_t* data, size_t size) { winToDosCode(data, data, size); }
+	inline void winToDosInPlace(std::string& word) { winToDosCode(reinterpret_cast<uint8_t*>(&word[0]), word.size()); }
+	inline std::string winToDosCode(std::string winWord)
+	{
+		winToDosInPlace(winWord);
+		return winWord;
+	}
+}
@@ -1,6 +1,22 @@
 #include "dictionary.hpp"
 #include "logger.hpp"
+#include "snapshotformat.hpp"
+#include "editdistance.hpp"
+#include "metrics.hpp"
 #include <bitset>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <numeric>
+#include <random>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#endif
 
 namespace utils
 {
@@ -31,6 +47,7 @@ Dictionary::Dictionary()
 		_dictionaryFilePath = DEFAULT_DICTIONARY_PATH;
 	}
 
+	loadConfig();
 	loadDictionary();
 	shuffle();
 }
@@ -64,36 +81,66 @@ Dictionary::Dictionary(const std::string& configFilePath)
 		_dictionaryFilePath = DEFAULT_DICTIONARY_PATH;
 	}
 
+	loadConfig();
 	loadDictionary();
 	shuffle();
 }
 
+/* The tables view the base's memory the way a loaded snapshot views its mapping, so a layer owns only its edits, index and cache */
+Dictionary::Dictionary(std::shared_ptr<const Dictionary> base) :
+	_base(std::move(base))
+{
+	auto viewTable = [](StringTable& table, const StringTable& other) { table.view(other.offsets().data(), other.size(), other.data().data(), other.data().size()); };
+	viewTable(_allWords, _base->_allWords);
+	viewTable(_dirtyWords, _base->_dirtyWords);
+	viewTable(_explanations, _base->_explanations);
+	_explanationIds.view(_base->_explanationIds.data(), _base->_explanationIds.size());
+	_sortedIds.view(_base->_sortedIds.data(), _base->_sortedIds.size());
+	_tierStarts.view(_base->_tierStarts.data(), _base->_tierStarts.size());
+	_patternIndex.reset(LONGEST_WORD);
+
+	// The base's words stay valid as long as the base, and what it hid or rescored is already in the words it returns
+	auto edits = std::make_shared<Edits>(*_base->getEdits());
+	edits->hidden.clear();
+	edits->rescored.clear();
+	_edits = std::move(edits);
+
+	setCacheBudget(_base->getCacheStats().budgetBytes);
+	_shuffleSeed = _base->_shuffleSeed.load();
+	_dictionaryFilePath = _base->_dictionaryFilePath;
+	VLOG_INFO("[INFO]: Dictionary::Dictionary: Made a layer over " << _base->getNumWords() << " words of " << _dictionaryFilePath << std::endl);
+}
+
 Dictionary::~Dictionary()
 {
-	for (auto& it : _cacheSearchMap)
-	{
-		delete it.second;
-	}
 }
 
-int Dictionary::levenstein(std::string a, std::string b)
+void Dictionary::loadConfig()
 {
-	std::vector< std::vector<int> > dp(a.length() + 1, std::vector<int>(b.length() + 1, 0));
+	size_t cacheBudget = _iniPropertyTree.get<size_t>("dictionary.cache_budget_bytes", PatternCache::DEFAULT_BUDGET_BYTES);
+	setCacheBudget(cacheBudget);
+	VLOG_INFO("[INFO]: Dictionary::loadConfig: Pattern cache budget is " << cacheBudget << " bytes" << std::endl);
 
-	for (uint32_t i = 0; i <= a.length(); ++i) 
+	_snapshotFilePath = _iniPropertyTree.get<std::string>("dictionary.snapshot_file_path", "");
+
+	_loadThreads = _iniPropertyTree.get<size_t>("dictionary.load_threads", 0);
+	if (_loadThreads == 0)
 	{
-		for (uint32_t j = 0; j <= b.length(); ++j)
-		{
-			if (std::min(i, j) == 0)
-				dp[i][j] = 0;
-			else
-			{
-				dp[i][j] = std::min(dp[i - 1u][j] + 1, dp[i][j - 1u] + 1);
-				dp[i][j] = std::min(dp[i][j], dp[i - 1u][j - 1u] + (a[i - 1u] != b[j - 1u]));
-			}
-		}
+		_loadThreads = std::max<size_t>(1, std::thread::hardware_concurrency());
 	}
-	return dp[a.length()][b.length()];
+
+	_scoresFilePath = _iniPropertyTree.get<std::string>("dictionary.scores_file_path", "");
+	_fillabilityWeight = _iniPropertyTree.get<double>("dictionary.fillability_weight", 0.0);
+	_numScoreTiers = std::clamp<uint32_t>(_iniPropertyTree.get<uint32_t>("dictionary.score_tiers", 8), 1, uint32_t(MAX_SCORE_TIERS));
+}
+
+int Dictionary::levenstein(std::string_view a, std::string_view b)
+{
+	return int(editDistance(a, b));
+}
+int Dictionary::levenstein(std::string_view a, std::string_view b, int maxDistance)
+{
+	return int(editDistance(a, b, uint32_t(std::max(maxDistance, 0))));
 }
 
 std::string Dictionary::toupper(std::string capsWord)
@@ -123,215 +170,1304 @@ uint8_t Dictionary::tolower(uint8_t c)
 std::string Dictionary::cleanString(const std::string& dirtyString)
 {
 	std::string clean; // Contains the clean word (only alphabetic symbols)
-
+	cleanString(dirtyString, clean);
+	return clean;
+}
+void Dictionary::cleanString(std::string_view dirtyString, std::string& clean)
+{
+	clean.clear();
 	for (uint32_t i = 0; i < dirtyString.size(); ++i)
 		if (isCyrillicChar( dirtyString[i] ))
 			clean.push_back(dirtyString[i]);
-
-	return clean;
 }
 
 void Dictionary::reset()
 {
 	_allWords.clear();
-	_dirtyDict.clear();
-	_explanationDict.clear();
-	_cacheSearchMap.clear();
-	for (uint32_t i = 0; i < LONGEST_WORD; ++i)
-		_fastSearch[i].clear();
+	_dirtyWords.clear();
+	_explanations.clear();
+	_explanationIds.clear();
+	_sortedIds.clear();
+	_tierStarts.clear();
+	_patternCache.clear();
+	_patternIndex.reset(LONGEST_WORD);
+	std::atomic_store(&_bkTree, std::shared_ptr<const BKTree>());
+	std::atomic_store(&_edits, std::make_shared<const Edits>());
+	_editStrings.clear();
+	_snapshot.close();
+}
 
+/* Hot path and load metrics of every dictionary in the process */
+struct DictionaryMetrics
+{
+	Metrics& metrics = Metrics::getInstance();
+	Counter& cacheHits = metrics.counter("dictionary_find_possible_cache_hits_total", "findPossible calls answered by the pattern cache");
+	Counter& cacheMisses = metrics.counter("dictionary_find_possible_cache_misses_total", "findPossible calls which scanned the pattern index");
+	Histogram& candidates = metrics.histogram("dictionary_find_possible_candidates", "Words matching the pattern of a findPossible call", Histogram::exponentialBounds(1, 4, 12));
+	Histogram& lookupSeconds = metrics.histogram("dictionary_find_possible_lookup_seconds", "Time spent in the pattern cache lookup of a findPossible call, sampled", Histogram::exponentialBounds(1e-7, 2, 20));
+	Histogram& scanSeconds = metrics.histogram("dictionary_find_possible_scan_seconds", "Time spent scanning the pattern index on a cache miss", Histogram::exponentialBounds(1e-7, 2, 20));
+	Counter& countFromCache = metrics.counter("dictionary_count_possible_total", "countPossible calls by where the count came from", "source=\"cache\"");
+	Counter& countFromIndex = metrics.counter("dictionary_count_possible_total", "countPossible calls by where the count came from", "source=\"index\"");
+	Gauge& snapshotSeconds = metrics.gauge("dictionary_load_phase_seconds", "Duration of the phases of the last dictionary load", "phase=\"snapshot\"");
+	Gauge& parseSeconds = metrics.gauge("dictionary_load_phase_seconds", "Duration of the phases of the last dictionary load", "phase=\"parse\"");
+	Gauge& mergeSeconds = metrics.gauge("dictionary_load_phase_seconds", "Duration of the phases of the last dictionary load", "phase=\"merge\"");
+	Gauge& rankSeconds = metrics.gauge("dictionary_load_phase_seconds", "Duration of the phases of the last dictionary load", "phase=\"rank\"");
+	Gauge& indexSeconds = metrics.gauge("dictionary_load_phase_seconds", "Duration of the phases of the last dictionary load", "phase=\"index\"");
+	Gauge& saveSnapshotSeconds = metrics.gauge("dictionary_load_phase_seconds", "Duration of the phases of the last dictionary load", "phase=\"save_snapshot\"");
+	Gauge& words = metrics.gauge("dictionary_words", "Words of the last loaded dictionary");
+	Counter& layerFromBase = metrics.counter("dictionary_layer_patterns_total", "Patterns a layer looked up in its base by outcome", "result=\"base\"");
+	Counter& layerMerged = metrics.counter("dictionary_layer_patterns_total", "Patterns a layer looked up in its base by outcome", "result=\"merged\"");
+};
+
+static DictionaryMetrics& getMetrics()
+{
+	static DictionaryMetrics metrics;
+	return metrics;
 }
 
 void Dictionary::loadDictionary()
 {
 	reset();
 
-	std::ifstream fin(_dictionaryFilePath);
-
-	if (!fin.good())
+	Stopwatch stopwatch;
+	if (!_snapshotFilePath.empty() && loadSnapshot(_snapshotFilePath))
 	{
-		VLOG_ERROR("[ERROR]: Dictionary::loadDictionary: Could not open file: " << _dictionaryFilePath << std::endl);
+		VMETRIC_SET(getMetrics().snapshotSeconds, stopwatch.lap());
+		VMETRIC_SET(getMetrics().words, double(_allWords.size()));
 		return;
 	}
 
+	loadTextDictionary();
+	VMETRIC_SET(getMetrics().words, double(_allWords.size()));
+
+	if (!_snapshotFilePath.empty() && !_allWords.empty())
+	{
+		stopwatch.lap();
+		saveSnapshot(_snapshotFilePath);
+		VMETRIC_SET(getMetrics().saveSnapshotSeconds, stopwatch.lap());
+	}
+}
+
+/* The words of one chunk of the text dictionary, parsed independently of the other chunks */
+struct TextChunk
+{
+	StringTable words;
+	StringTable dirtyWords;
+	StringTable explanations; // Every different explanation of the chunk once
+	std::vector<std::string_view> dosExplanations; // The source of every explanation, pointing into the mapped file. Used to merge the chunks.
+	std::vector<uint32_t> explanationIds; // Per word, into `explanations`
+	std::vector<std::string> skipped; // Words which are too long
+};
+
+/*
+* Splits the text in about numChunks pieces which end at a record boundary.
+* The end of a line holding a tab always ends a record (`word<TAB>explanation`), even around malformed lines without one.
+*/
+static std::vector<std::pair<const char*, const char*>> splitRecords(const char* begin, const char* end, size_t numChunks)
+{
+	std::vector<std::pair<const char*, const char*>> chunks;
+	const char* start = begin;
+	for (size_t i = 1; i < numChunks && start < end; ++i)
+	{
+		const char* target = begin + size_t(end - begin) * i / numChunks;
+		if (target < start)
+			continue;
+
+		const char* cut = std::find(target, end, '\n');
+		while (cut != end)
+		{
+			const char* lineStart = cut;
+			while (lineStart > start && lineStart[-1] != '\n')
+				--lineStart;
+			if (std::find(lineStart, cut, '\t') != cut)
+				break;
+			cut = std::find(cut + 1, end, '\n');
+		}
+		if (cut == end)
+			break;
+
+		chunks.push_back({ start, cut + 1 });
+		start = cut + 1;
+	}
+	chunks.push_back({ start, end });
+	return chunks;
+}
+
+/* The word in windows code in `word` and its upper case clean form in `clean` */
+static void cleanDosWord(std::string_view dosWord, std::string& word, std::string& clean)
+{
+	word.assign(dosWord.data(), dosWord.size());
+	dosToWinInPlace(word);
+	Dictionary::cleanString(word, clean);
+	for (auto& c : clean)
+		c = Dictionary::toupper(uint8_t(c));
+}
+
+static void parseChunk(const char* text, const char* const end, TextChunk& chunk)
+{
+	robin_hood::unordered_map<std::string_view, uint32_t> explanationIds; // Keys point into the mapped file
+
+	// Reused for every line, so parsing does not allocate per word
 	std::string nextWord;
 	std::string explanation;
+	std::string clean;
+
+	while (text < end)
+	{
+		// Every line is `word<TAB>explanation`
+		const char* tab = std::find(text, end, '\t');
+		const char* lineEnd = tab == end ? end : std::find(tab + 1, end, '\n');
+		const std::string_view dirtyWord(text, size_t(tab - text));
+		std::string_view dosExplanation = tab == end ? std::string_view() : std::string_view(tab + 1, size_t(lineEnd - tab - 1));
+		if (!dosExplanation.empty() && dosExplanation.back() == '\r')
+		{
+			dosExplanation.remove_suffix(1);
+		}
+		text = lineEnd == end ? end : lineEnd + 1;
+
+		cleanDosWord(dirtyWord, nextWord, clean);
+
+		if (clean.size() >= Dictionary::LONGEST_WORD)
+		{
+			chunk.skipped.push_back(clean);
+			continue;
+		}
+
+		chunk.words.push_back(clean);
+		chunk.dirtyWords.push_back(nextWord == clean ? std::string_view() : std::string_view(nextWord));
+
+		// The conversion is one to one, so equal dos explanations are equal after it
+		auto it = explanationIds.find(dosExplanation);
+		if (it == explanationIds.end())
+		{
+			explanation.assign(dosExplanation.data(), dosExplanation.size());
+			dosToWinInPlace(explanation);
+			it = explanationIds.emplace(dosExplanation, uint32_t(chunk.explanations.size())).first;
+			chunk.explanations.push_back(explanation);
+			chunk.dosExplanations.push_back(dosExplanation);
+		}
+		chunk.explanationIds.push_back(it->second);
+	}
+}
 
-	while (getline(fin, nextWord, '\t')) // Get the next word
+/*
+* The file is split in chunks which are parsed on all cores and then appended in file order, so word ids do not depend
+* on the number of threads. The sorted ids and every length of the pattern index are then built in parallel too.
+*/
+void Dictionary::loadTextDictionary()
+{
+	MappedFile file;
+	if (!file.open(_dictionaryFilePath))
 	{
-		getline(fin, explanation); // Get the explanation for the word
+		VLOG_ERROR("[ERROR]: Dictionary::loadTextDictionary: Could not open file: " << _dictionaryFilePath << std::endl);
+		return;
+	}
 
-		nextWord = dosToWinCode(nextWord);
-		explanation = dosToWinCode(explanation);
+	const char* text = reinterpret_cast<const char*>(file.data());
+	const size_t minChunkBytes = 1 << 20; // Smaller chunks cost more to merge than they save
+	const size_t numChunks = std::max<size_t>(1, std::min<size_t>(_loadThreads * 4, file.size() / minChunkBytes));
+	const auto ranges = splitRecords(text, text + file.size(), numChunks);
 
-		std::string clean( toupper(cleanString(nextWord)) );
+	Stopwatch stopwatch;
+	ThreadPool pool(_loadThreads);
+	std::vector<TextChunk> chunks(ranges.size());
+	for (size_t i = 0; i < ranges.size(); ++i)
+	{
+		pool.submit([&ranges, &chunks, i]() { parseChunk(ranges[i].first, ranges[i].second, chunks[i]); });
+	}
+	pool.wait();
+	VMETRIC_SET(getMetrics().parseSeconds, stopwatch.lap());
 
-		_dirtyDict.emplace(clean, nextWord);
-		_explanationDict.emplace(clean, explanation);
+	robin_hood::unordered_map<std::string_view, uint32_t> explanationIds; // Keys point into the mapped file
+	std::vector<uint32_t> wordExplanations;
+	for (auto& chunk : chunks)
+	{
+		for (const auto& skipped : chunk.skipped)
+		{
+			VLOG_WARN("[WARN]: Dictionary::loadTextDictionary: Skipping " << skipped << ". Words have to be shorter than " << uint32_t(LONGEST_WORD) << " letters." << std::endl);
+		}
+
+		std::vector<uint32_t> globalIds(chunk.explanations.size());
+		for (uint32_t local = 0; local < chunk.explanations.size(); ++local)
+		{
+			auto it = explanationIds.find(chunk.dosExplanations[local]);
+			if (it == explanationIds.end())
+			{
+				it = explanationIds.emplace(chunk.dosExplanations[local], uint32_t(_explanations.size())).first;
+				_explanations.push_back(chunk.explanations[local]);
+			}
+			globalIds[local] = it->second;
+		}
+		for (uint32_t local : chunk.explanationIds)
+		{
+			wordExplanations.push_back(globalIds[local]);
+		}
 
-		addToFastSearch(clean, _allWords.size());
-		_allWords.push_back(clean);
+		_allWords.append(chunk.words);
+		_dirtyWords.append(chunk.dirtyWords);
+		chunk = TextChunk(); // Give the memory back before the index is built
 	}
+	VMETRIC_SET(getMetrics().mergeSeconds, stopwatch.lap());
+
+	rankWords(wordExplanations);
+	_allWords.shrink_to_fit();
+	_dirtyWords.shrink_to_fit();
+	_explanations.shrink_to_fit();
+	_explanationIds.assign(std::move(wordExplanations));
+	VMETRIC_SET(getMetrics().rankSeconds, stopwatch.lap());
+
+	std::vector<WordId> sortedIds(_allWords.size());
+	pool.submit([this, &sortedIds]()
+	{
+		std::iota(sortedIds.begin(), sortedIds.end(), WordId(0));
+		std::stable_sort(sortedIds.begin(), sortedIds.end(), [this](WordId a, WordId b) { return _allWords[a] < _allWords[b]; });
+	});
+	_patternIndex.build(_allWords, LONGEST_WORD, pool);
+	pool.wait();
+	_sortedIds.assign(std::move(sortedIds));
+	VMETRIC_SET(getMetrics().indexSeconds, stopwatch.lap());
 
-	VLOG_INFO("[INFO]: Dictionary::loadDictionary: Loaded " << _allWords.size() << " words from dictionary" << std::endl);
+	size_t indexBytes = 0;
+	for (uint32_t length = 0; length < LONGEST_WORD; ++length)
+		indexBytes += getIndexMemoryStats(length).bytes;
+
+	VLOG_INFO("[INFO]: Dictionary::loadTextDictionary: Loaded " << _allWords.size() << " words with " << _explanations.size() << " different explanations from dictionary" << std::endl);
+	VLOG_INFO("[INFO]: Dictionary::loadTextDictionary: Pattern index uses " << indexBytes << " bytes" << std::endl);
 }
 
-void Dictionary::addToFastSearch(const std::string& newWord, uint16_t index)
+/* Reads `word<TAB>frequency[<TAB>priority]` lines. Each clean word gets log2(1 + frequency) + priority. */
+static bool readScoresFile(const std::string& path, StringTable& words, std::vector<double>& scores)
 {
-	auto& currentFastSearch = _fastSearch[newWord.size()];
-	
-	for (uint32_t mask = 0u; mask < 64u; ++mask)
+	MappedFile file;
+	if (!file.open(path))
 	{
-		uint64_t key = getKey(mask, newWord);
-		currentFastSearch[key].push_back(index);
+		VLOG_ERROR("[ERROR]: Dictionary::readScoresFile: Could not open file: " << path << std::endl);
+		return false;
 	}
+
+	size_t numMalformed = 0;
+	std::string word, clean, number;
+	const char* text = reinterpret_cast<const char*>(file.data());
+	const char* const end = text + file.size();
+	while (text < end)
+	{
+		const char* lineEnd = std::find(text, end, '\n');
+		std::string_view line(text, size_t(lineEnd - text));
+		text = lineEnd == end ? end : lineEnd + 1;
+		if (!line.empty() && line.back() == '\r')
+			line.remove_suffix(1);
+		if (line.empty())
+			continue;
+
+		double fields[2] = { 0.0, 0.0 };
+		const size_t tab = line.find('\t');
+		bool valid = tab != std::string_view::npos;
+		std::string_view rest = valid ? line.substr(tab + 1) : std::string_view();
+		for (size_t i = 0; valid && i < 2 && !rest.empty(); ++i)
+		{
+			const size_t next = rest.find('\t');
+			number.assign(rest.substr(0, next));
+			char* parsed = nullptr;
+			fields[i] = std::strtod(number.c_str(), &parsed);
+			valid = parsed != number.c_str() && *parsed == 0;
+			rest = next == std::string_view::npos ? std::string_view() : rest.substr(next + 1);
+		}
+		if (!valid)
+		{
+			++numMalformed;
+			continue;
+		}
+
+		cleanDosWord(line.substr(0, tab), word, clean);
+		words.push_back(clean);
+		scores.push_back(std::log2(1.0 + std::max(0.0, fields[0])) + fields[1]);
+	}
+
+	if (numMalformed)
+	{
+		VLOG_WARN("[WARN]: Dictionary::readScoresFile: Skipped " << numMalformed << " malformed lines of " << path << std::endl);
+	}
+	return true;
 }
 
-const std::string& Dictionary::getDirty(const std::string& clean) const 
+/*
+* A word's score comes from its line in the scores file (0 without one), plus fillability_weight times the mean log2
+* share of its letters among all letters, so words made of common letters, which are easy to cross, come first among equally frequent ones.
+*/
+std::vector<double> Dictionary::computeScores() const
+{
+	if (_scoresFilePath.empty() && _fillabilityWeight == 0)
+	{
+		return {};
+	}
+
+	std::vector<double> scores(_allWords.size(), 0.0);
+	StringTable scoredWords;
+	std::vector<double> fileScores;
+	if (!_scoresFilePath.empty() && readScoresFile(_scoresFilePath, scoredWords, fileScores))
+	{
+		robin_hood::unordered_map<std::string_view, double> scoreOf; // A later line of the same word wins
+		scoreOf.reserve(scoredWords.size());
+		for (size_t i = 0; i < scoredWords.size(); ++i)
+			scoreOf[scoredWords[i]] = fileScores[i];
+		for (size_t id = 0; id < _allWords.size(); ++id)
+		{
+			auto it = scoreOf.find(_allWords[id]);
+			if (it != scoreOf.end())
+				scores[id] = it->second;
+		}
+	}
+
+	if (_fillabilityWeight != 0)
+	{
+		uint64_t letterCounts[PatternIndex::ALPHABET_SIZE] = {};
+		uint64_t numLetters = 0;
+		for (const auto word : _allWords)
+		{
+			for (const char c : word)
+			{
+				const int letter = PatternIndex::letterIndex(uint8_t(c));
+				if (letter >= 0)
+				{
+					++letterCounts[letter];
+					++numLetters;
+				}
+			}
+		}
+
+		double letterScores[PatternIndex::ALPHABET_SIZE] = {};
+		for (uint32_t letter = 0; letter < PatternIndex::ALPHABET_SIZE; ++letter)
+			letterScores[letter] = letterCounts[letter] ? std::log2(double(letterCounts[letter]) / double(numLetters)) : 0.0;
+
+		for (size_t id = 0; id < _allWords.size(); ++id)
+		{
+			const std::string_view word = _allWords[id];
+			double sum = 0;
+			for (const char c : word)
+			{
+				const int letter = PatternIndex::letterIndex(uint8_t(c));
+				sum += letter >= 0 ? letterScores[letter] : 0.0;
+			}
+			scores[id] += word.empty() ? 0.0 : _fillabilityWeight * sum / double(word.size());
+		}
+	}
+	return scores;
+}
+
+/*
+* Sorting the ids by score makes every posting list of the index, and so every result of findPossible, best first
+* without any sorting per query. The tiers hold about the same number of words. Words with the same score stay in one tier.
+*/
+void Dictionary::rankWords(std::vector<uint32_t>& wordExplanations)
+{
+	const std::vector<double> scores = computeScores();
+	if (scores.empty())
+	{
+		return;
+	}
+
+	std::vector<WordId> order(_allWords.size());
+	std::iota(order.begin(), order.end(), WordId(0));
+	std::stable_sort(order.begin(), order.end(), [&scores](WordId a, WordId b) { return scores[a] > scores[b]; }); // Ties keep the file order
+
+	StringTable words;
+	StringTable dirtyWords;
+	std::vector<uint32_t> explanationIds(order.size());
+	for (size_t i = 0; i < order.size(); ++i)
+	{
+		words.push_back(_allWords[order[i]]);
+		dirtyWords.push_back(_dirtyWords[order[i]]);
+		explanationIds[i] = wordExplanations[order[i]];
+	}
+	_allWords = std::move(words);
+	_dirtyWords = std::move(dirtyWords);
+	wordExplanations = std::move(explanationIds);
+
+	std::vector<WordId> tierStarts;
+	for (uint32_t tier = 1; tier < _numScoreTiers; ++tier)
+	{
+		size_t start = std::max(order.size() * tier / _numScoreTiers, tierStarts.empty() ? size_t(1) : size_t(tierStarts.back()) + 1);
+		while (start < order.size() && scores[order[start]] == scores[order[start - 1]])
+			++start;
+		if (start >= order.size())
+			break;
+		tierStarts.push_back(WordId(start));
+	}
+	_tierStarts.assign(std::move(tierStarts));
+
+	VLOG_INFO("[INFO]: Dictionary::rankWords: Ranked " << _allWords.size() << " words in " << getNumScoreTiers() << " score tiers" << std::endl);
+}
+
+uint64_t Dictionary::getScoreSettings() const
+{
+	if (_scoresFilePath.empty() && _fillabilityWeight == 0)
+	{
+		return 0;
+	}
+
+	uint64_t hash = FNV_OFFSET_BASIS;
+	auto add = [&hash](const void* data, size_t size)
+	{
+		for (size_t i = 0; i < size; ++i)
+			hash = hashLetter(hash, static_cast<const uint8_t*>(data)[i]);
+	};
+	const uint8_t hasScoresFile = !_scoresFilePath.empty();
+	add(&hasScoresFile, sizeof(hasScoresFile));
+	add(&_fillabilityWeight, sizeof(_fillabilityWeight));
+	add(&_numScoreTiers, sizeof(_numScoreTiers));
+	return hash | 1; // 0 means unranked
+}
+
+int32_t Dictionary::getScoreTier(WordId id) const
+{
+	return getScoreTier(*getEdits(), id);
+}
+
+int32_t Dictionary::getScoreTier(const Edits& edits, WordId id) const
+{
+	if (!edits.tiers.empty())
+	{
+		auto it = edits.tiers.find(id);
+		if (it != edits.tiers.end())
+		{
+			return it->second;
+		}
+	}
+	return int32_t(std::upper_bound(_tierStarts.begin(), _tierStarts.end(), id) - _tierStarts.begin());
+}
+
+/* Ids are in this order already unless some of them were rescored, so the sort is skipped when it would change nothing */
+void Dictionary::arrangeByTier(const Edits& edits, std::vector<WordId>& ids) const
+{
+	std::vector<std::pair<int32_t, WordId>> keyed;
+	keyed.reserve(ids.size());
+	bool ordered = true;
+	for (WordId id : ids)
+	{
+		keyed.emplace_back(getScoreTier(edits, id), id);
+		ordered = ordered && (keyed.size() == 1 || keyed[keyed.size() - 2] < keyed.back());
+	}
+	if (ordered)
+	{
+		return;
+	}
+
+	std::sort(keyed.begin(), keyed.end());
+	for (size_t i = 0; i < ids.size(); ++i)
+	{
+		ids[i] = keyed[i].second;
+	}
+}
+
+void Dictionary::reportMemoryUsage() const
+{
+	for (uint32_t length = 0; length < LONGEST_WORD; ++length)
+	{
+		const auto stats = getIndexMemoryStats(length);
+		if (stats.numWords == 0)
+		{
+			continue;
+		}
+		VLOG_INFO("[INFO]: Dictionary::reportMemoryUsage: Length " << length << ": " << stats.numWords << " words, " << stats.numBitmaps << " bitmaps, "
+			<< stats.bytes << " bytes" << std::endl);
+	}
+}
+
+/* Returns the size and last write time of the text dictionary. Zeros if it does not exist. */
+static std::pair<uint64_t, int64_t> getSourceStamp(const std::string& path)
+{
+	std::error_code error;
+	const auto size = std::filesystem::file_size(path, error);
+	if (error)
+	{
+		return { 0, 0 };
+	}
+	const auto writeTime = std::filesystem::last_write_time(path, error);
+	if (error)
+	{
+		return { size, 0 };
+	}
+	return { size, int64_t(writeTime.time_since_epoch().count()) };
+}
+
+bool Dictionary::saveSnapshot(const std::string& path) const
+{
+	if (_base)
+	{
+		VLOG_ERROR("[ERROR]: Dictionary::saveSnapshot: A layer has no tables of its own. Save its base instead." << std::endl);
+		return false;
+	}
+	if (!getEdits()->empty())
+	{
+		VLOG_ERROR("[ERROR]: Dictionary::saveSnapshot: The dictionary was changed since loading. Edit the text dictionary instead." << std::endl);
+		return false;
+	}
+
+	// Written next to the snapshot and moved over it, so processes which have the old one mapped keep their pages and a crash leaves no half-written snapshot behind
+	const std::string temporaryPath = path + ".tmp";
+	std::ofstream fout(temporaryPath, std::ios::binary);
+	if (!fout.good())
+	{
+		VLOG_ERROR("[ERROR]: Dictionary::saveSnapshot: Could not open file: " << temporaryPath << std::endl);
+		return false;
+	}
+
+	SnapshotHeader header = {};
+	std::copy(std::begin(SNAPSHOT_MAGIC), std::end(SNAPSHOT_MAGIC), header.magic);
+	header.version = SNAPSHOT_VERSION;
+	header.longestWord = LONGEST_WORD;
+	header.numWords = _allWords.size();
+	std::tie(header.sourceSize, header.sourceWriteTime) = getSourceStamp(_dictionaryFilePath);
+	if (!_scoresFilePath.empty())
+	{
+		std::tie(header.scoresSize, header.scoresWriteTime) = getSourceStamp(_scoresFilePath);
+	}
+	header.scoreSettings = getScoreSettings();
+
+	SnapshotWriter out(fout);
+	out.write(&header, sizeof(header)); // Rewritten with the section offsets at the end
+
+	auto writeTable = [&out, &header](const StringTable& table, SnapshotSectionId offsetsId, SnapshotSectionId dataId)
+	{
+		header.sections[offsetsId] = out.writeSection(table.offsets().data(), table.offsets().size() * sizeof(uint64_t));
+		header.sections[dataId] = out.writeSection(table.data().data(), table.data().size());
+	};
+	writeTable(_allWords, SNAPSHOT_WORD_OFFSETS, SNAPSHOT_WORD_DATA);
+	writeTable(_dirtyWords, SNAPSHOT_DIRTY_OFFSETS, SNAPSHOT_DIRTY_DATA);
+	writeTable(_explanations, SNAPSHOT_EXPLANATION_OFFSETS, SNAPSHOT_EXPLANATION_DATA);
+	header.sections[SNAPSHOT_EXPLANATION_IDS] = out.writeSection(_explanationIds.data(), _explanationIds.size() * sizeof(uint32_t));
+	header.sections[SNAPSHOT_SORTED_IDS] = out.writeSection(_sortedIds.data(), _sortedIds.size() * sizeof(WordId));
+	header.sections[SNAPSHOT_TIER_STARTS] = out.writeSection(_tierStarts.data(), _tierStarts.size() * sizeof(WordId));
+
+	out.align();
+	const uint64_t indexStart = out.position();
+	_patternIndex.write(out);
+	header.sections[SNAPSHOT_PATTERN_INDEX] = { indexStart, out.position() - indexStart };
+
+	fout.seekp(0);
+	fout.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	fout.close();
+
+	if (!fout.good())
+	{
+		VLOG_ERROR("[ERROR]: Dictionary::saveSnapshot: Could not write " << temporaryPath << std::endl);
+		std::remove(temporaryPath.c_str());
+		return false;
+	}
+#if defined(_WIN32)
+	const bool moved = MoveFileExA(temporaryPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) != 0; // std::rename does not replace an existing file there
+#else
+	const bool moved = std::rename(temporaryPath.c_str(), path.c_str()) == 0;
+#endif
+	if (!moved)
+	{
+		VLOG_ERROR("[ERROR]: Dictionary::saveSnapshot: Could not move " << temporaryPath << " to " << path << std::endl);
+		return false;
+	}
+
+	VLOG_INFO("[INFO]: Dictionary::saveSnapshot: Saved " << _allWords.size() << " words in " << path << std::endl);
+	return true;
+}
+
+bool Dictionary::loadSnapshot(const std::string& path)
+{
+	if (_base)
+	{
+		VLOG_ERROR("[ERROR]: Dictionary::loadSnapshot: Cannot load " << path << " in a layer" << std::endl);
+		return false;
+	}
+	reset();
+
+	if (!_snapshot.open(path))
+	{
+		VLOG_INFO("[INFO]: Dictionary::loadSnapshot: Could not map file: " << path << std::endl);
+		return false;
+	}
+
+	SnapshotHeader header;
+	if (_snapshot.size() < sizeof(header))
+	{
+		VLOG_WARN("[WARN]: Dictionary::loadSnapshot: " << path << " is too small to be a snapshot" << std::endl);
+		reset();
+		return false;
+	}
+	std::memcpy(&header, _snapshot.data(), sizeof(header));
+
+	if (!std::equal(std::begin(SNAPSHOT_MAGIC), std::end(SNAPSHOT_MAGIC), header.magic) || header.version != SNAPSHOT_VERSION || header.longestWord != LONGEST_WORD)
+	{
+		VLOG_WARN("[WARN]: Dictionary::loadSnapshot: " << path << " is not a version " << SNAPSHOT_VERSION << " snapshot" << std::endl);
+		reset();
+		return false;
+	}
+
+	const auto sourceStamp = getSourceStamp(_dictionaryFilePath);
+	if (sourceStamp.first != 0 && sourceStamp != std::make_pair(header.sourceSize, header.sourceWriteTime))
+	{
+		VLOG_WARN("[WARN]: Dictionary::loadSnapshot: " << path << " is out of date with " << _dictionaryFilePath << std::endl);
+		reset();
+		return false;
+	}
+
+	const auto scoresStamp = _scoresFilePath.empty() ? std::make_pair(uint64_t(0), int64_t(0)) : getSourceStamp(_scoresFilePath);
+	if (header.scoreSettings != getScoreSettings() || (scoresStamp.first != 0 && scoresStamp != std::make_pair(header.scoresSize, header.scoresWriteTime)))
+	{
+		VLOG_WARN("[WARN]: Dictionary::loadSnapshot: " << path << " was ranked with other scores than the config gives" << std::endl);
+		reset();
+		return false;
+	}
+
+	for (const auto& section : header.sections)
+	{
+		if (section.offset % 8 != 0 || section.offset > _snapshot.size() || section.size > _snapshot.size() - section.offset)
+		{
+			VLOG_WARN("[WARN]: Dictionary::loadSnapshot: " << path << " is truncated or corrupted" << std::endl);
+			reset();
+			return false;
+		}
+	}
+
+	auto sectionData = [this, &header](SnapshotSectionId id) { return _snapshot.data() + header.sections[id].offset; };
+	auto sectionSize = [&header](SnapshotSectionId id) { return size_t(header.sections[id].size); };
+
+	auto mapTable = [&](StringTable& table, SnapshotSectionId offsetsId, SnapshotSectionId dataId, size_t size)
+	{
+		if (sectionSize(offsetsId) != (size + 1) * sizeof(uint64_t))
+		{
+			return false;
+		}
+		const uint64_t* offsets = reinterpret_cast<const uint64_t*>(sectionData(offsetsId));
+		if (offsets[0] != 0 || offsets[size] != sectionSize(dataId))
+		{
+			return false;
+		}
+		table.view(offsets, size, reinterpret_cast<const char*>(sectionData(dataId)), sectionSize(dataId));
+		return true;
+	};
+
+	// Explanations are interned, so their table has its own size. Every word has to point into it.
+	const size_t numExplanations = sectionSize(SNAPSHOT_EXPLANATION_OFFSETS) / sizeof(uint64_t) - (sectionSize(SNAPSHOT_EXPLANATION_OFFSETS) != 0);
+	const uint32_t* explanationIds = reinterpret_cast<const uint32_t*>(sectionData(SNAPSHOT_EXPLANATION_IDS));
+	const bool validExplanationIds = sectionSize(SNAPSHOT_EXPLANATION_IDS) == header.numWords * sizeof(uint32_t) &&
+		std::all_of(explanationIds, explanationIds + header.numWords, [numExplanations](uint32_t id) { return id < numExplanations; });
+
+	// The ids sorted by word index the word tables
+	const WordId* sortedIds = reinterpret_cast<const WordId*>(sectionData(SNAPSHOT_SORTED_IDS));
+	const bool validSortedIds = sectionSize(SNAPSHOT_SORTED_IDS) == header.numWords * sizeof(WordId) &&
+		std::all_of(sortedIds, sortedIds + header.numWords, [&header](WordId id) { return id < header.numWords; });
+
+	// Tier starts are increasing word ids after the first word
+	const WordId* tierStarts = reinterpret_cast<const WordId*>(sectionData(SNAPSHOT_TIER_STARTS));
+	const size_t numTierStarts = sectionSize(SNAPSHOT_TIER_STARTS) / sizeof(WordId);
+	bool validTierStarts = sectionSize(SNAPSHOT_TIER_STARTS) % sizeof(WordId) == 0 && numTierStarts < MAX_SCORE_TIERS;
+	for (size_t i = 0; validTierStarts && i < numTierStarts; ++i)
+		validTierStarts = tierStarts[i] > (i ? tierStarts[i - 1] : 0) && tierStarts[i] < header.numWords;
+
+	if (!mapTable(_allWords, SNAPSHOT_WORD_OFFSETS, SNAPSHOT_WORD_DATA, size_t(header.numWords)) ||
+		!mapTable(_dirtyWords, SNAPSHOT_DIRTY_OFFSETS, SNAPSHOT_DIRTY_DATA, size_t(header.numWords)) ||
+		!mapTable(_explanations, SNAPSHOT_EXPLANATION_OFFSETS, SNAPSHOT_EXPLANATION_DATA, numExplanations) ||
+		!validExplanationIds ||
+		!validTierStarts ||
+		!validSortedIds ||
+		!_patternIndex.map(sectionData(SNAPSHOT_PATTERN_INDEX), sectionSize(SNAPSHOT_PATTERN_INDEX), LONGEST_WORD, size_t(header.numWords)))
+	{
+		VLOG_WARN("[WARN]: Dictionary::loadSnapshot: " << path << " is truncated or corrupted" << std::endl);
+		reset();
+		return false;
+	}
+	_sortedIds.view(sortedIds, size_t(header.numWords));
+	_explanationIds.view(explanationIds, size_t(header.numWords));
+	_tierStarts.view(tierStarts, numTierStarts);
+
+	VLOG_INFO("[INFO]: Dictionary::loadSnapshot: Mapped " << _allWords.size() << " words from " << path << std::endl);
+	return true;
+}
+
+size_t Dictionary::getNumWords() const
+{
+	return _allWords.size() + getEdits()->words->size();
+}
+
+std::string_view Dictionary::getWord(WordId id) const
+{
+	if (id < _allWords.size())
+	{
+		return _allWords[id];
+	}
+	return (*getEdits()->words)[id - _allWords.size()];
+}
+
+std::string_view Dictionary::getDirty(WordId id) const
+{
+	if (id < _allWords.size())
+	{
+		return _dirtyWords[id].empty() ? _allWords[id] : _dirtyWords[id];
+	}
+	const auto edits = getEdits();
+	const size_t added = id - _allWords.size();
+	return edits->dirtyWords[added].empty() ? (*edits->words)[added] : edits->dirtyWords[added];
+}
+
+std::string_view Dictionary::getExplanation(WordId id) const
+{
+	if (id < _allWords.size())
+	{
+		return _explanations[_explanationIds[id]];
+	}
+	return getEdits()->explanations[id - _allWords.size()];
+}
+
+Dictionary::WordId Dictionary::findWordId(std::string_view clean) const
+{
+	const auto edits = getEdits();
+	auto it = std::lower_bound(_sortedIds.begin(), _sortedIds.end(), clean, [this](WordId id, std::string_view word) { return _allWords[id] < word; });
+	for (; it != _sortedIds.end() && _allWords[*it] == clean; ++it)
+	{
+		if (edits->removed.count(*it) == 0)
+		{
+			return *it;
+		}
+	}
+
+	auto added = edits->addedIds.find(clean);
+	if (added != edits->addedIds.end())
+	{
+		return added->second;
+	}
+	return INVALID_WORD;
+}
+
+std::vector<Dictionary::WordId> Dictionary::findLiveIds(const Edits& edits, std::string_view clean) const
+{
+	std::vector<WordId> ids;
+	auto it = std::lower_bound(_sortedIds.begin(), _sortedIds.end(), clean, [this](WordId id, std::string_view word) { return _allWords[id] < word; });
+	for (; it != _sortedIds.end() && _allWords[*it] == clean; ++it)
+	{
+		if (edits.removed.count(*it) == 0)
+		{
+			ids.push_back(*it);
+		}
+	}
+
+	auto added = edits.addedIds.find(clean);
+	if (added != edits.addedIds.end())
+	{
+		ids.push_back(added->second);
+	}
+	return ids;
+}
+
+std::string_view Dictionary::getDirty(std::string_view clean) const 
 { 
-	auto it = _dirtyDict.find(clean);
-	if (it != _dirtyDict.end())
+	WordId id = findWordId(clean);
+	if (id != INVALID_WORD)
 	{
-		return it->second;
+		return getDirty(id);
 	}
-	return "";
+	return {};
 }
-const std::string& Dictionary::getExplanation(const std::string& clean) const 
+std::string_view Dictionary::getExplanation(std::string_view clean) const 
 { 
-	auto it = _explanationDict.find(clean);
-	if (it != _explanationDict.end())
+	WordId id = findWordId(clean);
+	if (id != INVALID_WORD)
 	{
-		return it->second;
+		return getExplanation(id);
 	}
-	return "";
+	return {};
 }
 
 void Dictionary::shuffle()
 {
-	for (auto length = 0; length < LONGEST_WORD; ++length)
+	std::random_device randomDevice;
+	shuffle((uint64_t(randomDevice()) << 32) | randomDevice());
+}
+
+uint64_t Dictionary::getPatternSeed(std::string_view pattern) const
+{
+	const uint64_t seed = _shuffleSeed.load(std::memory_order_relaxed);
+	return seed ? seed ^ std::hash<std::string_view>()(pattern) : 0; // Different patterns should not walk their words in the same order
+}
+
+/* The cache keeps the words of a pattern in index order, which is tier order until some word is rescored */
+PatternCache::Entry Dictionary::findEntry(std::string_view pattern) const
+{
+	if (_base)
+	{
+		return findLayerEntry(pattern);
+	}
+
+	const uint64_t generation = _patternCache.getGeneration(); // Before the index is read, so words computed before an edit are not cached after it
+	PatternCache::Entry cached;
+	{
+		VMETRIC_TIME_SAMPLED(getMetrics().lookupSeconds);
+		cached = _patternCache.find(pattern);
+	}
+	if (cached)
+	{
+		VMETRIC_INC(getMetrics().cacheHits);
+		VMETRIC_OBSERVE(getMetrics().candidates, double(cached->size()));
+		return cached;
+	}
+	VMETRIC_INC(getMetrics().cacheMisses);
+
+	std::vector<WordId> possibleWordIndices;
+	{
+		VMETRIC_TIME(getMetrics().scanSeconds);
+		_patternIndex.find(pattern, possibleWordIndices);
+	}
+	VMETRIC_OBSERVE(getMetrics().candidates, double(possibleWordIndices.size()));
+
+	const auto edits = getEdits();
+	if (!edits->tiers.empty())
+	{
+		arrangeByTier(*edits, possibleWordIndices);
+	}
+	return _patternCache.insert(pattern, std::move(possibleWordIndices), generation);
+}
+
+/*
+* The base's words are merged with the layer's own matches and the hidden ones are left out on the first query of a pattern.
+* A pattern none of the layer's changes touch is cached as a shared entry, or not at all when the layer hid and rescored
+* nothing, so the layer does not hold a copy of the words its base already holds.
+*/
+PatternCache::Entry Dictionary::findLayerEntry(std::string_view pattern) const
+{
+	const uint64_t generation = _patternCache.getGeneration();
+	if (auto cached = _patternCache.find(pattern))
+	{
+		return cached;
+	}
+
+	const auto edits = getEdits();
+	PatternCache::Entry baseWords = _base->findEntry(pattern);
+	std::vector<WordId> own;
+	_patternIndex.find(pattern, own);
+
+	const bool touchesBase = !edits->hidden.empty() || !edits->rescored.empty();
+	if (own.empty() && !touchesBase)
+	{
+		VMETRIC_INC(getMetrics().layerFromBase);
+		return baseWords;
+	}
+
+	std::vector<WordId> merged;
+	bool changed = !own.empty();
+	if (touchesBase)
+	{
+		merged.reserve(baseWords->size() + own.size());
+		for (WordId id : *baseWords)
+		{
+			if (std::binary_search(edits->hidden.begin(), edits->hidden.end(), id))
+			{
+				changed = true;
+				continue;
+			}
+			changed = changed || std::binary_search(edits->rescored.begin(), edits->rescored.end(), id);
+			merged.push_back(id);
+		}
+	}
+	if (!changed)
+	{
+		VMETRIC_INC(getMetrics().layerFromBase);
+		return _patternCache.insertShared(pattern, std::move(baseWords), generation);
+	}
+
+	VMETRIC_INC(getMetrics().layerMerged);
+	if (!touchesBase)
+	{
+		merged.reserve(baseWords->size() + own.size());
+		merged.assign(baseWords->begin(), baseWords->end());
+	}
+	merged.insert(merged.end(), own.begin(), own.end());
+	arrangeByTier(*edits, merged);
+	return _patternCache.insert(pattern, std::move(merged), generation);
+}
+
+/*
+* The edits are read after the words, so they name every added word the words can hold.
+* Rescored words are out of id order, so the ends of the tiers are searched in the words instead of derived from _tierStarts.
+*/
+Dictionary::Pattern Dictionary::makePattern(PatternCache::Entry words, uint64_t seed) const
+{
+	const auto edits = getEdits();
+	if (edits->tiers.empty())
+	{
+		return Pattern(std::move(words), seed, &_allWords, edits->words, _tierStarts.data(), _tierStarts.size());
+	}
+
+	Cursor::TierEnds tierEnds;
+	size_t end = 0;
+	for (int32_t tier = FEATURED_TIER; end < words->size() && tierEnds.count < MAX_SCORE_TIERS + 1; ++tier)
+	{
+		end = size_t(std::partition_point(words->begin() + end, words->end(), [&](WordId id) { return getScoreTier(*edits, id) <= tier; }) - words->begin());
+		tierEnds.ends[tierEnds.count++] = uint32_t(end);
+	}
+	return Pattern(std::move(words), seed, &_allWords, edits->words, tierEnds);
+}
+
+Dictionary::Pattern Dictionary::findPossible(std::string_view pattern) const
+{
+	return findPossible(pattern, getPatternSeed(pattern));
+}
+
+/* Returns all words which satisfy this pattern. The seed only changes how Pattern walks them. */
+Dictionary::Pattern Dictionary::findPossible(std::string_view pattern, uint64_t seed) const
+{
+	return makePattern(findEntry(pattern), seed);
+}
+
+Dictionary::Pattern Dictionary::findPossible(std::string_view pattern, const Overlay& overlay) const
+{
+	return findPossible(pattern, getPatternSeed(pattern), overlay);
+}
+
+/*
+* Cached words are shared by every request, so the excluded ones are filtered out of a private copy.
+* Both lists are in increasing order and the copy is only made if the overlay excludes one of the words.
+* Rescored words leave the cached words in tier order instead, and then every word is looked up in the overlay.
+*/
+Dictionary::Pattern Dictionary::findPossible(std::string_view pattern, uint64_t seed, const Overlay& overlay) const
+{
+	PatternCache::Entry words = findEntry(pattern);
+
+	std::vector<WordId> kept;
+	bool filtered = false;
+	auto copied = words->begin(); // Words before it are in `kept` already
+	auto keepUntil = [&](std::vector<WordId>::const_iterator excluded)
 	{
-		for (auto& it : _fastSearch[length])
+		if (!filtered)
 		{
-			std::random_shuffle(it.second.begin(), it.second.end());
+			kept.reserve(words->size());
+			filtered = true;
+		}
+		kept.insert(kept.end(), copied, excluded);
+		copied = excluded + 1;
+	};
+
+	if (getEdits()->tiers.empty())
+	{
+		auto search = words->begin();
+		for (WordId excluded : overlay.getExcluded())
+		{
+			search = std::lower_bound(search, words->end(), excluded);
+			if (search == words->end())
+				break;
+			if (*search != excluded)
+				continue;
+
+			keepUntil(search++);
+		}
+	}
+	else if (!overlay.empty())
+	{
+		for (auto it = words->begin(); it != words->end(); ++it)
+		{
+			if (overlay.excludes(*it))
+				keepUntil(it);
 		}
 	}
 
-	for (auto& it : _cacheSearchMap)
+	if (filtered)
 	{
-		std::random_shuffle(it.second->begin(), it.second->end());
+		kept.insert(kept.end(), copied, words->end());
+		words = std::make_shared<const std::vector<WordId>>(std::move(kept));
 	}
+	return makePattern(std::move(words), seed);
 }
 
-/* Efficient function to get key from word used in fastSearch*/
-uint64_t Dictionary::getKey(uint32_t mask, const std::string& word)
+/* Counting does not cache anything: there are no words to cache, and the index answers it with one AND and popcount pass */
+size_t Dictionary::countPossible(std::string_view pattern) const
 {
-	uint64_t key = 0ull;
+	if (auto cached = _patternCache.peek(pattern)) // A miss is answered from the index and never cached, so it is not a cache miss
+	{
+		VMETRIC_INC(getMetrics().countFromCache);
+		return cached->size();
+	}
+	if (_base)
+	{
+		// The own index never holds a word the base returns, so without hidden words the counts add up
+		if (!getEdits()->hidden.empty())
+		{
+			return findLayerEntry(pattern)->size();
+		}
+		return _base->countPossible(pattern) + _patternIndex.count(pattern);
+	}
+	VMETRIC_INC(getMetrics().countFromIndex);
+	return _patternIndex.count(pattern);
+}
+
+/* A layer adds the support of its own words to the base's. Words it hides still count, which only makes forward checks prune less. */
+uint32_t Dictionary::getLetterSupport(std::string_view pattern, uint32_t position) const
+{
+	const uint32_t support = _patternIndex.letterSupport(pattern, position);
+	return _base ? support | _base->getLetterSupport(pattern, position) : support;
+}
 
-	switch (word.size())
+void Dictionary::getLetterSupport(std::string_view pattern, uint32_t* masks) const
+{
+	if (!_base)
 	{
-	default:
-	case 6:
-		key |= ((mask >> 5 & 1u) ? (uint64_t(uint8_t(word[5])) << 40) : 0ull);
-	case 5:
-		key |= ((mask >> 4 & 1u) ? (uint64_t(uint8_t(word[4])) << 32) : 0ull);
-	case 4:
-		key |= ((mask >> 3 & 1u) ? (uint64_t(uint8_t(word[3])) << 24) : 0ull);
-	case 3:
-		key |= ((mask >> 2 & 1u) ? (uint64_t(uint8_t(word[2])) << 16) : 0ull);
-	case 2:
-		key |= ((mask >> 1 & 1u) ? (uint64_t(uint8_t(word[1])) << 8) : 0ull);
-	case 1:
-		key |= ((mask >> 0 & 1u) ? (uint64_t(uint8_t(word[0])) << 0) : 0ull);
-	case 0:
-		break;
+		_patternIndex.letterSupport(pattern, masks);
+		return;
+	}
+
+	_base->getLetterSupport(pattern, masks);
+	if (pattern.size() >= LONGEST_WORD)
+	{
+		return; // No word is that long
+	}
+	uint32_t own[LONGEST_WORD];
+	_patternIndex.letterSupport(pattern, own);
+	for (size_t i = 0; i < pattern.size(); ++i)
+	{
+		masks[i] |= own[i];
 	}
-	return key;
 }
 
-/* Efficient function to get key from word used in fastSearch*/
-uint64_t Dictionary::getKey(const std::string& word)
+/*
+* The new word is published in _edits before it enters the index, so a reader which finds its id can also read it.
+* Only the cached patterns the word matches are dropped.
+*/
+Dictionary::WordId Dictionary::addWord(std::string_view dirtyWord, std::string_view explanation)
 {
-	uint64_t key = 0ull;
+	std::string clean;
+	cleanString(dirtyWord, clean);
+	for (auto& c : clean)
+		c = toupper(uint8_t(c));
+
+	if (clean.empty() || clean.size() >= LONGEST_WORD)
+	{
+		VLOG_WARN("[WARN]: Dictionary::addWord: Skipping " << dirtyWord << ". Words have to have between 1 and " << uint32_t(LONGEST_WORD) - 1 << " letters." << std::endl);
+		return INVALID_WORD;
+	}
+
+	std::lock_guard<std::mutex> lock(_editMutex);
+
+	const WordId existing = findWordId(clean);
+	if (existing != INVALID_WORD)
+	{
+		changeBan(clean, false);
+		return existing;
+	}
+
+	const auto current = getEdits();
+	auto edits = std::make_shared<Edits>(*current);
+	const WordId id = WordId(_allWords.size() + current->words->size());
 
-	switch (word.size())
+	_editStrings.push_back(clean);
+	const std::string_view word = _editStrings.back();
+	std::string_view dirty;
+	if (dirtyWord != clean)
 	{
-	default:
-	case 6:
-		key |= (uint64_t(uint8_t(word[5])) << 40);
-	case 5:
-		key |= (uint64_t(uint8_t(word[4])) << 32);
-	case 4:
-		key |= (uint64_t(uint8_t(word[3])) << 24);
-	case 3:
-		key |= (uint64_t(uint8_t(word[2])) << 16);
-	case 2:
-		key |= (uint64_t(uint8_t(word[1])) << 8);
-	case 1:
-		key |= (uint64_t(uint8_t(word[0])) << 0);
-	case 0:
-		break;
+		_editStrings.emplace_back(dirtyWord);
+		dirty = _editStrings.back();
 	}
-	return key;
+	_editStrings.emplace_back(explanation);
+
+	auto words = std::make_shared<std::vector<std::string_view>>(*current->words);
+	words->push_back(word);
+	edits->words = std::move(words);
+	edits->dirtyWords.push_back(dirty);
+	edits->explanations.push_back(_editStrings.back());
+	edits->addedIds.emplace(word, id);
+	std::atomic_store(&_edits, std::shared_ptr<const Edits>(std::move(edits)));
+
+	_patternIndex.insert(id, word);
+	_patternCache.invalidate(word);
+
+	VLOG_INFO("[INFO]: Dictionary::addWord: Added " << word << " as word " << id << std::endl);
+	return id;
 }
 
-/* Returns whether the contender word matches the pattern*/
-inline bool Dictionary::isPossible(const std::string& pattern, const std::string& contender, const std::vector<uint32_t>& filledIndices)
+bool Dictionary::removeWord(std::string_view clean)
 {
-	for (uint32_t i : filledIndices)
-		if (pattern[i] != contender[i])
-			return false;
-	
+	std::lock_guard<std::mutex> lock(_editMutex);
+
+	const auto current = getEdits();
+	const auto ids = findLiveIds(*current, clean);
+	if (ids.empty())
+	{
+		return false;
+	}
+
+	auto edits = std::make_shared<Edits>(*current);
+	for (WordId id : ids)
+	{
+		if (edits->banned.erase(id) == 0) // Nothing to do for a banned word
+		{
+			setSearchable(*edits, id, false);
+		}
+		edits->removed.insert(id);
+	}
+	edits->addedIds.erase(clean);
+	std::atomic_store(&_edits, std::shared_ptr<const Edits>(std::move(edits)));
+
+	_patternCache.invalidate(clean);
 	return true;
 }
 
-/* Returns all words which satisfy this pattern */
-Dictionary::Pattern Dictionary::findPossible(const std::string& pattern)
+bool Dictionary::banWord(std::string_view clean)
+{
+	std::lock_guard<std::mutex> lock(_editMutex);
+	return changeBan(clean, true);
+}
+
+bool Dictionary::unbanWord(std::string_view clean)
+{
+	std::lock_guard<std::mutex> lock(_editMutex);
+	return changeBan(clean, false);
+}
+
+bool Dictionary::changeBan(std::string_view clean, bool banned)
 {
+	const auto current = getEdits();
+	const auto ids = findLiveIds(*current, clean);
+	if (ids.empty())
 	{
-		auto it = _cacheSearchMap.find(pattern);
-		if (it != _cacheSearchMap.end())
-		{
-			auto& newCachePosition = it->second;
+		return false;
+	}
 
-			return Pattern(newCachePosition->size(),
-						   newCachePosition->begin(),
-						   [this](uint16_t index) -> const std::string& { return getFromIndex(index); });
+	auto edits = std::make_shared<Edits>(*current);
+	bool changed = false;
+	for (WordId id : ids)
+	{
+		if (banned ? !edits->banned.insert(id).second : edits->banned.erase(id) == 0)
+		{
+			continue;
 		}
+		changed = true;
+		setSearchable(*edits, id, !banned);
+	}
+
+	if (changed)
+	{
+		std::atomic_store(&_edits, std::shared_ptr<const Edits>(std::move(edits)));
+		_patternCache.invalidate(clean);
+	}
+	return true;
+}
+
+bool Dictionary::rescoreWord(std::string_view clean, int32_t tier)
+{
+	if (tier < FEATURED_TIER || tier >= int32_t(MAX_SCORE_TIERS))
+	{
+		VLOG_WARN("[WARN]: Dictionary::rescoreWord: Tier " << tier << " of " << clean << " is out of range" << std::endl);
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(_editMutex);
+
+	const auto current = getEdits();
+	const auto ids = findLiveIds(*current, clean);
+	if (ids.empty())
+	{
+		return false;
 	}
 
-	auto key = getKey(pattern);
-	auto& narrowedWords = _fastSearch[pattern.size()][key];
-	
-	if (pattern.size() <= 6) // The narrowedWords are the possible words
+	auto edits = std::make_shared<Edits>(*current);
+	for (WordId id : ids)
 	{
-		auto newCachePosition = new std::vector<uint16_t>(narrowedWords);
-		_cacheSearchMap[pattern] = newCachePosition;
+		edits->tiers[id] = tier;
+		if (_base)
+		{
+			auto it = std::lower_bound(edits->rescored.begin(), edits->rescored.end(), id);
+			if (it == edits->rescored.end() || *it != id)
+			{
+				edits->rescored.insert(it, id);
+			}
+		}
+	}
+	std::atomic_store(&_edits, std::shared_ptr<const Edits>(std::move(edits)));
+
+	_patternCache.invalidate(clean);
+	return true;
+}
 
-		return Pattern(newCachePosition->size(), 
-					   newCachePosition->begin(), 
-					   [this](uint16_t index) -> const std::string& { return getFromIndex(index); });
+/*
+* The words a layer gets from its base cannot leave the base's index, so the layer hides them instead.
+* Everything else (own words and base words the base does not return, e.g. ones the layer unbanned) lives in the own index.
+*/
+void Dictionary::setSearchable(Edits& edits, WordId id, bool searchable)
+{
+	if (_base && _base->isSearchable(*_base->getEdits(), id))
+	{
+		auto it = std::lower_bound(edits.hidden.begin(), edits.hidden.end(), id);
+		const bool hidden = it != edits.hidden.end() && *it == id;
+		if (searchable && hidden)
+		{
+			edits.hidden.erase(it);
+		}
+		else if (!searchable && !hidden)
+		{
+			edits.hidden.insert(it, id);
+		}
+	}
+	else if (searchable)
+	{
+		_patternIndex.insert(id, getWord(id));
 	}
 	else
 	{
-		std::vector<uint16_t>* possibleWordIndices = new std::vector<uint16_t>;
-		possibleWordIndices->reserve(narrowedWords.size());
-		std::vector<uint32_t> filledIndices;
-		filledIndices.reserve(pattern.size());
+		_patternIndex.erase(id, getWord(id));
+	}
+}
+
+std::shared_ptr<const BKTree> Dictionary::getBKTree() const
+{
+	if (_base)
+	{
+		return _base->getBKTree(); // Built over the same word table
+	}
+
+	auto tree = std::atomic_load(&_bkTree);
+	if (tree)
+	{
+		return tree;
+	}
 
-		for (uint32_t i = 0; i < pattern.size(); ++i)
-			if (pattern[i] != ANY_CHAR)
-				filledIndices.push_back(i);
+	std::lock_guard<std::mutex> lock(_bkTreeMutex);
+	tree = std::atomic_load(&_bkTree);
+	if (!tree)
+	{
+		auto built = std::make_shared<BKTree>();
+		built->build(_allWords);
+		VLOG_INFO("[INFO]: Dictionary::getBKTree: Built a BK-tree over " << built->size() << " words (" << built->memoryUsage() << " bytes)" << std::endl);
+		tree = std::move(built);
+		std::atomic_store(&_bkTree, tree);
+	}
+	return tree;
+}
 
-		for (auto contender : narrowedWords)
-			if (isPossible(pattern, getFromIndex(contender), filledIndices))
-				possibleWordIndices->push_back(contender);
+std::vector<Dictionary::Match> Dictionary::findNearest(std::string_view clean, size_t k, uint32_t maxDistance) const
+{
+	const auto edits = getEdits();
+	const auto tree = getBKTree();
 
-		_cacheSearchMap[pattern] = possibleWordIndices;
+	// The tree only holds the loaded words: removed ones are skipped and the few added ones are compared one by one
+	std::vector<Match> matches;
+	for (const auto& match : tree->findNearest(clean, k + edits->removed.size(), maxDistance))
+	{
+		if (edits->removed.count(match.id) == 0)
+		{
+			matches.push_back({ match.id, _allWords[match.id], match.distance });
+		}
+	}
+	for (size_t i = 0; i < edits->words->size(); ++i)
+	{
+		const WordId id = WordId(_allWords.size() + i);
+		const std::string_view word = (*edits->words)[i];
+		const uint32_t distance = editDistance(clean, word, maxDistance);
+		if (distance <= maxDistance && edits->removed.count(id) == 0)
+		{
+			matches.push_back({ id, word, distance });
+		}
+	}
 
-		return Pattern(possibleWordIndices->size(),
-			           possibleWordIndices->begin(),
-					   [this](uint16_t index) -> const std::string& { return getFromIndex(index); });
+	std::sort(matches.begin(), matches.end(), [](const Match& a, const Match& b) { return a.distance == b.distance ? a.id < b.id : a.distance < b.distance; });
+	if (matches.size() > k)
+	{
+		matches.resize(k);
 	}
+	return matches;
 }
 
-}
\ No newline at end of file
+}
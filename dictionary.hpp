@@ -5,10 +5,25 @@
 #include <list>
 #include <algorithm>
 #include <string>
+#include <string_view>
+#include <functional>
+#include <cassert>
+#include <type_traits>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <deque>
 #include <boost/property_tree/ini_parser.hpp>
 
 #include "robin_hood.h"
 #include "crosswordutils.hpp"
+#include "patternindex.hpp"
+#include "patterncache.hpp"
+#include "stringtable.hpp"
+#include "mappedfile.hpp"
+#include "permutation.hpp"
+#include "bktree.hpp"
+#include "threadpool.hpp"
 
 namespace utils
 {
@@ -17,56 +32,240 @@ namespace utils
 	{
 	public:
 
+		using WordId = uint32_t; // Index of a word in the dictionary. Holds any dictionary size.
+
+		const static WordId INVALID_WORD = UINT32_MAX;
 		const static uint8_t ANY_CHAR = 0; // Used in patterns to indicate that any character can be placed there
 		const static uint8_t LONGEST_WORD = 50;
+		const static uint32_t MAX_SCORE_TIERS = 16;
+		const static int32_t FEATURED_TIER = -1; // Set with rescoreWord. Walked before tier 0.
 		const static char* DEFAULT_DICTIONARY_PATH;
 		const static char* DEFAULT_CONFIG_PATH;
 	
 	public:
 
-		class Pattern
+		struct Candidate
+		{
+			WordId id;
+			std::string_view word;
+		};
+
+		struct Match
+		{
+			WordId id;
+			std::string_view word;
+			uint32_t distance; // Edit distance to the query
+		};
+
+		/*
+		* Trivially copyable cursor over the words matching a pattern.
+		* Holds a direct pointer to the word table and the span of matching ids, so stepping does no indirect calls.
+		* Words are numbered best score first, so the ids of every score tier are a contiguous part of the span. The
+		* tiers are walked in order and the seed only shuffles the words inside each one.
+		* It stays valid as long as the Pattern it came from.
+		*/
+		class Cursor
 		{
 		public:
-			Pattern(size_t size, std::vector<uint16_t>::iterator nextWord, std::function<const std::string& (uint16_t)> callback) :
-				size(size),
-				_get(std::move(callback)),
-				_nextWord(nextWord),
-				_begin(std::move(nextWord))
-			{}
-			Pattern() : 
-				size(0),
-				_get([](uint32_t) -> const std::string& { assert(false && "Using uninitialized Pattern"); return ""; })
-			{}
-			Pattern(Pattern&& other) noexcept
+			/* Positions in the span after the last word of every tier, for spans which are ordered by tier but not by id (see rescoreWord) */
+			struct TierEnds
+			{
+				uint32_t ends[MAX_SCORE_TIERS + 1] = {};
+				uint32_t count = 0;
+			};
+
+			class iterator
+			{
+			public:
+				iterator(const Cursor* cursor, size_t step) : _cursor(cursor), _step(step) {}
+
+				Candidate operator*() const { return _cursor->at(_step); }
+				iterator& operator++() { ++_step; return *this; }
+				bool operator!=(const iterator& other) const { return _step != other._step; }
+				bool operator==(const iterator& other) const { return _step == other._step; }
+
+			private:
+				const Cursor* _cursor;
+				size_t _step;
+			};
+
+		public:
+			Cursor() = default;
+			Cursor(const StringTable* words, const std::string_view* addedWords, const WordId* ids, size_t size, IndexPermutation order,
+				const WordId* tierStarts = nullptr, size_t numTierStarts = 0) :
+				_words(words),
+				_addedWords(addedWords),
+				_ids(ids),
+				_size(size),
+				_order(order)
 			{
-				*this = std::move(other);
+				// Ends of the tiers which hold some of the ids. Ids are increasing, so each search starts at the previous end.
+				size_t start = 0;
+				for (size_t i = 0; i < numTierStarts && start < size && _numTiers + 1 < MAX_SCORE_TIERS; ++i)
+				{
+					const size_t end = size_t(std::lower_bound(ids + start, ids + size, tierStarts[i]) - ids);
+					if (end != start)
+						addTier(start, end);
+					start = end;
+				}
+				addTier(start, size);
 			}
+			Cursor(const StringTable* words, const std::string_view* addedWords, const WordId* ids, size_t size, IndexPermutation order, const TierEnds& tierEnds) :
+				_words(words),
+				_addedWords(addedWords),
+				_ids(ids),
+				_size(size),
+				_order(order)
+			{
+				// Tiers past the capacity are walked as part of the last one
+				size_t start = 0;
+				for (uint32_t i = 0; i < tierEnds.count && start < size && _numTiers + 1 < MAX_SCORE_TIERS; ++i)
+				{
+					const size_t end = std::min<size_t>(tierEnds.ends[i], size);
+					if (end > start)
+						addTier(start, end);
+					start = std::max(start, end);
+				}
+				addTier(start, size);
+			}
+
+			bool exhausted() const { return _next >= _size; }
+			size_t size() const { return _size; }
+			size_t remaining() const { return _size - _next; }
+			void reset() { _next = 0; }
 
-			void operator=(Pattern&& other) noexcept
+			Candidate next() // Has to be !exhausted()
+			{
+				assert(!exhausted() && "[LOGICAL ERROR]: Reading past the end of a Cursor!");
+				return at(_next++);
+			}
+			size_t next(Candidate* out, size_t maxCount) // Writes up to maxCount candidates in `out`. Returns how many were written.
 			{
-				size = other.size;
-				_get = std::move(other._get);
-				_nextWord = std::move(other._nextWord);
-				_begin = std::move(other._begin);
+				const size_t count = std::min(maxCount, remaining());
+				for (size_t i = 0; i < count; ++i)
+					out[i] = at(_next++);
+				return count;
 			}
 
-			void reset() { _nextWord = _begin; }
+			iterator begin() const { return iterator(this, _next); } // Range-for visits the remaining candidates without consuming them
+			iterator end() const { return iterator(this, _size); }
+
+		private:
+			Candidate at(size_t step) const
+			{
+				const WordId id = _ids[position(step)];
+				return { id, id < _words->size() ? (*_words)[id] : _addedWords[id - _words->size()] };
+			}
+			size_t position(size_t step) const
+			{
+				if (_numTiers == 1)
+					return size_t(_order(step));
+
+				uint32_t tier = 0;
+				while (step >= _tierEnds[tier])
+					++tier;
+				const size_t start = tier ? _tierEnds[tier - 1] : 0;
+				return start + size_t(_order.within(step - start, _tierEnds[tier] - start, _tierHalfBits[tier]));
+			}
+			void addTier(size_t start, size_t end)
+			{
+				_tierEnds[_numTiers] = uint32_t(end);
+				_tierHalfBits[_numTiers++] = uint8_t(IndexPermutation::getHalfBits(end - start));
+			}
+
+		private:
+			const StringTable* _words = nullptr;
+			const std::string_view* _addedWords = nullptr; // Words added with addWord, numbered after _words
+			const WordId* _ids = nullptr;
+			size_t _size = 0;
+			size_t _next = 0;
+			IndexPermutation _order; // Maps from iteration step to position in _ids
+			uint32_t _tierEnds[MAX_SCORE_TIERS] = {}; // Position in _ids after the last word of every non-empty tier
+			uint8_t _tierHalfBits[MAX_SCORE_TIERS] = {}; // IndexPermutation::getHalfBits of the size of every tier
+			uint32_t _numTiers = 0;
+		};
+		static_assert(std::is_trivially_copyable<Cursor>::value, "Cursor has to stay trivially copyable");
+
+		/* Owns the words matching a pattern (they stay alive even if they are evicted from the cache) and walks them with a Cursor */
+		class Pattern
+		{
+		public:
+			Pattern() = default;
+			Pattern(PatternCache::Entry words, uint64_t seed, const StringTable* wordTable, std::shared_ptr<const std::vector<std::string_view>> addedWords,
+				const WordId* tierStarts = nullptr, size_t numTierStarts = 0) :
+				size(words->size()),
+				_words(std::move(words)),
+				_addedWords(std::move(addedWords)),
+				_cursor(wordTable, _addedWords->data(), _words->data(), _words->size(), IndexPermutation(_words->size(), seed), tierStarts, numTierStarts)
+			{}
+			Pattern(PatternCache::Entry words, uint64_t seed, const StringTable* wordTable, std::shared_ptr<const std::vector<std::string_view>> addedWords,
+				const Cursor::TierEnds& tierEnds) :
+				size(words->size()),
+				_words(std::move(words)),
+				_addedWords(std::move(addedWords)),
+				_cursor(wordTable, _addedWords->data(), _words->data(), _words->size(), IndexPermutation(_words->size(), seed), tierEnds)
+			{}
+
+			Pattern(const Pattern& other) { *this = other; }
+			Pattern(Pattern&& other) noexcept { *this = std::move(other); }
+			Pattern& operator=(const Pattern& other) = default;
+			Pattern& operator=(Pattern&& other) noexcept = default;
+
+			const Cursor& cursor() const { return _cursor; }
+			bool exhausted() const { return _cursor.exhausted(); }
+			Candidate next() { return _cursor.next(); }
+			size_t next(Candidate* out, size_t maxCount) { return _cursor.next(out, maxCount); }
+			void reset() { _cursor.reset(); }
+
+			Cursor::iterator begin() const { return _cursor.begin(); }
+			Cursor::iterator end() const { return _cursor.end(); }
 
 		public:
-			size_t size; // The number of possible words
-			std::pair<uint16_t, const std::string&> operator()() { return { *_nextWord, _get(*(_nextWord++)) }; } // Returns the next possible word and its index
+			size_t size = 0; // The number of possible words
+			std::pair<WordId, std::string_view> operator()() { auto candidate = next(); return { candidate.id, candidate.word }; } // Returns the next possible word and its index
 
 		private:
-			std::function<const std::string& (uint16_t)> _get; // callback to dictionary which returns word from index.
-			std::vector<uint16_t>::iterator _nextWord, _begin; // iterator given at construction pointing from vector of possible words.
+			PatternCache::Entry _words; // Possible words in index order
+			std::shared_ptr<const std::vector<std::string_view>> _addedWords; // Kept alive for the cursor
+			Cursor _cursor;
 
 		};
 
+		/*
+		* Changes applied by one request on top of the shared dictionary at query time, e.g. the words already used in this issue.
+		* Cheap to build and private to its owner, so it needs no locking.
+		*/
+		class Overlay
+		{
+		public:
+			void exclude(WordId id)
+			{
+				auto it = std::lower_bound(_excluded.begin(), _excluded.end(), id);
+				if (it == _excluded.end() || *it != id)
+					_excluded.insert(it, id);
+			}
+			void include(WordId id)
+			{
+				auto it = std::lower_bound(_excluded.begin(), _excluded.end(), id);
+				if (it != _excluded.end() && *it == id)
+					_excluded.erase(it);
+			}
+			bool excludes(WordId id) const { return std::binary_search(_excluded.begin(), _excluded.end(), id); }
+			const std::vector<WordId>& getExcluded() const { return _excluded; } // In increasing order
+			bool empty() const { return _excluded.empty(); }
+			void clear() { _excluded.clear(); }
+
+		private:
+			std::vector<WordId> _excluded;
+		};
+
 	public:
 
-		static int levenstein(std::string a, std::string b); // Returns the distance between word `a` and word `b`
+		static int levenstein(std::string_view a, std::string_view b); // Returns the distance between word `a` and word `b`
+		static int levenstein(std::string_view a, std::string_view b, int maxDistance); // Returns maxDistance + 1 if the distance is larger. Stops early.
 
 		static std::string cleanString(const std::string& dirtyString);
+		static void cleanString(std::string_view dirtyString, std::string& clean); // Writes the clean form in `clean`, reusing its memory
 		static std::string toupper(std::string word);
 		static std::string tolower(std::string word);
 		static uint8_t toupper(uint8_t c);
@@ -74,42 +273,136 @@ namespace utils
 
 	public:
 
-		const std::vector<std::string>& getAllWords() const { return _allWords; }
-		const std::string& getDirty(const std::string& clean) const;
-		const std::string& getExplanation(const std::string& clean) const;
-		Pattern findPossible(const std::string& pattern);
-		void shuffle();
+		const StringTable& getAllWords() const { return _allWords; } // The loaded words. Words added with addWord come after them (see getWord).
+		size_t getNumWords() const; // Loaded and added words, removed ones included. WordIds are below it.
+		std::string_view getWord(WordId id) const;
+		WordId findWordId(std::string_view clean) const; // Returns the first word equal to `clean` which was not removed or INVALID_WORD
+		std::string_view getDirty(std::string_view clean) const;
+		std::string_view getExplanation(std::string_view clean) const;
+		std::string_view getDirty(WordId id) const;
+		std::string_view getExplanation(WordId id) const;
+		Pattern findPossible(std::string_view pattern) const; // Safe to call from any number of threads, even during addWord, removeWord and banWord. Iterates best score tier first, each tier in the order of the current shuffle seed.
+		Pattern findPossible(std::string_view pattern, uint64_t seed) const; // Iterates each tier in the order given by `seed`. Seed 0 is index order, which is best score first.
+		Pattern findPossible(std::string_view pattern, const Overlay& overlay) const; // Leaves out the words excluded by `overlay`
+		Pattern findPossible(std::string_view pattern, uint64_t seed, const Overlay& overlay) const;
+		size_t countPossible(std::string_view pattern) const; // findPossible(pattern).size, read from the cache or counted straight from the index without building a Pattern
+		uint32_t getLetterSupport(std::string_view pattern, uint32_t position) const; // Bit i is set if a word matching `pattern` has letter CYRILLIC_A - 32 + i at `position`
+		void getLetterSupport(std::string_view pattern, uint32_t* masks) const; // Writes the support of every position of the pattern in `masks`
+		std::vector<Match> findNearest(std::string_view clean, size_t k, uint32_t maxDistance = UINT32_MAX) const; // The k clean words closest to `clean` by edit distance. Builds a BK-tree on the first call.
+		void shuffle(); // Picks a new random shuffle seed. O(1)
+		void shuffle(uint64_t seed) { _shuffleSeed = seed; } // Makes the order of findPossible reproducible
+		uint32_t getNumScoreTiers() const { return uint32_t(_tierStarts.size()) + 1; } // 1 without scores. FEATURED_TIER and the tiers set by rescoreWord come on top.
+		int32_t getScoreTier(WordId id) const; // 0 is the best. Added words rank with the last tier unless they were rescored.
+
+		/*
+		* Editorial changes without a reload. Each one copies the pattern index of the word's length and drops only the cached
+		* patterns the word matches. Added words have the highest ids, so the index copies only the few words added since its
+		* last fold (see PatternIndex). Removing, banning and unbanning a loaded word copy its whole length.
+		* They are serialized with each other and safe to call while other threads query.
+		* Changes live in memory only: they are lost on reload and a changed dictionary does not write snapshots.
+		*/
+		WordId addWord(std::string_view dirtyWord, std::string_view explanation); // Windows-1251 text. Returns the id of the word, which is the existing one (unbanned) if the clean word is already there. INVALID_WORD if it has no letters or is too long.
+		bool removeWord(std::string_view clean); // Removes every word equal to `clean` from findPossible and from the lookups. Returns false if there was none.
+		bool banWord(std::string_view clean); // Keeps the words equal to `clean` out of findPossible. They can still be looked up.
+		bool unbanWord(std::string_view clean);
+		bool rescoreWord(std::string_view clean, int32_t tier); // Moves the words equal to `clean` to `tier`, from FEATURED_TIER to MAX_SCORE_TIERS - 1. Returns false if there was none.
+
+		bool saveSnapshot(const std::string& path) const; // Writes the word tables and the pattern index in a binary snapshot. Not for layers.
+		bool loadSnapshot(const std::string& path); // Memory maps a snapshot written by saveSnapshot. Rejects it if it is older than the text dictionary. Not for layers.
+
+		PatternIndex::MemoryStats getIndexMemoryStats(uint32_t length) const { return _patternIndex.getMemoryStats(length); } // Memory used by the pattern index for words of the given length
+		void reportMemoryUsage() const; // Logs the index memory for every word length
+
+		PatternCache::Stats getCacheStats() const { return _patternCache.getStats(); }
+		void setCacheBudget(size_t budgetBytes) { _patternCache.setBudget(budgetBytes); }
+
+		const std::shared_ptr<const Dictionary>& getBase() const { return _base; } // nullptr unless this is a layer
 
 	public:
 
 		Dictionary();
 		Dictionary(const std::string& configFilePath);
+
+		/*
+		* Layering: a dictionary made over a base shares the base's tables, pattern index and cached patterns instead of copying them.
+		* It starts with the base's edits, and its own addWord, removeWord, banWord and rescoreWord do not touch the base. Its own
+		* index holds only the words it added, and findPossible merges them into the base's words (leaving out the hidden ones)
+		* the first time a pattern is asked for. Patterns it does not change are served straight from the base.
+		* Layers can be stacked. The base must not be edited once it has layers.
+		*/
+		explicit Dictionary(std::shared_ptr<const Dictionary> base);
 		~Dictionary();
 
 	private:
 		
-		static uint64_t getKey(uint32_t mask, const std::string& word);
-		static uint64_t getKey(const std::string& word);
-		static inline bool isPossible(const std::string& pattern, const std::string& contender, const std::vector<uint32_t>& filledIndices);
+		void loadConfig(); // Reads everything except the dictionary path from _iniPropertyTree
+		void loadDictionary(); // Loads the snapshot if there is a valid one. Otherwise parses the text dictionary and writes a new snapshot.
+		void loadTextDictionary();
+		std::vector<double> computeScores() const; // Score of every loaded word from dictionary.scores_file_path and the fillability of its letters. Empty if scoring is off.
+		void rankWords(std::vector<uint32_t>& wordExplanations); // Renumbers the loaded words best score first and splits them in tiers
+		uint64_t getScoreSettings() const; // Hash of the settings rankWords depends on, so a snapshot ranked differently is rejected
+		void reset();
+		std::shared_ptr<const BKTree> getBKTree() const; // A layer uses the tree of its base
 
-		void addToFastSearch(const std::string& newWord, uint16_t index);
-		inline const std::string& getFromIndex(uint16_t index) const { return _allWords[index]; }
+		/* Everything addWord, removeWord, banWord and rescoreWord changed since loading (a layer starts with the base's). Immutable: every change publishes a new copy. */
+		struct Edits
+		{
+			std::shared_ptr<const std::vector<std::string_view>> words = std::make_shared<const std::vector<std::string_view>>(); // Clean form of the added words. Word _allWords.size() + i is words[i].
+			std::vector<std::string_view> dirtyWords; // Parallel to words
+			std::vector<std::string_view> explanations; // Parallel to words
+			robin_hood::unordered_map<std::string_view, WordId> addedIds; // Clean form of every added word which was not removed
+			robin_hood::unordered_set<WordId> removed;
+			robin_hood::unordered_set<WordId> banned; // Not in the index, but still found by findWordId
+			robin_hood::unordered_map<WordId, int32_t> tiers; // Set by rescoreWord
+			std::vector<WordId> hidden; // Layers: words of the base's index which this layer removed or banned. Sorted.
+			std::vector<WordId> rescored; // Layers: words rescored by this layer. Sorted.
 
-		void loadDictionary();
-		void reset();
+			bool empty() const { return words->empty() && removed.empty() && banned.empty() && tiers.empty(); }
+		};
+
+		std::shared_ptr<const Edits> getEdits() const { return std::atomic_load(&_edits); }
+		std::vector<WordId> findLiveIds(const Edits& edits, std::string_view clean) const; // Every word equal to `clean` which was not removed
+		bool changeBan(std::string_view clean, bool banned); // Has to hold _editMutex
+		bool isSearchable(const Edits& edits, WordId id) const { return id < getNumWords() && edits.removed.count(id) == 0 && edits.banned.count(id) == 0; } // findPossible can return the word
+		void setSearchable(Edits& edits, WordId id, bool searchable); // Puts the word in the own index or takes it out. A layer hides the words of its base instead.
+		int32_t getScoreTier(const Edits& edits, WordId id) const;
+		void arrangeByTier(const Edits& edits, std::vector<WordId>& ids) const; // Orders ids best tier first and by id inside a tier
+		uint64_t getPatternSeed(std::string_view pattern) const; // Seed of findPossible without one
+		PatternCache::Entry findEntry(std::string_view pattern) const; // Ordered by tier and id
+		PatternCache::Entry findLayerEntry(std::string_view pattern) const;
+		Pattern makePattern(PatternCache::Entry words, uint64_t seed) const;
 
 	private:
 
-		robin_hood::unordered_map<std::string, std::string> _explanationDict; // Given a clean word it returns an explination.
-		robin_hood::unordered_map<std::string, std::string> _dirtyDict; // Given a clean word it returns the original untouched word in the dictionary.
-		std::vector<std::string> _allWords; // All words loaded from the dict
+		std::shared_ptr<const Dictionary> _base; // Of a layer. The tables below view its memory. First member, so it outlives the views.
+		MappedFile _snapshot; // Backs the tables and the index when they were loaded from a snapshot. Declared before them for the same reason.
+
+		StringTable _allWords; // All clean words loaded from the dict. Indexed by WordId.
+		StringTable _dirtyWords; // The original untouched words. Indexed by WordId. Empty when the dirty form is the clean word.
+		StringTable _explanations; // Every different explanation once. Indexed by _explanationIds.
+		MappedArray<uint32_t> _explanationIds; // Indexed by WordId
+		MappedArray<WordId> _sortedIds; // All word ids sorted by word (ties by id). Used to find a word's id.
+		MappedArray<WordId> _tierStarts; // First word id of every score tier after the first. Empty without scores.
+
+		mutable PatternCache _patternCache; // Maps from pattern to the words matching it. Bounded by dictionary.cache_budget_bytes
+		std::atomic<uint64_t> _shuffleSeed{ 0 }; // Default seed of findPossible
+		PatternIndex _patternIndex; // Bitmap per (length, position, letter) used to find the words matching a pattern. A layer's holds only its own words.
+
+		mutable std::mutex _bkTreeMutex; // Taken only to build the tree
+		mutable std::shared_ptr<const BKTree> _bkTree; // Over _allWords. Built by the first findNearest, read with atomic_load.
 
-		robin_hood::unordered_map<std::string, std::vector<uint16_t>*> _cacheSearchMap; // Maps from pattern to cache
-		robin_hood::unordered_map<uint64_t, std::vector<uint16_t>> _fastSearch[LONGEST_WORD]; // Maps from first six (or less if there aren't enough) letters to word indices. Divided by length.
+		std::mutex _editMutex; // Serializes addWord, removeWord and banWord
+		std::deque<std::string> _editStrings; // Backs the views of _edits. Never moves its strings.
+		std::shared_ptr<const Edits> _edits = std::make_shared<const Edits>(); // Read with atomic_load, replaced with atomic_store
 
 		boost::property_tree::ptree _iniPropertyTree;
 
 		std::string _dictionaryFilePath;
+		std::string _snapshotFilePath; // dictionary.snapshot_file_path. Empty if snapshots are disabled.
+		size_t _loadThreads = 1; // dictionary.load_threads. 0 in the config means one per core.
+		std::string _scoresFilePath; // dictionary.scores_file_path: `word<TAB>frequency[<TAB>priority]` lines in the encoding of the dictionary
+		double _fillabilityWeight = 0; // dictionary.fillability_weight: weight of the mean log2 frequency of a word's letters in its score
+		uint32_t _numScoreTiers = 8; // dictionary.score_tiers
 
 	};
 
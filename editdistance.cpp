@@ -0,0 +1,127 @@
+#include "editdistance.hpp"
+
+#include <algorithm>
+#include <vector>
+
+namespace utils
+{
+
+const uint32_t NO_LIMIT = UINT32_MAX;
+
+/*
+* Myers/Hyyro: bit i of Pv/Mv tells if D[i + 1][j] - D[i][j] is +1/-1 for the current column j of the DP over `text`.
+* `pattern` has to be 1 to 64 letters. Stops with maxDistance + 1 once the distance cannot come back under maxDistance.
+*/
+static uint32_t myersDistance(std::string_view pattern, std::string_view text, uint32_t maxDistance)
+{
+	uint64_t peq[256] = {}; // Bit i of peq[c] is set if pattern[i] == c
+	for (size_t i = 0; i < pattern.size(); ++i)
+		peq[uint8_t(pattern[i])] |= 1ull << i;
+
+	const uint64_t last = 1ull << (pattern.size() - 1);
+	uint64_t pv = ~0ull;
+	uint64_t mv = 0;
+	uint32_t score = uint32_t(pattern.size());
+
+	for (size_t j = 0; j < text.size(); ++j)
+	{
+		const uint64_t eq = peq[uint8_t(text[j])];
+		const uint64_t xv = eq | mv;
+		const uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+		uint64_t ph = mv | ~(xh | pv);
+		uint64_t mh = pv & xh;
+
+		if (ph & last)
+			++score;
+		else if (mh & last)
+			--score;
+
+		// The distance drops by at most one per remaining letter
+		if (maxDistance != NO_LIMIT && score > maxDistance + (text.size() - j - 1))
+			return maxDistance + 1;
+
+		ph = (ph << 1) | 1;
+		mh <<= 1;
+		pv = mh | ~(xv | ph);
+		mv = ph & xv;
+	}
+	return maxDistance != NO_LIMIT && score > maxDistance ? maxDistance + 1 : score;
+}
+
+/* Classic DP keeping two rows. `b` is the shorter string. */
+static uint32_t rowDistance(std::string_view a, std::string_view b)
+{
+	std::vector<uint32_t> prev(b.size() + 1), cur(b.size() + 1);
+	for (size_t j = 0; j <= b.size(); ++j)
+		prev[j] = uint32_t(j);
+
+	for (size_t i = 1; i <= a.size(); ++i)
+	{
+		cur[0] = uint32_t(i);
+		for (size_t j = 1; j <= b.size(); ++j)
+			cur[j] = std::min({ prev[j] + 1, cur[j - 1] + 1, prev[j - 1] + (a[i - 1] != b[j - 1]) });
+		std::swap(prev, cur);
+	}
+	return prev[b.size()];
+}
+
+/* DP over the diagonals |i - j| <= maxDistance. Cells outside the band hold maxDistance + 1. `b` is the shorter string. */
+static uint32_t bandedDistance(std::string_view a, std::string_view b, uint32_t maxDistance)
+{
+	const uint32_t outside = maxDistance + 1;
+	const size_t n = a.size(), m = b.size();
+
+	std::vector<uint32_t> prev(m + 1), cur(m + 1);
+	for (size_t j = 0; j <= m; ++j)
+		prev[j] = j <= maxDistance ? uint32_t(j) : outside;
+
+	for (size_t i = 1; i <= n; ++i)
+	{
+		const size_t lo = i > maxDistance ? i - maxDistance : 1;
+		const size_t hi = std::min(m, i + maxDistance);
+
+		cur[lo - 1] = lo == 1 && i <= maxDistance ? uint32_t(i) : outside;
+		uint32_t rowMin = cur[lo - 1];
+		for (size_t j = lo; j <= hi; ++j)
+		{
+			cur[j] = std::min({ prev[j] + 1, cur[j - 1] + 1, prev[j - 1] + (a[i - 1] != b[j - 1]), outside });
+			rowMin = std::min(rowMin, cur[j]);
+		}
+		if (hi < m)
+			cur[hi + 1] = outside; // The next row reads one cell past its band
+
+		if (rowMin > maxDistance)
+			return outside;
+		std::swap(prev, cur);
+	}
+	return prev[m];
+}
+
+uint32_t editDistance(std::string_view a, std::string_view b)
+{
+	if (a.size() < b.size())
+		std::swap(a, b);
+	if (b.empty())
+		return uint32_t(a.size());
+	if (b.size() <= 64)
+		return myersDistance(b, a, NO_LIMIT);
+	return rowDistance(a, b);
+}
+
+uint32_t editDistance(std::string_view a, std::string_view b, uint32_t maxDistance)
+{
+	if (maxDistance == NO_LIMIT)
+		return editDistance(a, b);
+
+	if (a.size() < b.size())
+		std::swap(a, b);
+	if (a.size() - b.size() > maxDistance)
+		return maxDistance + 1;
+	if (b.empty())
+		return uint32_t(a.size());
+	if (b.size() <= 64)
+		return myersDistance(b, a, maxDistance);
+	return bandedDistance(a, b, maxDistance);
+}
+
+}
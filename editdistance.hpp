@@ -0,0 +1,22 @@
+#pragma once
+#include <inttypes.h>
+#include <cstddef>
+#include <string_view>
+
+namespace utils
+{
+	/*
+	* Levenshtein distance (insertions, deletions and substitutions all cost 1).
+	* If the shorter string fits in a machine word, the Myers/Hyyro bit-parallel algorithm computes a whole DP column
+	* per letter of the longer one, O(max(a, b)) with no allocation. Longer strings fall back to a two row DP.
+	*/
+	uint32_t editDistance(std::string_view a, std::string_view b);
+
+	/*
+	* Bounded variant. Returns the distance if it is at most maxDistance and maxDistance + 1 otherwise.
+	* Gives up right away if the lengths differ by more than maxDistance. Myers stops once the remaining letters cannot bring
+	* the distance back under maxDistance, and the long string DP only computes the 2 * maxDistance + 1 diagonals around
+	* the main one and stops as soon as a whole row is above maxDistance.
+	*/
+	uint32_t editDistance(std::string_view a, std::string_view b, uint32_t maxDistance);
+}
@@ -0,0 +1,571 @@
+#include "fillservice.hpp"
+#include "logger.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+struct ServiceMetrics
+{
+	utils::Metrics& metrics = utils::Metrics::getInstance();
+	utils::Counter* requests[utils::SERVICE_NUM_REQUEST_TYPES] = {
+		&metrics.counter("service_requests_total", "Answered requests by type", "type=\"fill\""),
+		&metrics.counter("service_requests_total", "Answered requests by type", "type=\"validate\""),
+		&metrics.counter("service_requests_total", "Answered requests by type", "type=\"render\""),
+		&metrics.counter("service_requests_total", "Answered requests by type", "type=\"metrics\""),
+	};
+	utils::Counter& rejected = metrics.counter("service_rejected_total", "Requests answered with SERVICE_BUSY or SERVICE_SHUTTING_DOWN");
+	utils::Counter& badRequests = metrics.counter("service_bad_requests_total", "Requests which could not be parsed");
+	utils::Gauge& queued = metrics.gauge("service_queued_requests", "Requests waiting for a worker");
+	utils::Histogram& batchSize = metrics.histogram("service_batch_size", "Requests queued together from one read", utils::Histogram::exponentialBounds(1, 2, 12));
+	utils::Histogram& queueSeconds = metrics.histogram("service_queue_seconds", "Time from the arrival of a request until a worker took it", utils::Histogram::exponentialBounds(1e-6, 4, 14));
+	utils::Histogram& requestSeconds = metrics.histogram("service_request_seconds", "Time from the arrival of a request until its response was written", utils::Histogram::exponentialBounds(1e-5, 4, 14));
+};
+
+static ServiceMetrics& getMetrics()
+{
+	static ServiceMetrics metrics;
+	return metrics;
+}
+
+/* Pipe mode over a pair of binary streams, e.g. std::cin and std::cout */
+class FillService::StreamConnection : public FillService::Connection
+{
+public:
+	StreamConnection(std::istream& in, std::ostream& out) : _in(in), _out(out) {}
+
+	size_t receive(uint8_t* data, size_t capacity) override
+	{
+		// Blocks for one byte, then takes whatever else is already buffered, so the requests sent together are decoded together
+		_in.read(reinterpret_cast<char*>(data), 1);
+		if (_in.gcount() != 1)
+			return 0;
+		return 1 + size_t(std::max<std::streamsize>(0, _in.readsome(reinterpret_cast<char*>(data) + 1, std::streamsize(capacity - 1))));
+	}
+	bool send(const uint8_t* data, size_t size) override
+	{
+		_out.write(reinterpret_cast<const char*>(data), std::streamsize(size));
+		_out.flush();
+		return bool(_out);
+	}
+
+private:
+	std::istream& _in;
+	std::ostream& _out;
+};
+
+#ifndef _WIN32
+class FillService::SocketConnection : public FillService::Connection
+{
+public:
+	explicit SocketConnection(int socket) : _socket(socket) {}
+	~SocketConnection() override { ::close(_socket); }
+
+	size_t receive(uint8_t* data, size_t capacity) override
+	{
+		for (;;)
+		{
+			const ssize_t received = recv(_socket, data, capacity, 0);
+			if (received >= 0)
+				return size_t(received);
+			if (errno != EINTR)
+				return 0;
+		}
+	}
+	bool send(const uint8_t* data, size_t size) override
+	{
+		while (size)
+		{
+			const ssize_t sent = ::send(_socket, data, size, MSG_NOSIGNAL);
+			if (sent < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				return false;
+			}
+			data += sent;
+			size -= size_t(sent);
+		}
+		return true;
+	}
+	void close() override { shutdown(_socket, SHUT_RDWR); }
+
+private:
+	int _socket;
+};
+#endif
+
+void FillService::Connection::respond(const std::vector<uint8_t>& frame)
+{
+	std::lock_guard<std::mutex> lock(writeMutex);
+	if (broken)
+		return;
+	if (!send(frame.data(), frame.size()))
+	{
+		broken = true;
+		VLOG_WARN("[WARN]: FillService: Could not write a response. The connection is dropped." << std::endl);
+	}
+}
+
+void FillService::Connection::finishRequest()
+{
+	if (--pending == 0)
+	{
+		std::lock_guard<std::mutex> lock(_idleMutex);
+		_idle.notify_all();
+	}
+}
+
+void FillService::Connection::waitIdle()
+{
+	std::unique_lock<std::mutex> lock(_idleMutex);
+	_idle.wait(lock, [this] { return pending == 0; });
+}
+
+FillService::FillService(const utils::Dictionary& dictionary, Options options) :
+	_dictionary(dictionary),
+	_options(std::move(options))
+{
+	_options.fill.overlay = nullptr;
+	_renderer = CrosswordRenderer(_options.render);
+	CrosswordRenderer::Options puzzle = _options.render;
+	puzzle.drawLetters = false;
+	_puzzleRenderer = CrosswordRenderer(std::move(puzzle));
+
+	_pool = std::make_unique<utils::ThreadPool>(_options.numThreads);
+	if (_options.maxConcurrentFills == 0)
+		_options.maxConcurrentFills = std::max<size_t>(1, _pool->size() - 1);
+	getMetrics();
+}
+
+FillService::~FillService()
+{
+	stop();
+	std::vector<Reader> readers;
+	{
+		std::lock_guard<std::mutex> lock(_readersMutex);
+		readers.swap(_readers);
+	}
+	for (auto& reader : readers)
+		reader.thread.join();
+	_pool.reset(); // Waits for the running requests
+}
+
+size_t FillService::getNumQueued() const
+{
+	std::lock_guard<std::mutex> lock(_queueMutex);
+	return _quick.size() + _fills.size();
+}
+
+void FillService::serve(std::istream& in, std::ostream& out)
+{
+	VLOG_INFO("[INFO]: FillService::serve: Serving requests from the input stream on " << _pool->size() << " threads" << std::endl);
+	readLoop(std::make_shared<StreamConnection>(in, out));
+}
+
+bool FillService::listen(const std::string& path)
+{
+#ifdef _WIN32
+	VLOG_ERROR("[ERROR]: FillService::listen: Unix domain sockets are not supported on this platform. Use serve." << std::endl);
+	return false;
+#else
+	sockaddr_un address{};
+	address.sun_family = AF_UNIX;
+	if (path.empty() || path.size() >= sizeof(address.sun_path))
+	{
+		VLOG_ERROR("[ERROR]: FillService::listen: Invalid socket path " << path << std::endl);
+		return false;
+	}
+	std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+	const int listenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listenSocket < 0)
+	{
+		VLOG_ERROR("[ERROR]: FillService::listen: Could not create a socket: " << std::strerror(errno) << std::endl);
+		return false;
+	}
+	unlink(path.c_str()); // A socket file left by a previous run
+	if (bind(listenSocket, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 || ::listen(listenSocket, 64) != 0)
+	{
+		VLOG_ERROR("[ERROR]: FillService::listen: Could not listen on " << path << ": " << std::strerror(errno) << std::endl);
+		::close(listenSocket);
+		return false;
+	}
+	_listenSocket = listenSocket;
+	VLOG_INFO("[INFO]: FillService::listen: Listening on " << path << " with " << _pool->size() << " threads" << std::endl);
+
+	for (;;)
+	{
+		const int client = accept(listenSocket, nullptr, nullptr);
+		if (client < 0)
+		{
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			break; // stop shut the socket down
+		}
+
+		auto connection = std::make_shared<SocketConnection>(client);
+		std::lock_guard<std::mutex> lock(_readersMutex);
+		{
+			std::lock_guard<std::mutex> queueLock(_queueMutex);
+			if (_stopping)
+				break;
+		}
+		// Joins the readers of the connections which ended since the last accept
+		for (size_t i = 0; i < _readers.size();)
+		{
+			if (_readers[i].connection->finished)
+			{
+				_readers[i].thread.join();
+				if (i + 1 != _readers.size())
+					_readers[i] = std::move(_readers.back());
+				_readers.pop_back();
+			}
+			else
+			{
+				++i;
+			}
+		}
+		_readers.push_back({ connection, std::thread([this, connection]() { readLoop(connection); }) });
+	}
+
+	_listenSocket = -1;
+	::close(listenSocket);
+	unlink(path.c_str());
+
+	std::vector<Reader> readers;
+	{
+		std::lock_guard<std::mutex> lock(_readersMutex);
+		readers.swap(_readers);
+	}
+	for (auto& reader : readers)
+	{
+		reader.connection->close();
+		reader.thread.join();
+	}
+	VLOG_INFO("[INFO]: FillService::listen: Stopped listening on " << path << std::endl);
+	return true;
+#endif
+}
+
+void FillService::stop()
+{
+	std::deque<Request> dropped;
+	{
+		std::lock_guard<std::mutex> lock(_queueMutex);
+		_stopping = true;
+		dropped.swap(_quick);
+		for (auto& request : _fills)
+			dropped.push_back(std::move(request));
+		_fills.clear();
+		VMETRIC_SET(getMetrics().queued, 0.0);
+	}
+	for (auto& request : dropped)
+	{
+		respondError(request, utils::SERVICE_SHUTTING_DOWN, "The service is shutting down");
+		request.connection->finishRequest();
+	}
+
+#ifndef _WIN32
+	const int listenSocket = _listenSocket;
+	if (listenSocket >= 0)
+		shutdown(listenSocket, SHUT_RDWR); // Makes accept return
+#endif
+	std::lock_guard<std::mutex> lock(_readersMutex);
+	for (auto& reader : _readers)
+		reader.connection->close();
+}
+
+void FillService::readLoop(const std::shared_ptr<Connection>& connection)
+{
+	const size_t MIN_READ = 1 << 16;
+	std::vector<uint8_t> buffer(MIN_READ);
+	size_t begin = 0, end = 0; // Received bytes which are not decoded yet
+	std::vector<Request> batch;
+
+	for (bool open = true; open;)
+	{
+		// What is left is at most one partial frame. It moves to the front, so the buffer stays under two frames plus one read.
+		if (begin)
+		{
+			std::memmove(buffer.data(), buffer.data() + begin, end - begin);
+			end -= begin;
+			begin = 0;
+		}
+		if (buffer.size() - end < MIN_READ)
+			buffer.resize(end + MIN_READ);
+
+		const size_t received = connection->receive(buffer.data() + end, buffer.size() - end);
+		if (received == 0)
+			break;
+		end += received;
+
+		while (end - begin >= sizeof(ServiceFrameHeader))
+		{
+			ServiceFrameHeader header;
+			std::memcpy(&header, buffer.data() + begin, sizeof(header));
+			if (header.magic != utils::SERVICE_MAGIC || header.version != utils::SERVICE_VERSION || header.size > _options.maxFrameBytes)
+			{
+				// The stream cannot be resynchronized after a bad header
+				VLOG_WARN("[WARN]: FillService: Invalid frame header (request " << header.id << ", " << header.size << " bytes). Closing the connection." << std::endl);
+				std::vector<uint8_t> response;
+				appendError(response, header, utils::SERVICE_BAD_REQUEST, "Invalid frame header");
+				connection->respond(response);
+				open = false;
+				break;
+			}
+			if (end - begin < sizeof(header) + header.size)
+				break;
+
+			Request request;
+			request.connection = connection;
+			request.header = header;
+			const uint8_t* payload = buffer.data() + begin + sizeof(header);
+			request.payload.assign(payload, payload + header.size);
+			batch.push_back(std::move(request));
+			begin += sizeof(header) + header.size;
+		}
+
+		if (!batch.empty())
+			enqueue(batch);
+	}
+
+	connection->waitIdle();
+	connection->finished = true;
+}
+
+void FillService::enqueue(std::vector<Request>& batch)
+{
+	VMETRIC_OBSERVE(getMetrics().batchSize, double(batch.size()));
+
+	std::vector<Request> rejected;
+	bool stopping;
+	{
+		std::lock_guard<std::mutex> lock(_queueMutex);
+		stopping = _stopping;
+		for (auto& request : batch)
+		{
+			if (_stopping || _quick.size() + _fills.size() >= _options.maxQueued)
+			{
+				rejected.push_back(std::move(request));
+				continue;
+			}
+			++request.connection->pending;
+			(request.header.type == utils::SERVICE_FILL ? _fills : _quick).push_back(std::move(request));
+		}
+		VMETRIC_SET(getMetrics().queued, double(_quick.size() + _fills.size()));
+		schedule();
+	}
+	batch.clear();
+
+	for (const auto& request : rejected)
+	{
+		VMETRIC_INC(getMetrics().rejected);
+		if (stopping)
+			respondError(request, utils::SERVICE_SHUTTING_DOWN, "The service is shutting down");
+		else
+			respondError(request, utils::SERVICE_BUSY, "The request queue is full");
+	}
+}
+
+void FillService::schedule()
+{
+	const size_t runnableFills = _runningFills < _options.maxConcurrentFills ? std::min(_fills.size(), _options.maxConcurrentFills - _runningFills) : 0;
+	size_t runnable = _quick.size() + runnableFills;
+	while (runnable && _activeWorkers < _pool->size())
+	{
+		++_activeWorkers;
+		--runnable;
+		_pool->submit([this]() { runWorker(); });
+	}
+}
+
+bool FillService::popRunnable(Request& request)
+{
+	if (!_quick.empty())
+	{
+		request = std::move(_quick.front());
+		_quick.pop_front();
+	}
+	else if (!_fills.empty() && _runningFills < _options.maxConcurrentFills)
+	{
+		request = std::move(_fills.front());
+		_fills.pop_front();
+		++_runningFills;
+	}
+	else
+	{
+		return false;
+	}
+	VMETRIC_SET(getMetrics().queued, double(_quick.size() + _fills.size()));
+	return true;
+}
+
+void FillService::runWorker()
+{
+	// Runs requests until none can be started. A worker which finishes a fill goes on with the next queued fill.
+	for (;;)
+	{
+		Request request;
+		{
+			std::lock_guard<std::mutex> lock(_queueMutex);
+			if (!popRunnable(request))
+			{
+				--_activeWorkers;
+				return;
+			}
+		}
+
+		const bool isFill = request.header.type == utils::SERVICE_FILL;
+		process(request);
+		if (isFill)
+		{
+			std::lock_guard<std::mutex> lock(_queueMutex);
+			--_runningFills;
+		}
+	}
+}
+
+void FillService::process(Request& request)
+{
+	const double queueSeconds = request.queued.lap();
+	VMETRIC_OBSERVE(getMetrics().queueSeconds, queueSeconds);
+
+	std::vector<uint8_t> response;
+	switch (request.header.type)
+	{
+	case utils::SERVICE_FILL:
+		processFill(request, queueSeconds, response);
+		break;
+	case utils::SERVICE_VALIDATE:
+		processValidate(request, response);
+		break;
+	case utils::SERVICE_RENDER:
+		processRender(request, response);
+		break;
+	case utils::SERVICE_METRICS:
+		processMetrics(request, response);
+		break;
+	default:
+		appendError(response, request.header, utils::SERVICE_BAD_REQUEST, "Unknown request type");
+		break;
+	}
+
+	request.connection->respond(response);
+	request.connection->finishRequest();
+
+	if (request.header.type < utils::SERVICE_NUM_REQUEST_TYPES)
+		VMETRIC_INC(*getMetrics().requests[request.header.type]);
+	VMETRIC_OBSERVE(getMetrics().requestSeconds, queueSeconds + request.queued.lap());
+}
+
+void FillService::processFill(const Request& request, double queueSeconds, std::vector<uint8_t>& response) const
+{
+	utils::ServiceFillRequest fillRequest;
+	Crossword crossword;
+	if (request.payload.size() < sizeof(fillRequest))
+		return appendError(response, request.header, utils::SERVICE_BAD_REQUEST, "Truncated fill request");
+	std::memcpy(&fillRequest, request.payload.data(), sizeof(fillRequest));
+	if (!parseCrossword(request.payload.data() + sizeof(fillRequest), request.payload.size() - sizeof(fillRequest), fillRequest.crossword, crossword))
+		return appendError(response, request.header, utils::SERVICE_BAD_REQUEST, "Invalid crossword");
+
+	CrosswordFiller::Options options = _options.fill;
+	options.seed = fillRequest.seed;
+	if (fillRequest.maxNodes)
+		options.maxNodes = fillRequest.maxNodes;
+	options.allowRepeats = fillRequest.allowRepeats != 0;
+	options.deterministic = fillRequest.deterministic != 0;
+
+	utils::Stopwatch stopwatch;
+	CrosswordFiller filler(_dictionary);
+	const CrosswordFiller::Result result = filler.fill(crossword, options);
+
+	const utils::ServiceFillResult fillResult{ result.nodes, result.backtracks, result.backjumps, result.nogoodHits, queueSeconds, stopwatch.lap() };
+	std::vector<uint8_t> image;
+	if (result.solved)
+		crossword.serialize(image);
+	utils::appendServiceFrame(response, utils::SERVICE_FILL, result.solved ? utils::SERVICE_OK : utils::SERVICE_NOT_SOLVED, request.header.id,
+		&fillResult, sizeof(fillResult), image.data(), image.size());
+}
+
+void FillService::processValidate(const Request& request, std::vector<uint8_t>& response) const
+{
+	utils::ServiceCrosswordRequest crosswordRequest;
+	Crossword crossword;
+	if (request.payload.size() < sizeof(crosswordRequest))
+		return appendError(response, request.header, utils::SERVICE_BAD_REQUEST, "Truncated validate request");
+	std::memcpy(&crosswordRequest, request.payload.data(), sizeof(crosswordRequest));
+	if (!parseCrossword(request.payload.data() + sizeof(crosswordRequest), request.payload.size() - sizeof(crosswordRequest), crosswordRequest, crossword))
+		return appendError(response, request.header, utils::SERVICE_BAD_REQUEST, "Invalid crossword");
+
+	const Crossword::CrosswordReport report = crossword.generateReport();
+	std::vector<uint32_t> repeats;
+	repeats.reserve(report.repeatingWords.size());
+	for (const CrosswordWord* word : report.repeatingWords)
+		repeats.push_back(uint32_t(word - crossword.getWords().data()));
+
+	utils::ServiceValidateResult result{};
+	result.valid = Crossword::isValid(crossword);
+	result.numWords = report.numWords;
+	result.numBoxes = report.numBoxes;
+	result.rows = report.rows;
+	result.cols = report.cols;
+	result.numRepeats = uint32_t(repeats.size());
+	result.averageWordLength = report.averageWordLength;
+	result.boxedAreaCoef = report.boxedAreaCoef;
+	utils::appendServiceFrame(response, utils::SERVICE_VALIDATE, utils::SERVICE_OK, request.header.id,
+		&result, sizeof(result), repeats.data(), repeats.size() * sizeof(uint32_t));
+}
+
+void FillService::processRender(const Request& request, std::vector<uint8_t>& response) const
+{
+	utils::ServiceRenderRequest renderRequest;
+	Crossword crossword;
+	if (request.payload.size() < sizeof(renderRequest))
+		return appendError(response, request.header, utils::SERVICE_BAD_REQUEST, "Truncated render request");
+	std::memcpy(&renderRequest, request.payload.data(), sizeof(renderRequest));
+	if (!parseCrossword(request.payload.data() + sizeof(renderRequest), request.payload.size() - sizeof(renderRequest), renderRequest.crossword, crossword))
+		return appendError(response, request.header, utils::SERVICE_BAD_REQUEST, "Invalid crossword");
+
+	thread_local SVG::SVGWriter out; // Keeps its buffer between the requests a worker renders
+	out.clear();
+	(renderRequest.drawLetters ? _renderer : _puzzleRenderer).render(crossword, _dictionary, out);
+	const std::string_view svg = out.view();
+	utils::appendServiceFrame(response, utils::SERVICE_RENDER, utils::SERVICE_OK, request.header.id, svg.data(), svg.size());
+}
+
+void FillService::processMetrics(const Request& request, std::vector<uint8_t>& response)
+{
+	std::ostringstream out;
+	utils::Metrics::getInstance().writePrometheus(out);
+	const std::string text = out.str();
+	utils::appendServiceFrame(response, utils::SERVICE_METRICS, utils::SERVICE_OK, request.header.id, text.data(), text.size());
+}
+
+bool FillService::parseCrossword(const uint8_t* data, size_t size, const utils::ServiceCrosswordRequest& header, Crossword& crossword)
+{
+	if (header.nameSize > size)
+		return false;
+	return crossword.parse(data + header.nameSize, size - header.nameSize, std::string(reinterpret_cast<const char*>(data), header.nameSize));
+}
+
+void FillService::appendError(std::vector<uint8_t>& response, const ServiceFrameHeader& request, utils::ServiceStatus status, const std::string& message)
+{
+	if (status == utils::SERVICE_BAD_REQUEST)
+		VMETRIC_INC(getMetrics().badRequests);
+	utils::appendServiceFrame(response, request.type, uint8_t(status), request.id, message.data(), message.size());
+}
+
+void FillService::respondError(const Request& request, utils::ServiceStatus status, const std::string& message)
+{
+	std::vector<uint8_t> response;
+	appendError(response, request.header, status, message);
+	request.connection->respond(response);
+}
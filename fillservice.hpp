@@ -0,0 +1,141 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "crosswordfiller.hpp"
+#include "crosswordrender.hpp"
+#include "dictionary.hpp"
+#include "metrics.hpp"
+#include "serviceprotocol.hpp"
+#include "threadpool.hpp"
+
+/*
+* Long-running service which answers fill, validate, render and metrics requests (see serviceprotocol.hpp) with one
+* dictionary loaded up front. Every request shares its pattern cache, so later requests find it warm and pay only for the search.
+*
+* The reader of a connection decodes every complete frame it received with one read and queues them as one batch.
+* Workers of a ThreadPool take quick requests (everything but fills) first and never run more than maxConcurrentFills
+* fills at once, so a long fill cannot hold up validation and rendering. Requests of one kind run in arrival order.
+* Responses are written as soon as their request is done, tagged with its id.
+*/
+class FillService
+{
+public:
+
+	struct Options
+	{
+		size_t numThreads = std::thread::hardware_concurrency(); // Workers. 0 means one.
+		size_t maxConcurrentFills = 0; // 0 means every worker but one (at least one)
+		size_t maxQueued = 4096; // Requests waiting for a worker. More are answered with SERVICE_BUSY.
+		size_t maxFrameBytes = 1 << 20; // Larger frames close the connection
+		CrosswordFiller::Options fill; // Defaults of the fill requests. overlay is ignored.
+		CrosswordRenderer::Options render;
+	};
+
+public:
+
+	explicit FillService(const utils::Dictionary& dictionary) : FillService(dictionary, Options()) {}
+	FillService(const utils::Dictionary& dictionary, Options options); // The dictionary has to outlive the service
+	~FillService(); // Stops the service and waits for the running requests. listen has to have returned.
+
+	FillService(const FillService&) = delete;
+	FillService& operator=(const FillService&) = delete;
+
+	// Pipe mode: answers the requests read from `in` on `out` until `in` ends, then waits for the last responses. Both streams have to be binary.
+	void serve(std::istream& in, std::ostream& out);
+	// Accepts connections on a Unix domain socket at `path` until stop() and serves each on its own reader thread. Not supported on Windows.
+	bool listen(const std::string& path);
+	void stop(); // Makes listen return and ends the connections. Queued requests are answered with SERVICE_SHUTTING_DOWN.
+
+	size_t getNumQueued() const;
+
+private:
+
+	using ServiceFrameHeader = utils::ServiceFrameHeader;
+
+	/* One peer. Readers and workers share it: the workers write responses under writeMutex. */
+	class Connection
+	{
+	public:
+		virtual ~Connection() = default;
+		virtual size_t receive(uint8_t* data, size_t capacity) = 0; // Blocks until some bytes arrived. 0 at the end.
+		virtual bool send(const uint8_t* data, size_t size) = 0; // Has to hold writeMutex
+		virtual void close() {} // Unblocks receive
+
+		void respond(const std::vector<uint8_t>& frame);
+		void finishRequest(); // Wakes waitIdle when the last pending request is done
+		void waitIdle();
+
+	public:
+		std::mutex writeMutex;
+		bool broken = false; // A send failed. Later responses are dropped.
+		std::atomic<size_t> pending{ 0 }; // Queued or running requests
+		std::atomic<bool> finished{ false }; // Its reader returned
+
+	private:
+		std::mutex _idleMutex;
+		std::condition_variable _idle;
+	};
+
+	class StreamConnection;
+	class SocketConnection;
+
+	struct Reader
+	{
+		std::shared_ptr<Connection> connection;
+		std::thread thread;
+	};
+
+	struct Request
+	{
+		std::shared_ptr<Connection> connection;
+		ServiceFrameHeader header;
+		std::vector<uint8_t> payload;
+		utils::Stopwatch queued; // Started on arrival
+	};
+
+	void readLoop(const std::shared_ptr<Connection>& connection);
+	void enqueue(std::vector<Request>& batch);
+	void schedule(); // Has to hold _queueMutex. Starts runners while there are free workers and runnable requests.
+	bool popRunnable(Request& request); // Has to hold _queueMutex
+	void runWorker();
+	void process(Request& request);
+
+	// Each appends the response frame of the request to `response`
+	void processFill(const Request& request, double queueSeconds, std::vector<uint8_t>& response) const;
+	void processValidate(const Request& request, std::vector<uint8_t>& response) const;
+	void processRender(const Request& request, std::vector<uint8_t>& response) const;
+	static void processMetrics(const Request& request, std::vector<uint8_t>& response);
+
+	static bool parseCrossword(const uint8_t* data, size_t size, const utils::ServiceCrosswordRequest& header, Crossword& crossword); // `data` starts after `header`
+	static void appendError(std::vector<uint8_t>& response, const ServiceFrameHeader& request, utils::ServiceStatus status, const std::string& message);
+	static void respondError(const Request& request, utils::ServiceStatus status, const std::string& message); // For requests which were not queued
+
+private:
+
+	const utils::Dictionary& _dictionary;
+	Options _options;
+	CrosswordRenderer _renderer;
+	CrosswordRenderer _puzzleRenderer; // Without the letters
+
+	mutable std::mutex _queueMutex;
+	std::deque<Request> _quick; // Validate, render and metrics requests
+	std::deque<Request> _fills;
+	size_t _runningFills = 0;
+	size_t _activeWorkers = 0; // Runners submitted to _pool and not finished
+	bool _stopping = false;
+
+	std::mutex _readersMutex;
+	std::vector<Reader> _readers; // Of the connections accepted by listen, so stop can close them
+	std::atomic<int> _listenSocket{ -1 };
+
+	std::unique_ptr<utils::ThreadPool> _pool; // Last member: destroyed first, so the runners finish before the queues go away
+};
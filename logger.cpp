@@ -0,0 +1,244 @@
+#include "logger.hpp"
+
+namespace utils
+{
+
+/* Calls out(color, segment) for every run of `text` between LogColor markers. The first run uses `color`. */
+template <typename Out>
+static void forEachSegment(uint8_t color, std::string_view text, Out&& out)
+{
+	size_t start = 0;
+	for (size_t i = 0; i + 1 < text.size(); ++i)
+	{
+		if (text[i] != COLOR_MARKER)
+			continue;
+
+		if (i > start)
+			out(color, text.substr(start, i - start));
+		color = uint8_t(text[i + 1]);
+		start = ++i + 1;
+	}
+	if (start < text.size())
+		out(color, text.substr(start));
+}
+
+/* Console attributes keep blue in bit 0 and red in bit 2, ANSI numbers colors the other way around */
+static void writeAnsiColor(std::ostream& out, uint8_t color)
+{
+	if (color == 7)
+	{
+		out << "\x1B[0m"; // The terminal's own colors
+		return;
+	}
+
+	const int ansi[8] = { 0, 4, 2, 6, 1, 5, 3, 7 };
+	const int foreground = color & 0x0F, background = color >> 4;
+	out << "\x1B[0;" << (foreground & 8 ? 90 : 30) + ansi[foreground & 7] << ';' << (background & 8 ? 100 : 40) + ansi[background & 7] << 'm';
+}
+
+void AnsiConsoleSink::write(LogLevel, uint8_t color, std::string_view text)
+{
+	forEachSegment(color, text, [this](uint8_t segmentColor, std::string_view segment)
+	{
+		if (_currentColor != segmentColor)
+		{
+			_currentColor = segmentColor;
+			writeAnsiColor(std::cout, segmentColor);
+		}
+		std::cout.write(segment.data(), std::streamsize(segment.size()));
+	});
+}
+
+void AnsiConsoleSink::flush()
+{
+	std::cout.flush();
+}
+
+#if defined(_WIN32)
+ConsoleSink::ConsoleSink()
+{
+	ColorChanger::getInstance(); // Created before the Logger is done, so it is destroyed after the last message
+}
+
+void ConsoleSink::write(LogLevel, uint8_t color, std::string_view text)
+{
+	forEachSegment(color, text, [this](uint8_t segmentColor, std::string_view segment)
+	{
+		if (_currentColor != segmentColor)
+		{
+			std::cout.flush(); // The attribute only applies to what is written after it
+			_currentColor = segmentColor;
+			ColorChanger::getInstance().changeColor(segmentColor);
+		}
+		std::cout.write(segment.data(), std::streamsize(segment.size()));
+	});
+}
+
+void ConsoleSink::flush()
+{
+	std::cout.flush();
+}
+#else
+ConsoleSink::ConsoleSink()
+{
+}
+
+void ConsoleSink::write(LogLevel level, uint8_t color, std::string_view text)
+{
+	_ansi.write(level, color, text);
+}
+
+void ConsoleSink::flush()
+{
+	_ansi.flush();
+}
+#endif
+
+FileSink::FileSink(const std::string& path, bool append) :
+	_out(path, append ? std::ios::app : std::ios::trunc)
+{
+}
+
+void FileSink::write(LogLevel, uint8_t color, std::string_view text)
+{
+	forEachSegment(color, text, [this](uint8_t, std::string_view segment) { _out.write(segment.data(), std::streamsize(segment.size())); });
+}
+
+void FileSink::flush()
+{
+	_out.flush();
+}
+
+Logger::Logger() :
+	_slots(new Slot[RING_SIZE])
+{
+	for (size_t i = 0; i < RING_SIZE; ++i)
+		_slots[i].sequence.store(i, std::memory_order_relaxed);
+
+	_sinks.push_back(std::make_unique<ConsoleSink>());
+	_thread = std::thread([this]() { run(); });
+}
+
+Logger::~Logger()
+{
+	{
+		std::lock_guard<std::mutex> lock(_wakeMutex);
+		_stop = true;
+	}
+	_wake.notify_one();
+	_thread.join();
+}
+
+void Logger::addSink(std::unique_ptr<LogSink> sink)
+{
+	std::lock_guard<std::mutex> lock(_sinkMutex);
+	_sinks.push_back(std::move(sink));
+}
+
+void Logger::clearSinks()
+{
+	flush();
+	std::lock_guard<std::mutex> lock(_sinkMutex);
+	_sinks.clear();
+}
+
+/* Claims the next position with a CAS and publishes the record through the slot's sequence */
+void Logger::push(LogLevel level, uint8_t color, std::string text)
+{
+	size_t position = _enqueuePosition.load(std::memory_order_relaxed);
+	Slot* slot;
+	while (true)
+	{
+		slot = &_slots[position & (RING_SIZE - 1)];
+		const size_t sequence = slot->sequence.load(std::memory_order_acquire);
+		const intptr_t difference = intptr_t(sequence) - intptr_t(position);
+		if (difference == 0)
+		{
+			if (_enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+				break;
+		}
+		else if (difference < 0)
+		{
+			std::this_thread::yield(); // Full: wait for the logger thread
+			position = _enqueuePosition.load(std::memory_order_relaxed);
+		}
+		else
+		{
+			position = _enqueuePosition.load(std::memory_order_relaxed);
+		}
+	}
+
+	slot->record.level = level;
+	slot->record.color = color;
+	slot->record.text = std::move(text);
+	slot->sequence.store(position + 1, std::memory_order_seq_cst);
+
+	if (_sleeping.load(std::memory_order_seq_cst))
+	{
+		std::lock_guard<std::mutex> lock(_wakeMutex);
+		_wake.notify_one();
+	}
+}
+
+bool Logger::pop(Record& record)
+{
+	Slot& slot = _slots[_dequeuePosition & (RING_SIZE - 1)];
+	if (slot.sequence.load(std::memory_order_acquire) != _dequeuePosition + 1)
+		return false;
+
+	record = std::move(slot.record);
+	slot.sequence.store(_dequeuePosition + RING_SIZE, std::memory_order_release);
+	++_dequeuePosition;
+	return true;
+}
+
+void Logger::flush()
+{
+	const uint64_t target = _enqueuePosition.load(std::memory_order_seq_cst);
+
+	std::unique_lock<std::mutex> lock(_wakeMutex);
+	_wake.notify_one();
+	_drained.wait(lock, [this, target]() { return _written.load() >= target; });
+}
+
+/* Writes everything there is, flushes the sinks once per batch and sleeps until the next push */
+void Logger::run()
+{
+	Record record;
+	while (true)
+	{
+		uint64_t written = 0;
+		{
+			std::lock_guard<std::mutex> lock(_sinkMutex);
+			while (pop(record))
+			{
+				for (auto& sink : _sinks)
+					sink->write(record.level, record.color, record.text);
+				++written;
+			}
+			if (written)
+			{
+				for (auto& sink : _sinks)
+					sink->flush();
+			}
+		}
+
+		std::unique_lock<std::mutex> lock(_wakeMutex);
+		if (written)
+		{
+			_written.fetch_add(written);
+			_drained.notify_all();
+			continue;
+		}
+		if (_stop)
+			return;
+
+		// A push which does not see _sleeping published its record before the sequence is checked again below
+		_sleeping.store(true, std::memory_order_seq_cst);
+		if (_slots[_dequeuePosition & (RING_SIZE - 1)].sequence.load(std::memory_order_seq_cst) != _dequeuePosition + 1)
+			_wake.wait_for(lock, std::chrono::milliseconds(100));
+		_sleeping.store(false, std::memory_order_relaxed);
+	}
+}
+
+}
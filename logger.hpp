@@ -1,8 +1,21 @@
 #pragma once
+#include <inttypes.h>
 #include <sstream>
 #include <iostream>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 
+#ifdef _WIN32
+#ifndef NOMINMAX
 #define NOMINMAX
+#endif
 #include <Windows.h>
 
 class ColorChanger
@@ -40,11 +53,184 @@ private:
 	uint16_t _currentColor;
 
 };
+#endif
 
-#define VLOG_CUSTOM(color, message) ColorChanger::getInstance().changeColor(color);  std::cout << message;
-#define VLOG_TRACE(message) ColorChanger::getInstance().changeColor(7);  std::cout << message;
-#define VLOG_DEBUG(message) ColorChanger::getInstance().changeColor(9);  std::cout << message;
-#define VLOG_INFO(message)  ColorChanger::getInstance().changeColor(10); std::cout << message;
-#define VLOG_WARN(message)  ColorChanger::getInstance().changeColor(14); std::cout << message;
-#define VLOG_ERROR(message) ColorChanger::getInstance().changeColor(12); std::cout << message;
-#define VLOG_FATAL(message) ColorChanger::getInstance().changeColor(4); std::cout << message;
+namespace utils
+{
+	enum LogLevel : uint8_t
+	{
+		LOG_LEVEL_TRACE,
+		LOG_LEVEL_DEBUG,
+		LOG_LEVEL_INFO,
+		LOG_LEVEL_WARN,
+		LOG_LEVEL_ERROR,
+		LOG_LEVEL_FATAL,
+		LOG_LEVEL_OFF
+	};
+
+	/*
+	* Streamed into a message to switch colors in the middle of it (console attribute: foreground in the low 4 bits, background in the high 4).
+	* It is written as COLOR_MARKER followed by the color, so a line with many colors stays one message.
+	*/
+	struct LogColor
+	{
+		uint8_t color;
+	};
+	const char COLOR_MARKER = '\x01';
+	inline std::ostream& operator<<(std::ostream& out, LogColor color) { return out << COLOR_MARKER << char(color.color); }
+
+	/* Destination of the logged messages. Only called from the logger thread. */
+	class LogSink
+	{
+	public:
+		virtual ~LogSink() = default;
+		virtual void write(LogLevel level, uint8_t color, std::string_view text) = 0; // `text` may hold LogColor markers
+		virtual void flush() {}
+	};
+
+	/* Colored console through ANSI escape codes */
+	class AnsiConsoleSink : public LogSink
+	{
+	public:
+		void write(LogLevel level, uint8_t color, std::string_view text) override;
+		void flush() override;
+
+	private:
+		int _currentColor = -1;
+	};
+
+	/* Colored console through SetConsoleTextAttribute. On other platforms it is the same as AnsiConsoleSink. */
+	class ConsoleSink : public LogSink
+	{
+	public:
+		ConsoleSink();
+		void write(LogLevel level, uint8_t color, std::string_view text) override;
+		void flush() override;
+
+	private:
+#if defined(_WIN32)
+		int _currentColor = -1;
+#else
+		AnsiConsoleSink _ansi;
+#endif
+	};
+
+	/* Plain text file. Colors are dropped. */
+	class FileSink : public LogSink
+	{
+	public:
+		explicit FileSink(const std::string& path, bool append = true);
+		bool isOpen() const { return _out.is_open(); }
+		void write(LogLevel level, uint8_t color, std::string_view text) override;
+		void flush() override;
+
+	private:
+		std::ofstream _out;
+	};
+
+	/*
+	* Asynchronous logger behind the VLOG_* macros.
+	* The level is checked before the message is formatted, and levels under VLOG_MIN_LEVEL are compiled out.
+	* Formatted messages go in a bounded lock-free ring (Vyukov's MPMC queue, used with one consumer) which a
+	* background thread drains into the sinks, so logging costs the caller one formatting and one enqueue.
+	* A full ring makes the producer wait, messages are never dropped. Messages of one thread keep their order.
+	*/
+	class Logger
+	{
+	public:
+
+		constexpr static size_t RING_SIZE = 4096; // Power of two
+
+		static Logger& getInstance()
+		{
+			static Logger logger;
+			return logger;
+		}
+
+		/* Reused per thread by the macros, so formatting does not allocate a stream per message */
+		static std::ostringstream& getStream()
+		{
+			thread_local std::ostringstream stream;
+			stream.str(std::string());
+			stream.clear();
+			return stream;
+		}
+
+		bool isEnabled(LogLevel level) const { return level >= _level.load(std::memory_order_relaxed); }
+		void setLevel(LogLevel level) { _level.store(level, std::memory_order_relaxed); }
+		LogLevel getLevel() const { return _level.load(std::memory_order_relaxed); }
+
+		void push(LogLevel level, uint8_t color, std::string text);
+		void flush(); // Returns once every message pushed before the call was written and the sinks were flushed
+
+		void addSink(std::unique_ptr<LogSink> sink);
+		void clearSinks();
+
+		Logger(const Logger&) = delete;
+		Logger& operator=(const Logger&) = delete;
+
+	private:
+
+		struct Record
+		{
+			LogLevel level = LOG_LEVEL_TRACE;
+			uint8_t color = 7;
+			std::string text;
+		};
+
+		struct Slot
+		{
+			std::atomic<size_t> sequence; // Equal to the position once free for it, position + 1 once it holds its record
+			Record record;
+		};
+
+		Logger();
+		~Logger(); // Drains the ring
+
+		bool pop(Record& record); // Only called by the logger thread
+		void run();
+
+	private:
+
+		std::unique_ptr<Slot[]> _slots;
+		alignas(64) std::atomic<size_t> _enqueuePosition{ 0 };
+		alignas(64) size_t _dequeuePosition = 0;
+		std::atomic<uint64_t> _written{ 0 }; // Records handed to the sinks
+
+		std::atomic<LogLevel> _level{ LOG_LEVEL_TRACE };
+
+		std::mutex _sinkMutex; // Guards _sinks
+		std::vector<std::unique_ptr<LogSink>> _sinks;
+
+		std::mutex _wakeMutex;
+		std::condition_variable _wake; // Wakes the logger thread
+		std::condition_variable _drained; // Wakes flush
+		std::atomic<bool> _sleeping{ false }; // Set while the logger thread waits for a push
+		bool _stop = false;
+		std::thread _thread;
+	};
+}
+
+#ifndef VLOG_MIN_LEVEL
+#define VLOG_MIN_LEVEL 0 // Messages under this LogLevel are compiled out
+#endif
+
+#define VLOG_AT(level, color, message) \
+	do \
+	{ \
+		if ((level) >= VLOG_MIN_LEVEL && utils::Logger::getInstance().isEnabled(level)) \
+		{ \
+			std::ostringstream& vlogStream = utils::Logger::getStream(); \
+			vlogStream << message; \
+			utils::Logger::getInstance().push(level, color, vlogStream.str()); \
+		} \
+	} while (0)
+
+#define VLOG_CUSTOM(color, message) VLOG_AT(utils::LOG_LEVEL_INFO, color, message)
+#define VLOG_TRACE(message) VLOG_AT(utils::LOG_LEVEL_TRACE, 7, message)
+#define VLOG_DEBUG(message) VLOG_AT(utils::LOG_LEVEL_DEBUG, 9, message)
+#define VLOG_INFO(message)  VLOG_AT(utils::LOG_LEVEL_INFO, 10, message)
+#define VLOG_WARN(message)  VLOG_AT(utils::LOG_LEVEL_WARN, 14, message)
+#define VLOG_ERROR(message) VLOG_AT(utils::LOG_LEVEL_ERROR, 12, message)
+#define VLOG_FATAL(message) VLOG_AT(utils::LOG_LEVEL_FATAL, 4, message)
+#define VLOG_FLUSH() utils::Logger::getInstance().flush() // Before reading from the console
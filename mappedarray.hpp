@@ -0,0 +1,103 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+#include <cassert>
+
+namespace utils
+{
+	/*
+	* Read-only array which either owns its elements or views memory owned by someone else (e.g., a memory mapped snapshot).
+	* Growing it is only possible while it owns its elements.
+	*/
+	template <typename T>
+	class MappedArray
+	{
+	public:
+
+		MappedArray() = default;
+		explicit MappedArray(std::vector<T> owned) { assign(std::move(owned)); }
+
+		MappedArray(const MappedArray& other) { *this = other; }
+		MappedArray(MappedArray&& other) noexcept { *this = std::move(other); }
+
+		MappedArray& operator=(const MappedArray& other)
+		{
+			if (this == &other)
+				return *this;
+
+			_owned = other._owned;
+			_isView = other._isView;
+			_data = _isView ? other._data : _owned.data();
+			_size = other._size;
+			return *this;
+		}
+		MappedArray& operator=(MappedArray&& other) noexcept
+		{
+			_owned = std::move(other._owned);
+			_isView = other._isView;
+			_data = _isView ? other._data : _owned.data();
+			_size = other._size;
+			other.clear();
+			return *this;
+		}
+
+		void assign(std::vector<T> owned)
+		{
+			_owned = std::move(owned);
+			_isView = false;
+			refresh();
+		}
+		void view(const T* data, size_t size)
+		{
+			_owned = std::vector<T>();
+			_isView = true;
+			_data = data;
+			_size = size;
+		}
+		void clear() { assign(std::vector<T>()); }
+
+		void push_back(const T& value)
+		{
+			assert(!_isView && "[LOGICAL ERROR]: Cannot grow a MappedArray which views external memory!");
+			_owned.push_back(value);
+			refresh();
+		}
+		void append(const T* values, size_t count)
+		{
+			assert(!_isView && "[LOGICAL ERROR]: Cannot grow a MappedArray which views external memory!");
+			_owned.insert(_owned.end(), values, values + count);
+			refresh();
+		}
+		void shrink_to_fit()
+		{
+			_owned.shrink_to_fit();
+			if (!_isView)
+				refresh();
+		}
+
+		const T* data() const { return _data; }
+		size_t size() const { return _size; }
+		bool empty() const { return _size == 0; }
+		bool isView() const { return _isView; }
+		size_t memoryUsage() const { return _owned.capacity() * sizeof(T); } // Bytes owned by this array (views cost nothing)
+
+		const T& operator[](size_t i) const { return _data[i]; }
+		const T* begin() const { return _data; }
+		const T* end() const { return _data + _size; }
+
+	private:
+
+		void refresh()
+		{
+			_data = _owned.data();
+			_size = _owned.size();
+		}
+
+	private:
+
+		std::vector<T> _owned;
+		const T* _data = nullptr;
+		size_t _size = 0;
+		bool _isView = false;
+	};
+}
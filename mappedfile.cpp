@@ -0,0 +1,130 @@
+#include "mappedfile.hpp"
+
+#include <utility>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace utils
+{
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+	if (this == &other)
+		return *this;
+
+	close();
+	std::swap(_data, other._data);
+	std::swap(_size, other._size);
+#ifdef _WIN32
+	std::swap(_file, other._file);
+	std::swap(_mapping, other._mapping);
+#else
+	std::swap(_fd, other._fd);
+#endif
+	return *this;
+}
+
+#ifdef _WIN32
+
+bool MappedFile::open(const std::string& path)
+{
+	close();
+
+	// Sharing for deletion lets a writer replace the file (see Dictionary::saveSnapshot) while this mapping keeps the old contents
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	_file = file;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+	{
+		close();
+		return false;
+	}
+
+	_mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (_mapping == nullptr)
+	{
+		close();
+		return false;
+	}
+
+	_data = static_cast<const uint8_t*>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+	if (_data == nullptr)
+	{
+		close();
+		return false;
+	}
+	_size = size_t(fileSize.QuadPart);
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (_data)
+		UnmapViewOfFile(_data);
+	if (_mapping)
+		CloseHandle(_mapping);
+	if (_file)
+		CloseHandle(_file);
+
+	_data = nullptr;
+	_size = 0;
+	_mapping = nullptr;
+	_file = nullptr;
+}
+
+#else
+
+bool MappedFile::open(const std::string& path)
+{
+	close();
+
+	_fd = ::open(path.c_str(), O_RDONLY);
+	if (_fd < 0)
+		return false;
+
+	struct stat fileStat;
+	if (fstat(_fd, &fileStat) != 0 || fileStat.st_size == 0)
+	{
+		close();
+		return false;
+	}
+
+	void* mapping = mmap(nullptr, size_t(fileStat.st_size), PROT_READ, MAP_PRIVATE, _fd, 0);
+	if (mapping == MAP_FAILED)
+	{
+		close();
+		return false;
+	}
+	_data = static_cast<const uint8_t*>(mapping);
+	_size = size_t(fileStat.st_size);
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (_data)
+		munmap(const_cast<uint8_t*>(_data), _size);
+	if (_fd >= 0)
+		::close(_fd);
+
+	_data = nullptr;
+	_size = 0;
+	_fd = -1;
+}
+
+#endif
+
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <inttypes.h>
+#include <cstddef>
+#include <string>
+
+namespace utils
+{
+	/* Read-only memory mapping of a whole file. The mapping lives until close() or destruction. */
+	class MappedFile
+	{
+	public:
+
+		MappedFile() = default;
+		~MappedFile() { close(); }
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+		MappedFile(MappedFile&& other) noexcept { *this = std::move(other); }
+		MappedFile& operator=(MappedFile&& other) noexcept;
+
+		bool open(const std::string& path); // Returns false if the file could not be mapped
+		void close();
+
+		bool isOpen() const { return _data != nullptr; }
+		const uint8_t* data() const { return _data; }
+		size_t size() const { return _size; }
+
+	private:
+
+		const uint8_t* _data = nullptr;
+		size_t _size = 0;
+#ifdef _WIN32
+		void* _file = nullptr;
+		void* _mapping = nullptr;
+#else
+		int _fd = -1;
+#endif
+	};
+}
@@ -0,0 +1,230 @@
+#include "metrics.hpp"
+#include "logger.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <fstream>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#endif
+
+namespace utils
+{
+
+size_t Counter::getStripe()
+{
+	static std::atomic<size_t> nextStripe{ 0 };
+	thread_local const size_t stripe = nextStripe.fetch_add(1, std::memory_order_relaxed) % NUM_STRIPES;
+	return stripe;
+}
+
+Histogram::Histogram(std::vector<double> bounds) :
+	_bounds(std::move(bounds))
+{
+	if (_bounds.size() > MAX_BUCKETS)
+		_bounds.resize(MAX_BUCKETS);
+}
+
+void Histogram::observe(double value)
+{
+	const size_t bucket = size_t(std::lower_bound(_bounds.begin(), _bounds.end(), value) - _bounds.begin()); // Upper bounds are inclusive
+	Stripe& stripe = _stripes[Counter::getStripe()];
+	stripe.counts[bucket].fetch_add(1, std::memory_order_relaxed);
+
+	double sum = stripe.sum.load(std::memory_order_relaxed);
+	while (!stripe.sum.compare_exchange_weak(sum, sum + value, std::memory_order_relaxed))
+	{
+	}
+}
+
+void Histogram::getCounts(uint64_t* counts) const
+{
+	std::fill(counts, counts + _bounds.size() + 1, uint64_t(0));
+	for (const auto& stripe : _stripes)
+		for (size_t i = 0; i <= _bounds.size(); ++i)
+			counts[i] += stripe.counts[i].load(std::memory_order_relaxed);
+}
+
+uint64_t Histogram::count() const
+{
+	uint64_t counts[MAX_BUCKETS + 1];
+	getCounts(counts);
+	uint64_t total = 0;
+	for (size_t i = 0; i <= _bounds.size(); ++i)
+		total += counts[i];
+	return total;
+}
+
+double Histogram::sum() const
+{
+	double total = 0;
+	for (const auto& stripe : _stripes)
+		total += stripe.sum.load(std::memory_order_relaxed);
+	return total;
+}
+
+std::vector<double> Histogram::exponentialBounds(double start, double factor, size_t count)
+{
+	std::vector<double> bounds(std::min(count, MAX_BUCKETS));
+	for (auto& bound : bounds)
+	{
+		bound = start;
+		start *= factor;
+	}
+	return bounds;
+}
+
+std::vector<double> Histogram::linearBounds(double start, double width, size_t count)
+{
+	std::vector<double> bounds(std::min(count, MAX_BUCKETS));
+	for (size_t i = 0; i < bounds.size(); ++i)
+		bounds[i] = start + width * double(i);
+	return bounds;
+}
+
+Metrics::Entry& Metrics::add(const std::string& name, const std::string& help, const std::string& labels, Type type)
+{
+	_entries.push_back(std::make_unique<Entry>());
+	Entry& entry = *_entries.back();
+	entry.name = name;
+	entry.help = help;
+	entry.labels = labels;
+	entry.type = type;
+	return entry;
+}
+
+Counter& Metrics::counter(const std::string& name, const std::string& help, const std::string& labels)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	Entry& entry = add(name, help, labels, Type::COUNTER);
+	entry.counter = std::make_unique<Counter>();
+	return *entry.counter;
+}
+
+Gauge& Metrics::gauge(const std::string& name, const std::string& help, const std::string& labels)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	Entry& entry = add(name, help, labels, Type::GAUGE);
+	entry.gauge = std::make_unique<Gauge>();
+	return *entry.gauge;
+}
+
+Histogram& Metrics::histogram(const std::string& name, const std::string& help, std::vector<double> bounds, const std::string& labels)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	Entry& entry = add(name, help, labels, Type::HISTOGRAM);
+	entry.histogram = std::make_unique<Histogram>(std::move(bounds));
+	return *entry.histogram;
+}
+
+/* `name{labels,extra}` without the braces when both are empty */
+static void writeSeries(std::ostream& out, const std::string& name, const std::string& labels, const std::string& extra = "")
+{
+	out << name;
+	if (labels.empty() && extra.empty())
+		return;
+	out << '{' << labels << (labels.empty() || extra.empty() ? "" : ",") << extra << '}';
+}
+
+/* Shortest text which reads back as the same double */
+static void writeNumber(std::ostream& out, double value)
+{
+	char text[32];
+	const auto result = std::to_chars(text, text + sizeof(text), value);
+	out.write(text, result.ptr - text);
+}
+
+void Metrics::writePrometheus(std::ostream& out) const
+{
+	const char* typeNames[] = { "counter", "gauge", "histogram" };
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	std::vector<bool> written(_entries.size(), false);
+	for (size_t first = 0; first < _entries.size(); ++first)
+	{
+		if (written[first])
+			continue;
+
+		// The family: every entry with this name, in registration order
+		const Entry& family = *_entries[first];
+		out << "# HELP " << family.name << ' ' << family.help << '\n';
+		out << "# TYPE " << family.name << ' ' << typeNames[int(family.type)] << '\n';
+		for (size_t i = first; i < _entries.size(); ++i)
+		{
+			const Entry& entry = *_entries[i];
+			if (written[i] || entry.name != family.name)
+				continue;
+			written[i] = true;
+
+			switch (entry.type)
+			{
+			case Type::COUNTER:
+				writeSeries(out, entry.name, entry.labels);
+				out << ' ' << entry.counter->value() << '\n';
+				break;
+			case Type::GAUGE:
+				writeSeries(out, entry.name, entry.labels);
+				out << ' ';
+				writeNumber(out, entry.gauge->value());
+				out << '\n';
+				break;
+			case Type::HISTOGRAM:
+			{
+				const auto& bounds = entry.histogram->getBounds();
+				uint64_t counts[Histogram::MAX_BUCKETS + 1];
+				entry.histogram->getCounts(counts);
+
+				uint64_t cumulative = 0;
+				for (size_t bucket = 0; bucket <= bounds.size(); ++bucket)
+				{
+					cumulative += counts[bucket];
+					char bound[32] = "+Inf";
+					if (bucket < bounds.size())
+						*std::to_chars(bound, bound + sizeof(bound) - 1, bounds[bucket]).ptr = 0;
+					writeSeries(out, entry.name + "_bucket", entry.labels, std::string("le=\"") + bound + "\"");
+					out << ' ' << cumulative << '\n';
+				}
+				writeSeries(out, entry.name + "_sum", entry.labels);
+				out << ' ';
+				writeNumber(out, entry.histogram->sum());
+				out << '\n';
+				writeSeries(out, entry.name + "_count", entry.labels);
+				out << ' ' << cumulative << '\n';
+				break;
+			}
+			}
+		}
+	}
+}
+
+bool Metrics::writePrometheus(const std::string& path) const
+{
+	const std::string temporaryPath = path + ".tmp";
+	{
+		std::ofstream fout(temporaryPath);
+		writePrometheus(fout);
+		if (!fout)
+		{
+			VLOG_ERROR("[ERROR]: Metrics::writePrometheus: Could not write " << temporaryPath << std::endl);
+			return false;
+		}
+	}
+#if defined(_WIN32)
+	const bool moved = MoveFileExA(temporaryPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) != 0; // std::rename does not replace an existing file there
+#else
+	const bool moved = std::rename(temporaryPath.c_str(), path.c_str()) == 0;
+#endif
+	if (!moved)
+	{
+		VLOG_ERROR("[ERROR]: Metrics::writePrometheus: Could not move " << temporaryPath << " to " << path << std::endl);
+		return false;
+	}
+	return true;
+}
+
+}
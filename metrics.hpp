@@ -0,0 +1,233 @@
+#pragma once
+#include <inttypes.h>
+#include <cstddef>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace utils
+{
+	/*
+	* Monotonic counter. Additions go to one of a few cache line sized cells picked per thread, so threads
+	* counting the same event do not fight over one line. Reading sums the cells.
+	*/
+	class Counter
+	{
+	public:
+		constexpr static size_t NUM_STRIPES = 8;
+
+		void add(uint64_t n = 1) { _cells[getStripe()].value.fetch_add(n, std::memory_order_relaxed); }
+		uint64_t value() const
+		{
+			uint64_t sum = 0;
+			for (const auto& cell : _cells)
+				sum += cell.value.load(std::memory_order_relaxed);
+			return sum;
+		}
+
+		static size_t getStripe(); // Of the calling thread
+
+	private:
+		struct alignas(64) Cell
+		{
+			std::atomic<uint64_t> value{ 0 };
+		};
+		Cell _cells[NUM_STRIPES];
+	};
+
+	/* Last set value */
+	class Gauge
+	{
+	public:
+		void set(double value) { _value.store(value, std::memory_order_relaxed); }
+		double value() const { return _value.load(std::memory_order_relaxed); }
+
+	private:
+		std::atomic<double> _value{ 0.0 };
+	};
+
+	/* Distribution over fixed upper bounds, striped per thread like Counter */
+	class Histogram
+	{
+	public:
+		constexpr static size_t MAX_BUCKETS = 24; // Bounds, the +Inf bucket comes on top
+
+		explicit Histogram(std::vector<double> bounds); // Increasing. Extra bounds are dropped.
+
+		void observe(double value);
+
+		const std::vector<double>& getBounds() const { return _bounds; }
+		void getCounts(uint64_t* counts) const; // getBounds().size() + 1 counts, not cumulative
+		uint64_t count() const;
+		double sum() const;
+
+		static std::vector<double> exponentialBounds(double start, double factor, size_t count);
+		static std::vector<double> linearBounds(double start, double width, size_t count);
+
+	private:
+		struct alignas(64) Stripe
+		{
+			std::atomic<uint64_t> counts[MAX_BUCKETS + 1] = {};
+			std::atomic<double> sum{ 0.0 };
+		};
+
+		std::vector<double> _bounds;
+		Stripe _stripes[Counter::NUM_STRIPES];
+	};
+
+	/*
+	* Registry of the process metrics and their export in the Prometheus text format.
+	* Metrics are created once (usually into a function-local static struct) and never destroyed, so the references stay valid.
+	* Metrics with the same name and different labels form one family.
+	*/
+	class Metrics
+	{
+	public:
+
+		static Metrics& getInstance()
+		{
+			static Metrics metrics;
+			return metrics;
+		}
+
+		// `labels` is the inside of the braces, e.g. `phase="parse"`
+		Counter& counter(const std::string& name, const std::string& help, const std::string& labels = "");
+		Gauge& gauge(const std::string& name, const std::string& help, const std::string& labels = "");
+		Histogram& histogram(const std::string& name, const std::string& help, std::vector<double> bounds, const std::string& labels = "");
+
+		void writePrometheus(std::ostream& out) const;
+		bool writePrometheus(const std::string& path) const; // Writes a temporary file and renames it, so a scraper never reads half a file
+
+		Metrics(const Metrics&) = delete;
+		Metrics& operator=(const Metrics&) = delete;
+
+	private:
+
+		enum class Type
+		{
+			COUNTER,
+			GAUGE,
+			HISTOGRAM
+		};
+
+		struct Entry
+		{
+			std::string name;
+			std::string help;
+			std::string labels;
+			Type type;
+			std::unique_ptr<Counter> counter;
+			std::unique_ptr<Gauge> gauge;
+			std::unique_ptr<Histogram> histogram;
+		};
+
+		Metrics() = default;
+		Entry& add(const std::string& name, const std::string& help, const std::string& labels, Type type); // Has to hold _mutex
+
+	private:
+
+		mutable std::mutex _mutex;
+		std::vector<std::unique_ptr<Entry>> _entries; // In registration order
+	};
+
+	/* Seconds between laps, e.g. of the phases of a load */
+	class Stopwatch
+	{
+	public:
+		Stopwatch() : _start(std::chrono::steady_clock::now()) {}
+		double lap() // Seconds since the last lap (or the construction)
+		{
+			const auto now = std::chrono::steady_clock::now();
+			const double seconds = std::chrono::duration<double>(now - _start).count();
+			_start = now;
+			return seconds;
+		}
+
+	private:
+		std::chrono::steady_clock::time_point _start;
+	};
+
+	/* True on every period-th call from the calling thread */
+	inline bool sampleEvery(uint32_t period)
+	{
+		thread_local uint32_t calls = 0;
+		return ++calls >= period ? (calls = 0, true) : false;
+	}
+
+	/*
+	* Adds the lifetime of the timer in nanoseconds to a counter, or observes it in seconds in a histogram.
+	* With a period above 1 only every period-th timer of a thread reads the clock: a counter gets period times the
+	* sampled time, so its total stays an estimate of the real one, and a histogram counts only the samples.
+	*/
+	class ScopedTimer
+	{
+	public:
+		explicit ScopedTimer(Counter& counter, uint32_t period = 1) : _period(period)
+		{
+			if (period <= 1 || sampleEvery(period))
+			{
+				_counter = &counter;
+				_start = std::chrono::steady_clock::now();
+			}
+		}
+		explicit ScopedTimer(Histogram& histogram, uint32_t period = 1) : _period(period)
+		{
+			if (period <= 1 || sampleEvery(period))
+			{
+				_histogram = &histogram;
+				_start = std::chrono::steady_clock::now();
+			}
+		}
+		~ScopedTimer()
+		{
+			if (!_counter && !_histogram)
+				return;
+
+			const auto elapsed = std::chrono::steady_clock::now() - _start;
+			if (_counter)
+				_counter->add(uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()) * _period);
+			else
+				_histogram->observe(std::chrono::duration<double>(elapsed).count());
+		}
+
+		ScopedTimer(const ScopedTimer&) = delete;
+		ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+	private:
+		Counter* _counter = nullptr;
+		Histogram* _histogram = nullptr;
+		uint64_t _period;
+		std::chrono::steady_clock::time_point _start;
+	};
+}
+
+#ifndef VMETRICS_ENABLED
+#define VMETRICS_ENABLED 1 // 0 compiles the VMETRIC_* macros out. The metrics are still registered and exported as zeros.
+#endif
+
+#ifndef VMETRIC_SAMPLE_PERIOD
+#define VMETRIC_SAMPLE_PERIOD 64 // VMETRIC_TIME_SAMPLED reads the clock once per this many calls
+#endif
+
+#define VMETRIC_CONCAT_INNER(a, b) a##b
+#define VMETRIC_CONCAT(a, b) VMETRIC_CONCAT_INNER(a, b)
+
+#if VMETRICS_ENABLED
+#define VMETRIC_ADD(counter, n) (counter).add(n)
+#define VMETRIC_INC(counter) (counter).add(1)
+#define VMETRIC_SET(gauge, value) (gauge).set(value)
+#define VMETRIC_OBSERVE(histogram, value) (histogram).observe(value)
+#define VMETRIC_TIME(metric) utils::ScopedTimer VMETRIC_CONCAT(vmetricTimer, __LINE__)(metric) // Until the end of the scope
+#define VMETRIC_TIME_SAMPLED(metric) utils::ScopedTimer VMETRIC_CONCAT(vmetricTimer, __LINE__)(metric, VMETRIC_SAMPLE_PERIOD) // For calls too short to read the clock twice on every one
+#else
+#define VMETRIC_ADD(counter, n) ((void)0)
+#define VMETRIC_INC(counter) ((void)0)
+#define VMETRIC_SET(gauge, value) ((void)0)
+#define VMETRIC_OBSERVE(histogram, value) ((void)0)
+#define VMETRIC_TIME(metric) ((void)0)
+#define VMETRIC_TIME_SAMPLED(metric) ((void)0)
+#endif
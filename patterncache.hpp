@@ -0,0 +1,267 @@
+#pragma once
+#include <inttypes.h>
+#include <cstddef>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "robin_hood.h"
+
+namespace utils
+{
+	/*
+	* Concurrent cache from pattern to the words matching it, bounded by a byte budget.
+	* The cache is split in shards by pattern hash. Lookups only take a shared lock on their shard and mark the entry
+	* as referenced, so readers never block each other. Inserts take the shard exclusively and evict with the CLOCK
+	* algorithm (an approximation of LRU which does not need to reorder anything on a hit).
+	* Entries are immutable and shared, so a Pattern still iterating an evicted or replaced entry keeps it alive.
+	* When the dictionary changes, invalidate drops only the entries whose pattern matches the changed word. Every invalidation
+	* bumps a generation, and insert does not cache words computed before the last one, so a stale entry cannot slip back in.
+	*/
+	class PatternCache
+	{
+	public:
+
+		using WordId = uint32_t;
+		using Entry = std::shared_ptr<const std::vector<WordId>>;
+
+		constexpr static size_t DEFAULT_BUDGET_BYTES = 256ull << 20;
+		constexpr static size_t NUM_SHARDS = 16;
+		constexpr static char ANY_CHAR = 0; // Dictionary::ANY_CHAR
+
+		struct Stats
+		{
+			uint64_t hits = 0;
+			uint64_t misses = 0;
+			uint64_t evictions = 0;
+			size_t entries = 0;
+			size_t bytes = 0; // Approximate memory held by the cached entries
+			size_t budgetBytes = 0;
+		};
+
+	public:
+
+		explicit PatternCache(size_t budgetBytes = DEFAULT_BUDGET_BYTES) : _budgetBytes(budgetBytes) {}
+
+		PatternCache(const PatternCache&) = delete;
+		PatternCache& operator=(const PatternCache&) = delete;
+
+		/* Returns the cached words for `pattern` or nullptr */
+		Entry find(std::string_view pattern) const { return lookup(pattern, true); }
+		/* Like find, but leaves the hits and misses alone. For callers which use an entry when there is one and never insert it. */
+		Entry peek(std::string_view pattern) const { return lookup(pattern, false); }
+
+		/* Read before computing the words of a pattern and passed to insert */
+		uint64_t getGeneration() const { return _generation.load(); }
+
+		/*
+		* Caches `words` for `pattern` (replacing an older entry), evicting entries of the shard if its budget is exceeded.
+		* The words are only returned, not cached, if the cache was invalidated since `generation`.
+		*/
+		Entry insert(std::string_view pattern, std::vector<WordId> words, uint64_t generation)
+		{
+			return insertEntry(pattern, std::make_shared<const std::vector<WordId>>(std::move(words)), generation, false);
+		}
+
+		/*
+		* Caches words owned by another cache too, e.g. the words a dictionary layer takes unchanged from its base.
+		* Only the node counts against the budget, so an entry the owner evicted stays alive until this cache drops it.
+		*/
+		Entry insertShared(std::string_view pattern, Entry words, uint64_t generation)
+		{
+			return insertEntry(pattern, std::move(words), generation, true);
+		}
+
+		/* Drops every entry whose pattern `word` matches (same length, every letter equal or ANY_CHAR) */
+		void invalidate(std::string_view word)
+		{
+			_generation.fetch_add(1);
+			for (auto& shard : _shards)
+			{
+				std::unique_lock<std::shared_mutex> lock(shard.mutex);
+				for (size_t i = 0; i < shard.clock.size();)
+				{
+					Node* node = shard.clock[i];
+					if (!matches(node->pattern, word))
+					{
+						++i;
+						continue;
+					}
+
+					shard.bytes -= node->bytes;
+					shard.clock[i] = shard.clock.back();
+					shard.clock.pop_back();
+					shard.map.erase(shard.map.find(std::string_view(node->pattern)));
+				}
+			}
+		}
+
+		void clear()
+		{
+			_generation.fetch_add(1);
+			for (auto& shard : _shards)
+			{
+				std::unique_lock<std::shared_mutex> lock(shard.mutex);
+				shard.clock.clear();
+				shard.map.clear();
+				shard.hand = 0;
+				shard.bytes = 0;
+			}
+		}
+
+		void setBudget(size_t budgetBytes)
+		{
+			_budgetBytes = budgetBytes;
+			for (auto& shard : _shards)
+			{
+				std::unique_lock<std::shared_mutex> lock(shard.mutex);
+				evictToBudget(shard);
+			}
+		}
+
+		Stats getStats() const
+		{
+			Stats stats;
+			stats.hits = _hits.load(std::memory_order_relaxed);
+			stats.misses = _misses.load(std::memory_order_relaxed);
+			stats.evictions = _evictions.load(std::memory_order_relaxed);
+			stats.budgetBytes = _budgetBytes;
+			for (const auto& shard : _shards)
+			{
+				std::shared_lock<std::shared_mutex> lock(shard.mutex);
+				stats.entries += shard.map.size();
+				stats.bytes += shard.bytes;
+			}
+			return stats;
+		}
+
+	private:
+
+		struct Node
+		{
+			std::string pattern;
+			Entry words;
+			size_t bytes = 0;
+			bool shared = false; // The words are accounted by the cache which owns them
+			std::atomic<bool> referenced{ true };
+		};
+
+		struct Shard
+		{
+			mutable std::shared_mutex mutex;
+			robin_hood::unordered_map<std::string_view, std::unique_ptr<Node>> map; // Keys point into the nodes
+			std::vector<Node*> clock;
+			size_t hand = 0;
+			size_t bytes = 0;
+		};
+
+		Entry lookup(std::string_view pattern, bool recordStats) const
+		{
+			const Shard& shard = getShard(pattern);
+			std::shared_lock<std::shared_mutex> lock(shard.mutex);
+
+			auto it = shard.map.find(pattern);
+			if (it == shard.map.end())
+			{
+				if (recordStats)
+					_misses.fetch_add(1, std::memory_order_relaxed);
+				return nullptr;
+			}
+			if (recordStats)
+				_hits.fetch_add(1, std::memory_order_relaxed);
+			it->second->referenced.store(true, std::memory_order_relaxed);
+			return it->second->words;
+		}
+
+		Entry insertEntry(std::string_view pattern, Entry entry, uint64_t generation, bool shared)
+		{
+			Shard& shard = getShard(pattern);
+			std::unique_lock<std::shared_mutex> lock(shard.mutex);
+			if (_generation.load() != generation)
+				return entry;
+
+			auto it = shard.map.find(pattern);
+			if (it != shard.map.end())
+			{
+				Node& node = *it->second;
+				shard.bytes -= node.bytes;
+				node.words = entry;
+				node.shared = shared;
+				node.bytes = entryBytes(node);
+				shard.bytes += node.bytes;
+			}
+			else
+			{
+				auto node = std::make_unique<Node>();
+				node->pattern = pattern;
+				node->words = entry;
+				node->shared = shared;
+				node->bytes = entryBytes(*node);
+				shard.bytes += node->bytes;
+				shard.clock.push_back(node.get());
+				shard.map.emplace(std::string_view(node->pattern), std::move(node));
+			}
+
+			evictToBudget(shard);
+			return entry;
+		}
+
+		static size_t entryBytes(const Node& node)
+		{
+			const size_t mapOverhead = sizeof(std::string_view) + sizeof(std::unique_ptr<Node>) + 2 * sizeof(void*);
+			return sizeof(Node) + node.pattern.capacity() + (node.shared ? 0 : sizeof(std::vector<WordId>) + node.words->capacity() * sizeof(WordId)) + mapOverhead;
+		}
+
+		static bool matches(std::string_view pattern, std::string_view word)
+		{
+			if (pattern.size() != word.size())
+				return false;
+			for (size_t i = 0; i < pattern.size(); ++i)
+			{
+				if (pattern[i] != ANY_CHAR && pattern[i] != word[i])
+					return false;
+			}
+			return true;
+		}
+
+		const Shard& getShard(std::string_view pattern) const { return _shards[std::hash<std::string_view>()(pattern) % NUM_SHARDS]; }
+		Shard& getShard(std::string_view pattern) { return _shards[std::hash<std::string_view>()(pattern) % NUM_SHARDS]; }
+
+		void evictToBudget(Shard& shard)
+		{
+			const size_t shardBudget = _budgetBytes / NUM_SHARDS;
+			while (shard.bytes > shardBudget && !shard.clock.empty())
+			{
+				if (shard.hand >= shard.clock.size())
+					shard.hand = 0;
+
+				Node* node = shard.clock[shard.hand];
+				if (node->referenced.exchange(false, std::memory_order_relaxed))
+				{
+					++shard.hand; // Second chance
+					continue;
+				}
+
+				shard.bytes -= node->bytes;
+				shard.clock[shard.hand] = shard.clock.back();
+				shard.clock.pop_back();
+				shard.map.erase(shard.map.find(std::string_view(node->pattern)));
+				_evictions.fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+
+	private:
+
+		Shard _shards[NUM_SHARDS];
+		std::atomic<size_t> _budgetBytes;
+		std::atomic<uint64_t> _generation{ 0 }; // Number of invalidations
+
+		mutable std::atomic<uint64_t> _hits{ 0 };
+		mutable std::atomic<uint64_t> _misses{ 0 };
+		std::atomic<uint64_t> _evictions{ 0 };
+	};
+}
@@ -0,0 +1,886 @@
+#include "patternindex.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define PATTERN_INDEX_SSE2
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define PATTERN_INDEX_TARGET_AVX2
+#else
+#define PATTERN_INDEX_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace utils
+{
+
+static inline uint32_t countTrailingZeros(uint64_t block)
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanForward64(&index, block);
+	return index;
+#else
+	return __builtin_ctzll(block);
+#endif
+}
+
+static inline uint32_t countBits(uint64_t block)
+{
+#if defined(_MSC_VER)
+	return uint32_t(__popcnt64(block));
+#else
+	return uint32_t(__builtin_popcountll(block));
+#endif
+}
+
+/* Masked compare of a packed word: every byte of `word` selected by `mask` has to equal the same byte of `value` */
+template <uint32_t WIDTH>
+static inline bool matchesPacked(const uint8_t* word, const uint8_t* mask, const uint8_t* value)
+{
+#if defined(PATTERN_INDEX_SSE2)
+	if constexpr (WIDTH >= 16)
+	{
+		__m128i diff = _mm_setzero_si128();
+		for (uint32_t i = 0; i < WIDTH; i += 16)
+		{
+			const __m128i letters = _mm_loadu_si128(reinterpret_cast<const __m128i*>(word + i));
+			const __m128i selected = _mm_and_si128(letters, _mm_loadu_si128(reinterpret_cast<const __m128i*>(mask + i)));
+			diff = _mm_or_si128(diff, _mm_xor_si128(selected, _mm_loadu_si128(reinterpret_cast<const __m128i*>(value + i))));
+		}
+		return _mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) == 0xFFFF;
+	}
+#endif
+	uint64_t diff = 0;
+	for (uint32_t i = 0; i < WIDTH; i += 8)
+	{
+		uint64_t letters, selected, expected;
+		std::memcpy(&letters, word + i, 8);
+		std::memcpy(&selected, mask + i, 8);
+		std::memcpy(&expected, value + i, 8);
+		diff |= (letters & selected) ^ expected;
+	}
+	return diff == 0;
+}
+
+/* Calls visit(bit) for every set bit of `sparsest` whose packed word matches */
+template <uint32_t WIDTH, typename Visit>
+static void scanPacked(const uint8_t* packed, const uint64_t* sparsest, size_t numBlocks, const uint8_t* mask, const uint8_t* value, Visit& visit)
+{
+	for (size_t block = 0; block < numBlocks; ++block)
+	{
+		uint64_t bits = sparsest[block];
+		while (bits)
+		{
+			const uint32_t bit = uint32_t(block * 64 + countTrailingZeros(bits));
+			if (matchesPacked<WIDTH>(packed + size_t(bit) * WIDTH, mask, value))
+				visit(bit);
+			bits &= bits - 1;
+		}
+	}
+}
+
+std::shared_ptr<const PatternIndex::LengthBucket> PatternIndex::emptyBucket()
+{
+	static const auto empty = std::make_shared<const LengthBucket>();
+	return empty;
+}
+
+std::shared_ptr<const PatternIndex::Length> PatternIndex::makeLength(std::shared_ptr<const LengthBucket> bucket, std::shared_ptr<const LengthBucket> appended)
+{
+	return std::make_shared<const Length>(Length{ std::move(bucket), appended ? std::move(appended) : emptyBucket() });
+}
+
+void PatternIndex::reset(uint32_t longestWord)
+{
+	_lengths.clear();
+	_lengths.resize(longestWord, makeLength(emptyBucket()));
+}
+
+std::vector<std::vector<PatternIndex::WordId>> PatternIndex::groupByLength(const StringTable& words, uint32_t longestWord)
+{
+	std::vector<std::vector<WordId>> ids(longestWord);
+	for (WordId id = 0; id < words.size(); ++id)
+	{
+		if (words[id].size() < longestWord)
+			ids[words[id].size()].push_back(id);
+	}
+	return ids;
+}
+
+void PatternIndex::buildBucket(LengthBucket& bucket, uint32_t length, std::vector<WordId> ids, const StringTable& words)
+{
+	bucket.numWords = uint32_t(ids.size());
+	bucket.numBlocks = (bucket.numWords + 63) / 64;
+
+	std::vector<uint32_t> counts(length * ALPHABET_SIZE, 0);
+	std::vector<uint64_t> bitmaps(size_t(length) * ALPHABET_SIZE * bucket.numBlocks, 0ull);
+	bucket.width = packedWidth(length);
+	std::vector<uint8_t> packed(size_t(bucket.numWords) * bucket.width, 0);
+
+	for (uint32_t bit = 0; bit < bucket.numWords; ++bit)
+	{
+		const auto word = words[ids[bit]];
+		if (bucket.width)
+			std::copy(word.begin(), word.end(), packed.begin() + size_t(bit) * bucket.width);
+		for (uint32_t pos = 0; pos < length; ++pos)
+		{
+			int letter = letterIndex(word[pos]);
+			if (letter < 0)
+				continue;
+
+			const uint32_t bitmapIndex = pos * ALPHABET_SIZE + letter;
+			bitmaps[size_t(bitmapIndex) * bucket.numBlocks + bit / 64] |= 1ull << (bit % 64);
+			++counts[bitmapIndex];
+		}
+	}
+
+	bucket.ids.assign(std::move(ids));
+	bucket.counts.assign(std::move(counts));
+	bucket.bitmaps.assign(std::move(bitmaps));
+	bucket.packed.assign(std::move(packed));
+}
+
+void PatternIndex::build(const StringTable& words, uint32_t longestWord)
+{
+	reset(longestWord);
+
+	auto ids = groupByLength(words, longestWord);
+	for (uint32_t length = 0; length < longestWord; ++length)
+	{
+		auto bucket = std::make_shared<LengthBucket>();
+		buildBucket(*bucket, length, std::move(ids[length]), words);
+		_lengths[length] = makeLength(std::move(bucket));
+	}
+}
+
+void PatternIndex::build(const StringTable& words, uint32_t longestWord, ThreadPool& pool)
+{
+	reset(longestWord);
+
+	auto ids = groupByLength(words, longestWord);
+	for (uint32_t length = 0; length < longestWord; ++length)
+	{
+		pool.submit([this, length, &ids, &words]()
+		{
+			auto bucket = std::make_shared<LengthBucket>();
+			buildBucket(*bucket, length, std::move(ids[length]), words);
+			_lengths[length] = makeLength(std::move(bucket));
+		});
+	}
+	pool.wait();
+}
+
+/* Per length: numWords, numBlocks, ids, counts, bitmaps and packed words. Every array starts at an 8 byte boundary. */
+void PatternIndex::write(SnapshotWriter& out) const
+{
+	for (uint32_t length = 0; length < _lengths.size(); ++length)
+	{
+		const auto shared = std::atomic_load(&_lengths[length]);
+		const auto bucket = shared->appended->numWords ? concatBuckets(*shared->bucket, *shared->appended, length) : shared->bucket;
+		out.write(&bucket->numWords, sizeof(bucket->numWords));
+		out.write(&bucket->numBlocks, sizeof(bucket->numBlocks));
+		out.write(bucket->ids.data(), bucket->ids.size() * sizeof(WordId));
+		out.align();
+		out.write(bucket->counts.data(), bucket->counts.size() * sizeof(uint32_t));
+		out.align();
+		out.write(bucket->bitmaps.data(), bucket->bitmaps.size() * sizeof(uint64_t));
+		out.align();
+		out.write(bucket->packed.data(), bucket->packed.size());
+	}
+}
+
+/* Increasing ids below numWords and no bits past the words of the bucket, so find never reads past the ids */
+bool PatternIndex::isValidBucket(const WordId* ids, const uint64_t* bitmaps, const LengthBucket& bucket, size_t numBitmaps, size_t numWords)
+{
+	for (uint32_t i = 0; i < bucket.numWords; ++i)
+	{
+		if (ids[i] >= numWords || (i && ids[i] <= ids[i - 1]))
+			return false;
+	}
+	if (bucket.numWords % 64 == 0)
+		return true;
+
+	const uint64_t unused = ~0ull << (bucket.numWords % 64);
+	for (size_t bitmapIndex = 0; bitmapIndex < numBitmaps; ++bitmapIndex)
+	{
+		if (bitmaps[(bitmapIndex + 1) * bucket.numBlocks - 1] & unused)
+			return false;
+	}
+	return true;
+}
+
+bool PatternIndex::map(const uint8_t* data, size_t size, uint32_t longestWord, size_t numWords)
+{
+	reset(longestWord);
+
+	SnapshotReader in(data, size);
+	for (uint32_t length = 0; length < longestWord; ++length)
+	{
+		auto bucket = std::make_shared<LengthBucket>();
+
+		const uint32_t* header = in.read<uint32_t>(2);
+		if (!header || header[1] != (uint64_t(header[0]) + 63) / 64)
+		{
+			reset(longestWord);
+			return false;
+		}
+		bucket->numWords = header[0];
+		bucket->numBlocks = header[1];
+
+		const size_t numBitmaps = size_t(length) * ALPHABET_SIZE;
+		const WordId* ids = in.read<WordId>(bucket->numWords);
+		in.align();
+		const uint32_t* counts = in.read<uint32_t>(numBitmaps);
+		in.align();
+		const uint64_t* bitmaps = in.read<uint64_t>(numBitmaps * bucket->numBlocks);
+		in.align();
+		bucket->width = packedWidth(length);
+		const uint8_t* packed = in.read<uint8_t>(size_t(bucket->numWords) * bucket->width);
+
+		if (in.failed() || !isValidBucket(ids, bitmaps, *bucket, numBitmaps, numWords))
+		{
+			reset(longestWord);
+			return false;
+		}
+
+		bucket->ids.view(ids, bucket->numWords);
+		bucket->counts.view(counts, numBitmaps);
+		bucket->bitmaps.view(bitmaps, numBitmaps * bucket->numBlocks);
+		bucket->packed.view(packed, size_t(bucket->numWords) * bucket->width);
+		_lengths[length] = makeLength(std::move(bucket));
+	}
+	return true;
+}
+
+/*
+* AND kernels over the blocks [begin, end). x86-64 always has SSE2 and AVX2 is picked at runtime like the code page
+* kernels, NEON at compile time. A kernel hands the tail which does not fill its vectors to the next narrower one.
+*/
+using AndKernel = void (*)(const uint64_t* const* sources, size_t numSources, uint64_t* out, size_t begin, size_t end);
+using AndCountKernel = size_t (*)(const uint64_t* const* sources, size_t numSources, size_t begin, size_t end);
+
+static void andScalar(const uint64_t* const* sources, size_t numSources, uint64_t* out, size_t begin, size_t end)
+{
+	for (size_t i = begin; i < end; ++i)
+	{
+		uint64_t acc = sources[0][i];
+		for (size_t k = 1; k < numSources; ++k)
+			acc &= sources[k][i];
+		out[i] = acc;
+	}
+}
+
+static size_t andCountScalar(const uint64_t* const* sources, size_t numSources, size_t begin, size_t end)
+{
+	size_t count = 0;
+	for (size_t i = begin; i < end; ++i)
+	{
+		uint64_t acc = sources[0][i];
+		for (size_t k = 1; k < numSources; ++k)
+			acc &= sources[k][i];
+		count += countBits(acc);
+	}
+	return count;
+}
+
+#if defined(__x86_64__) || defined(_M_X64)
+static void andSse2(const uint64_t* const* sources, size_t numSources, uint64_t* out, size_t begin, size_t end)
+{
+	size_t i = begin;
+	for (; i + 2 <= end; i += 2)
+	{
+		__m128i acc = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sources[0] + i));
+		for (size_t k = 1; k < numSources; ++k)
+			acc = _mm_and_si128(acc, _mm_loadu_si128(reinterpret_cast<const __m128i*>(sources[k] + i)));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), acc);
+	}
+	andScalar(sources, numSources, out, i, end);
+}
+
+/* Baseline x86-64 has no popcnt instruction, so the bytes are counted with shifts and masks and summed with one SAD per 16 bytes */
+static size_t andCountSse2(const uint64_t* const* sources, size_t numSources, size_t begin, size_t end)
+{
+	const __m128i m1 = _mm_set1_epi8(0x55), m2 = _mm_set1_epi8(0x33), m4 = _mm_set1_epi8(0x0F);
+	__m128i total = _mm_setzero_si128();
+	size_t i = begin;
+	for (; i + 2 <= end; i += 2)
+	{
+		__m128i acc = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sources[0] + i));
+		for (size_t k = 1; k < numSources; ++k)
+			acc = _mm_and_si128(acc, _mm_loadu_si128(reinterpret_cast<const __m128i*>(sources[k] + i)));
+		acc = _mm_sub_epi8(acc, _mm_and_si128(_mm_srli_epi16(acc, 1), m1));
+		acc = _mm_add_epi8(_mm_and_si128(acc, m2), _mm_and_si128(_mm_srli_epi16(acc, 2), m2));
+		acc = _mm_and_si128(_mm_add_epi8(acc, _mm_srli_epi16(acc, 4)), m4);
+		total = _mm_add_epi64(total, _mm_sad_epu8(acc, _mm_setzero_si128()));
+	}
+	alignas(16) uint64_t lanes[2];
+	_mm_store_si128(reinterpret_cast<__m128i*>(lanes), total);
+	return size_t(lanes[0] + lanes[1]) + andCountScalar(sources, numSources, i, end);
+}
+
+PATTERN_INDEX_TARGET_AVX2
+static void andAvx2(const uint64_t* const* sources, size_t numSources, uint64_t* out, size_t begin, size_t end)
+{
+	size_t i = begin;
+	for (; i + 4 <= end; i += 4)
+	{
+		__m256i acc = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(sources[0] + i));
+		for (size_t k = 1; k < numSources; ++k)
+			acc = _mm256_and_si256(acc, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(sources[k] + i)));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), acc);
+	}
+	andSse2(sources, numSources, out, i, end);
+}
+
+/* Counts every nibble with a 16 entry shuffle table and sums the bytes with one SAD per 32 bytes */
+PATTERN_INDEX_TARGET_AVX2
+static size_t andCountAvx2(const uint64_t* const* sources, size_t numSources, size_t begin, size_t end)
+{
+	const __m256i table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+	const __m256i low = _mm256_set1_epi8(0x0F);
+	__m256i total = _mm256_setzero_si256();
+	size_t i = begin;
+	for (; i + 4 <= end; i += 4)
+	{
+		__m256i acc = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(sources[0] + i));
+		for (size_t k = 1; k < numSources; ++k)
+			acc = _mm256_and_si256(acc, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(sources[k] + i)));
+		const __m256i counts = _mm256_add_epi8(_mm256_shuffle_epi8(table, _mm256_and_si256(acc, low)),
+			_mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(acc, 4), low)));
+		total = _mm256_add_epi64(total, _mm256_sad_epu8(counts, _mm256_setzero_si256()));
+	}
+	alignas(32) uint64_t lanes[4];
+	_mm256_store_si256(reinterpret_cast<__m256i*>(lanes), total);
+	return size_t(lanes[0] + lanes[1] + lanes[2] + lanes[3]) + andCountSse2(sources, numSources, i, end);
+}
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+static void andNeon(const uint64_t* const* sources, size_t numSources, uint64_t* out, size_t begin, size_t end)
+{
+	size_t i = begin;
+	for (; i + 2 <= end; i += 2)
+	{
+		uint64x2_t acc = vld1q_u64(sources[0] + i);
+		for (size_t k = 1; k < numSources; ++k)
+			acc = vandq_u64(acc, vld1q_u64(sources[k] + i));
+		vst1q_u64(out + i, acc);
+	}
+	andScalar(sources, numSources, out, i, end);
+}
+
+static size_t andCountNeon(const uint64_t* const* sources, size_t numSources, size_t begin, size_t end)
+{
+	uint64x2_t total = vdupq_n_u64(0);
+	size_t i = begin;
+	for (; i + 2 <= end; i += 2)
+	{
+		uint64x2_t acc = vld1q_u64(sources[0] + i);
+		for (size_t k = 1; k < numSources; ++k)
+			acc = vandq_u64(acc, vld1q_u64(sources[k] + i));
+		total = vpadalq_u32(total, vpaddlq_u16(vpaddlq_u8(vcntq_u8(vreinterpretq_u8_u64(acc)))));
+	}
+	return size_t(vgetq_lane_u64(total, 0) + vgetq_lane_u64(total, 1)) + andCountScalar(sources, numSources, i, end);
+}
+#endif
+
+static AndKernel getBestAndKernel()
+{
+#if defined(__x86_64__) || defined(_M_X64)
+	return codepage::hasAvx2() ? andAvx2 : andSse2;
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	return andNeon;
+#else
+	return andScalar;
+#endif
+}
+
+static AndCountKernel getBestAndCountKernel()
+{
+#if defined(__x86_64__) || defined(_M_X64)
+	return codepage::hasAvx2() ? andCountAvx2 : andCountSse2;
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	return andCountNeon;
+#else
+	return andCountScalar;
+#endif
+}
+
+/* out[i] = AND of sources[k][i] over all k. Needs at least one source. */
+void PatternIndex::andBitmaps(const uint64_t* const* sources, size_t numSources, uint64_t* out, size_t numBlocks)
+{
+	static const AndKernel kernel = getBestAndKernel();
+	kernel(sources, numSources, out, 0, numBlocks);
+}
+
+/* Number of set bits in the AND of the sources */
+size_t PatternIndex::andCount(const uint64_t* const* sources, size_t numSources, size_t numBlocks)
+{
+	static const AndCountKernel kernel = getBestAndCountKernel();
+	return kernel(sources, numSources, 0, numBlocks);
+}
+
+bool PatternIndex::intersects(const uint64_t* a, const uint64_t* b, size_t numBlocks)
+{
+	for (size_t i = 0; i < numBlocks; ++i)
+	{
+		if (a[i] & b[i])
+			return true;
+	}
+	return false;
+}
+
+PatternIndex::Sources PatternIndex::getSources(const LengthBucket& bucket, std::string_view pattern)
+{
+	Sources sources;
+	sources.bitmaps.reserve(pattern.size());
+	sources.empty = bucket.numWords == 0;
+
+	for (uint32_t pos = 0; pos < pattern.size() && !sources.empty; ++pos)
+	{
+		if (uint8_t(pattern[pos]) == ANY_CHAR)
+			continue;
+
+		int letter = letterIndex(pattern[pos]);
+		if (letter < 0)
+		{
+			sources.empty = true; // Only cyrillic letters are indexed
+			break;
+		}
+
+		const uint32_t bitmapIndex = pos * ALPHABET_SIZE + letter;
+		sources.empty = bucket.counts[bitmapIndex] == 0; // No word has this letter here
+		if (bucket.counts[bitmapIndex] < sources.fewest)
+		{
+			sources.fewest = bucket.counts[bitmapIndex];
+			sources.sparsest = uint32_t(sources.bitmaps.size());
+		}
+		sources.bitmaps.push_back(bucket.bitmap(bitmapIndex));
+	}
+	return sources;
+}
+
+/*
+* Scanning reads the sparsest bitmap once and compares `fewest` packed words, ANDing reads every bitmap once.
+* A compare costs about as much as ANDing 8 blocks.
+*/
+bool PatternIndex::shouldScan(const LengthBucket& bucket, const Sources& sources)
+{
+	const size_t compareCost = 8;
+	return bucket.width != 0 && sources.bitmaps.size() > 1 && size_t(sources.fewest) * compareCost < (sources.bitmaps.size() - 1) * size_t(bucket.numBlocks);
+}
+
+/* The width is dispatched once per query, so the compare of every word is unrolled for it */
+template <typename Visit>
+void PatternIndex::scanSparsest(const LengthBucket& bucket, const Sources& sources, std::string_view pattern, Visit&& visit)
+{
+	alignas(16) uint8_t mask[MAX_PACKED_WIDTH] = {};
+	alignas(16) uint8_t value[MAX_PACKED_WIDTH] = {};
+	for (uint32_t pos = 0; pos < pattern.size(); ++pos)
+	{
+		if (uint8_t(pattern[pos]) == ANY_CHAR)
+			continue;
+		mask[pos] = 0xFF;
+		value[pos] = uint8_t(pattern[pos]);
+	}
+
+	const uint64_t* sparsest = sources.bitmaps[sources.sparsest];
+	switch (bucket.width)
+	{
+	case 8: scanPacked<8>(bucket.packed.data(), sparsest, bucket.numBlocks, mask, value, visit); break;
+	case 16: scanPacked<16>(bucket.packed.data(), sparsest, bucket.numBlocks, mask, value, visit); break;
+	case 32: scanPacked<32>(bucket.packed.data(), sparsest, bucket.numBlocks, mask, value, visit); break;
+	case 64: scanPacked<64>(bucket.packed.data(), sparsest, bucket.numBlocks, mask, value, visit); break;
+	}
+}
+
+/* Appends the words of `bucket` which satisfy this pattern, ANDing the bitmaps of every filled position or scanning the sparsest one */
+void PatternIndex::findInBucket(const LengthBucket& bucket, std::string_view pattern, std::vector<WordId>& out)
+{
+	const Sources sources = getSources(bucket, pattern);
+	if (sources.empty)
+		return;
+
+	if (sources.bitmaps.empty()) // Every word of this length matches
+	{
+		out.insert(out.end(), bucket.ids.begin(), bucket.ids.end());
+		return;
+	}
+
+	out.reserve(out.size() + sources.fewest);
+	if (shouldScan(bucket, sources))
+	{
+		scanSparsest(bucket, sources, pattern, [&](uint32_t bit) { out.push_back(bucket.ids[bit]); });
+		return;
+	}
+
+	const size_t numBlocks = bucket.numBlocks;
+	std::vector<uint64_t> result(numBlocks);
+	andBitmaps(sources.bitmaps.data(), sources.bitmaps.size(), result.data(), numBlocks);
+
+	for (size_t block = 0; block < numBlocks; ++block)
+	{
+		uint64_t bits = result[block];
+		while (bits)
+		{
+			out.push_back(bucket.ids[block * 64 + countTrailingZeros(bits)]);
+			bits &= bits - 1;
+		}
+	}
+}
+
+/* The appended words come after the bucket, so the ids stay in increasing order */
+void PatternIndex::find(std::string_view pattern, std::vector<WordId>& out) const
+{
+	if (pattern.size() >= _lengths.size())
+		return;
+
+	const auto shared = std::atomic_load(&_lengths[pattern.size()]); // Keeps the buckets alive if they are replaced meanwhile
+	findInBucket(*shared->bucket, pattern, out);
+	if (shared->appended->numWords)
+		findInBucket(*shared->appended, pattern, out);
+}
+
+/* Like findInBucket, but only the popcount of the AND is needed, so nothing is materialized */
+size_t PatternIndex::countInBucket(const LengthBucket& bucket, std::string_view pattern)
+{
+	const Sources sources = getSources(bucket, pattern);
+	if (sources.empty)
+		return 0;
+	if (sources.bitmaps.empty())
+		return bucket.numWords;
+	if (sources.bitmaps.size() == 1)
+		return sources.fewest;
+	if (shouldScan(bucket, sources))
+	{
+		size_t count = 0;
+		scanSparsest(bucket, sources, pattern, [&count](uint32_t) { ++count; });
+		return count;
+	}
+
+	return andCount(sources.bitmaps.data(), sources.bitmaps.size(), bucket.numBlocks);
+}
+
+size_t PatternIndex::count(std::string_view pattern) const
+{
+	if (pattern.size() >= _lengths.size())
+		return 0;
+
+	const auto shared = std::atomic_load(&_lengths[pattern.size()]);
+	const size_t count = countInBucket(*shared->bucket, pattern);
+	return shared->appended->numWords ? count + countInBucket(*shared->appended, pattern) : count;
+}
+
+/*
+* A letter is supported at `position` if its bitmap there intersects the matches. `matches` is the AND of the filled
+* positions, or nullptr if the pattern has none (then every word matches and the counts answer it).
+*/
+uint32_t PatternIndex::supportAt(const LengthBucket& bucket, std::string_view pattern, const std::vector<uint64_t>* matches, uint32_t position)
+{
+	if (uint8_t(pattern[position]) != ANY_CHAR)
+		return 1u << letterIndex(pattern[position]); // The pattern only matches words with this letter here
+
+	uint32_t mask = 0;
+	for (uint32_t letter = 0; letter < ALPHABET_SIZE; ++letter)
+	{
+		const uint32_t bitmapIndex = position * ALPHABET_SIZE + letter;
+		if (bucket.counts[bitmapIndex] == 0)
+			continue;
+		if (!matches || intersects(matches->data(), bucket.bitmap(bitmapIndex), bucket.numBlocks))
+			mask |= 1u << letter;
+	}
+	return mask;
+}
+
+void PatternIndex::letterSupportInBucket(const LengthBucket& bucket, std::string_view pattern, uint32_t* masks)
+{
+	const Sources sources = getSources(bucket, pattern);
+	if (sources.empty)
+		return;
+
+	std::vector<uint64_t> matches;
+	if (!sources.bitmaps.empty())
+	{
+		matches.resize(bucket.numBlocks);
+		andBitmaps(sources.bitmaps.data(), sources.bitmaps.size(), matches.data(), bucket.numBlocks);
+		if (std::all_of(matches.begin(), matches.end(), [](uint64_t block) { return block == 0; }))
+			return;
+	}
+
+	for (uint32_t pos = 0; pos < pattern.size(); ++pos)
+		masks[pos] |= supportAt(bucket, pattern, sources.bitmaps.empty() ? nullptr : &matches, pos);
+}
+
+void PatternIndex::letterSupport(std::string_view pattern, uint32_t* masks) const
+{
+	std::fill(masks, masks + pattern.size(), 0u);
+	if (pattern.size() >= _lengths.size())
+		return;
+
+	const auto shared = std::atomic_load(&_lengths[pattern.size()]);
+	letterSupportInBucket(*shared->bucket, pattern, masks);
+	if (shared->appended->numWords)
+		letterSupportInBucket(*shared->appended, pattern, masks);
+}
+
+uint32_t PatternIndex::letterSupportInBucket(const LengthBucket& bucket, std::string_view pattern, uint32_t position)
+{
+	const Sources sources = getSources(bucket, pattern);
+	if (sources.empty)
+		return 0;
+	if (sources.bitmaps.empty())
+		return supportAt(bucket, pattern, nullptr, position);
+
+	std::vector<uint64_t> matches(bucket.numBlocks);
+	andBitmaps(sources.bitmaps.data(), sources.bitmaps.size(), matches.data(), bucket.numBlocks);
+	if (std::all_of(matches.begin(), matches.end(), [](uint64_t block) { return block == 0; }))
+		return 0;
+	return supportAt(bucket, pattern, &matches, position);
+}
+
+uint32_t PatternIndex::letterSupport(std::string_view pattern, uint32_t position) const
+{
+	if (pattern.size() >= _lengths.size() || position >= pattern.size())
+		return 0;
+
+	const auto shared = std::atomic_load(&_lengths[pattern.size()]);
+	const uint32_t mask = letterSupportInBucket(*shared->bucket, pattern, position);
+	return shared->appended->numWords ? mask | letterSupportInBucket(*shared->appended, pattern, position) : mask;
+}
+
+/* Moves the bits from `bit` on one position up and writes `value` at `bit`. The last bit of the bitmap has to be free. */
+void PatternIndex::insertBit(uint64_t* bitmap, size_t numBlocks, uint32_t bit, bool value)
+{
+	const size_t block = bit / 64;
+	for (size_t i = numBlocks - 1; i > block; --i)
+		bitmap[i] = (bitmap[i] << 1) | (bitmap[i - 1] >> 63);
+
+	const uint64_t below = (1ull << (bit % 64)) - 1;
+	bitmap[block] = (bitmap[block] & below) | ((bitmap[block] & ~below) << 1) | (uint64_t(value) << (bit % 64));
+}
+
+/* Drops `bit` and moves the bits above it one position down */
+void PatternIndex::eraseBit(uint64_t* bitmap, size_t numBlocks, uint32_t bit)
+{
+	const size_t block = bit / 64;
+	const uint64_t below = (1ull << (bit % 64)) - 1;
+	bitmap[block] = (bitmap[block] & below) | ((bitmap[block] >> 1) & ~below);
+	for (size_t i = block; i + 1 < numBlocks; ++i)
+	{
+		bitmap[i] |= bitmap[i + 1] << 63;
+		bitmap[i + 1] >>= 1;
+	}
+}
+
+/*
+* Copies the bucket with the word's bit inserted at its place in id order, so find keeps returning increasing ids.
+* A bucket mapped from a snapshot becomes an owned one.
+*/
+std::shared_ptr<const PatternIndex::LengthBucket> PatternIndex::insertWord(const LengthBucket& old, WordId id, std::string_view word)
+{
+	const uint32_t length = uint32_t(word.size());
+	const auto position = std::lower_bound(old.ids.begin(), old.ids.end(), id);
+	if (position != old.ids.end() && *position == id)
+		return nullptr;
+	const uint32_t bit = uint32_t(position - old.ids.begin());
+
+	auto bucket = std::make_shared<LengthBucket>();
+	bucket->numWords = old.numWords + 1;
+	bucket->numBlocks = (bucket->numWords + 63) / 64;
+
+	std::vector<WordId> ids(old.ids.begin(), old.ids.end());
+	ids.insert(ids.begin() + bit, id);
+	std::vector<uint32_t> counts(old.counts.begin(), old.counts.end());
+	counts.resize(size_t(length) * ALPHABET_SIZE, 0); // Empty buckets have no counts yet
+	std::vector<uint64_t> bitmaps(counts.size() * bucket->numBlocks, 0ull);
+	bucket->width = packedWidth(length);
+	std::vector<uint8_t> packed(old.packed.begin(), old.packed.end());
+	if (bucket->width)
+	{
+		const auto at = packed.insert(packed.begin() + size_t(bit) * bucket->width, bucket->width, 0);
+		std::copy(word.begin(), word.end(), at);
+	}
+
+	for (uint32_t pos = 0; pos < length; ++pos)
+	{
+		const int letter = letterIndex(word[pos]);
+		for (uint32_t c = 0; c < ALPHABET_SIZE; ++c)
+		{
+			const uint32_t bitmapIndex = pos * ALPHABET_SIZE + c;
+			uint64_t* bitmap = bitmaps.data() + size_t(bitmapIndex) * bucket->numBlocks;
+			if (old.numBlocks)
+				std::copy(old.bitmap(bitmapIndex), old.bitmap(bitmapIndex) + old.numBlocks, bitmap);
+
+			insertBit(bitmap, bucket->numBlocks, bit, int(c) == letter);
+			counts[bitmapIndex] += int(c) == letter;
+		}
+	}
+
+	bucket->ids.assign(std::move(ids));
+	bucket->counts.assign(std::move(counts));
+	bucket->bitmaps.assign(std::move(bitmaps));
+	bucket->packed.assign(std::move(packed));
+	return bucket;
+}
+
+std::shared_ptr<const PatternIndex::LengthBucket> PatternIndex::eraseWord(const LengthBucket& old, WordId id)
+{
+	const auto position = std::lower_bound(old.ids.begin(), old.ids.end(), id);
+	if (position == old.ids.end() || *position != id)
+		return nullptr;
+	const uint32_t bit = uint32_t(position - old.ids.begin());
+
+	auto bucket = std::make_shared<LengthBucket>();
+	bucket->numWords = old.numWords - 1;
+	bucket->numBlocks = (bucket->numWords + 63) / 64;
+
+	std::vector<WordId> ids(old.ids.begin(), old.ids.end());
+	ids.erase(ids.begin() + bit);
+	std::vector<uint32_t> counts(old.counts.begin(), old.counts.end());
+	std::vector<uint64_t> bitmaps(counts.size() * bucket->numBlocks);
+	bucket->width = old.width;
+	std::vector<uint8_t> packed(old.packed.begin(), old.packed.end());
+	packed.erase(packed.begin() + size_t(bit) * bucket->width, packed.begin() + size_t(bit + 1) * bucket->width);
+
+	std::vector<uint64_t> scratch(old.numBlocks);
+	for (uint32_t bitmapIndex = 0; bitmapIndex < counts.size(); ++bitmapIndex)
+	{
+		std::copy(old.bitmap(bitmapIndex), old.bitmap(bitmapIndex) + old.numBlocks, scratch.begin());
+		counts[bitmapIndex] -= (scratch[bit / 64] >> (bit % 64)) & 1;
+		eraseBit(scratch.data(), scratch.size(), bit);
+		std::copy(scratch.begin(), scratch.begin() + bucket->numBlocks, bitmaps.begin() + size_t(bitmapIndex) * bucket->numBlocks);
+	}
+
+	bucket->ids.assign(std::move(ids));
+	bucket->counts.assign(std::move(counts));
+	bucket->bitmaps.assign(std::move(bitmaps));
+	bucket->packed.assign(std::move(packed));
+	return bucket;
+}
+
+/* The bits of `second` follow those of `first` in every bitmap */
+std::shared_ptr<const PatternIndex::LengthBucket> PatternIndex::concatBuckets(const LengthBucket& first, const LengthBucket& second, uint32_t length)
+{
+	auto bucket = std::make_shared<LengthBucket>();
+	bucket->numWords = first.numWords + second.numWords;
+	bucket->numBlocks = (bucket->numWords + 63) / 64;
+	bucket->width = packedWidth(length);
+
+	std::vector<WordId> ids(first.ids.begin(), first.ids.end());
+	ids.insert(ids.end(), second.ids.begin(), second.ids.end());
+	std::vector<uint8_t> packed(first.packed.begin(), first.packed.end());
+	packed.insert(packed.end(), second.packed.begin(), second.packed.end());
+
+	const size_t numBitmaps = size_t(length) * ALPHABET_SIZE;
+	std::vector<uint32_t> counts(numBitmaps, 0);
+	std::vector<uint64_t> bitmaps(numBitmaps * bucket->numBlocks, 0ull);
+	const size_t offsetBlock = first.numWords / 64, shift = first.numWords % 64;
+	for (uint32_t bitmapIndex = 0; bitmapIndex < numBitmaps; ++bitmapIndex)
+	{
+		uint64_t* bitmap = bitmaps.data() + size_t(bitmapIndex) * bucket->numBlocks;
+		if (first.numWords)
+		{
+			std::copy(first.bitmap(bitmapIndex), first.bitmap(bitmapIndex) + first.numBlocks, bitmap);
+			counts[bitmapIndex] += first.counts[bitmapIndex];
+		}
+		if (second.numWords)
+		{
+			const uint64_t* source = second.bitmap(bitmapIndex);
+			for (size_t block = 0; block < second.numBlocks; ++block)
+			{
+				bitmap[offsetBlock + block] |= source[block] << shift;
+				if (shift && offsetBlock + block + 1 < bucket->numBlocks)
+					bitmap[offsetBlock + block + 1] |= source[block] >> (64 - shift);
+			}
+			counts[bitmapIndex] += second.counts[bitmapIndex];
+		}
+	}
+
+	bucket->ids.assign(std::move(ids));
+	bucket->counts.assign(std::move(counts));
+	bucket->bitmaps.assign(std::move(bitmaps));
+	bucket->packed.assign(std::move(packed));
+	return bucket;
+}
+
+/*
+* Ids above every id of the main bucket go to the appended words, so adding a word copies only those. Once they are
+* more than MAX_APPENDED_WORDS, both buckets are folded into one.
+*/
+bool PatternIndex::insert(WordId id, std::string_view word)
+{
+	if (word.size() >= _lengths.size())
+		return false;
+
+	const uint32_t length = uint32_t(word.size());
+	const auto old = std::atomic_load(&_lengths[length]);
+	const LengthBucket& main = *old->bucket;
+	if (main.numWords && id <= main.ids[main.numWords - 1])
+	{
+		auto bucket = insertWord(main, id, word);
+		if (!bucket)
+			return false;
+		std::atomic_store(&_lengths[length], makeLength(std::move(bucket), old->appended));
+		return true;
+	}
+
+	auto appended = insertWord(*old->appended, id, word);
+	if (!appended)
+		return false;
+	if (appended->numWords > MAX_APPENDED_WORDS)
+		std::atomic_store(&_lengths[length], makeLength(concatBuckets(main, *appended, length)));
+	else
+		std::atomic_store(&_lengths[length], makeLength(old->bucket, std::move(appended)));
+	return true;
+}
+
+bool PatternIndex::erase(WordId id, std::string_view word)
+{
+	if (word.size() >= _lengths.size())
+		return false;
+
+	const uint32_t length = uint32_t(word.size());
+	const auto old = std::atomic_load(&_lengths[length]);
+	if (old->appended->numWords && id >= old->appended->ids[0])
+	{
+		auto appended = eraseWord(*old->appended, id);
+		if (!appended)
+			return false;
+		std::atomic_store(&_lengths[length], makeLength(old->bucket, std::move(appended)));
+		return true;
+	}
+
+	auto bucket = eraseWord(*old->bucket, id);
+	if (!bucket)
+		return false;
+	std::atomic_store(&_lengths[length], makeLength(std::move(bucket), old->appended));
+	return true;
+}
+
+PatternIndex::MemoryStats PatternIndex::getMemoryStats(uint32_t length) const
+{
+	MemoryStats stats;
+	if (length >= _lengths.size())
+		return stats;
+
+	const auto shared = std::atomic_load(&_lengths[length]);
+	for (const LengthBucket* bucket : { shared->bucket.get(), shared->appended.get() })
+	{
+		stats.numWords += bucket->numWords;
+		stats.numBitmaps = std::max(stats.numBitmaps, bucket->counts.size());
+		stats.bytes += bucket->ids.memoryUsage() + bucket->counts.memoryUsage() + bucket->bitmaps.memoryUsage() + bucket->packed.memoryUsage();
+	}
+
+	return stats;
+}
+
+}
@@ -0,0 +1,130 @@
+#pragma once
+#include <inttypes.h>
+#include <cstddef>
+#include <vector>
+#include <string>
+#include <memory>
+
+#include "crosswordutils.hpp"
+#include "mappedarray.hpp"
+#include "stringtable.hpp"
+#include "snapshotformat.hpp"
+#include "threadpool.hpp"
+
+namespace utils
+{
+	/*
+	* Pattern index with one bitmap per (word length, letter position, letter).
+	* Bit `i` of bitmap (length, pos, letter) is set if the i-th word of that length has `letter` at `pos`,
+	* so the words matching a pattern are the AND of the bitmaps of its filled positions.
+	* Memory and build time are linear in the dictionary size.
+	* Every word is also stored packed and zero padded to 8, 16, 32 or 64 bytes. When the sparsest bitmap of a pattern has
+	* few bits compared to the blocks an AND would read, only its words are visited and each one is checked with one
+	* masked compare of the whole packed word, specialized for the width of the bucket.
+	* The index can be served straight from a memory mapped snapshot. Every length is an immutable bucket, so insert and
+	* erase copy the bucket of the word's length and swap it in atomically while find keeps reading the old one.
+	* Words with ids above every id of their length (all the words a dictionary adds) go to a second, small bucket of
+	* appended words instead, which is the only one copied. It is folded into the main bucket once it holds
+	* MAX_APPENDED_WORDS words, so appending costs O(MAX_APPENDED_WORDS) amortized instead of the size of the length.
+	*/
+	class PatternIndex
+	{
+	public:
+
+		using WordId = uint32_t;
+
+		const static uint8_t ANY_CHAR = 0; // Matches every letter in a pattern
+		const static uint32_t ALPHABET_SIZE = 32; // Upper case cyrillic letters
+		const static uint32_t MAX_PACKED_WIDTH = 64; // Longer words are not packed
+		const static uint32_t MAX_APPENDED_WORDS = 1024; // Appended words are folded into the main bucket of their length beyond this
+
+		struct MemoryStats
+		{
+			size_t numWords = 0;
+			size_t numBitmaps = 0;
+			size_t bytes = 0;
+		};
+
+	public:
+
+		PatternIndex(uint32_t longestWord = 0) { reset(longestWord); }
+
+		void reset(uint32_t longestWord);
+		void build(const StringTable& words, uint32_t longestWord); // Word ids are indices in `words`. Words which are not shorter than longestWord are skipped.
+		void build(const StringTable& words, uint32_t longestWord, ThreadPool& pool); // Builds every length on its own task. Returns once the index is built.
+
+		void write(SnapshotWriter& out) const;
+		bool map(const uint8_t* data, size_t size, uint32_t longestWord, size_t numWords); // Serves the index from memory written by write(). The memory has to outlive the index. Rejects ids which are not below numWords.
+
+		void find(std::string_view pattern, std::vector<WordId>& out) const; // Appends the ids of all words matching `pattern` (in increasing order). Safe to call during insert and erase.
+		size_t count(std::string_view pattern) const; // Number of words find would return, by popcount of the ANDed bitmaps
+		void letterSupport(std::string_view pattern, uint32_t* masks) const; // Writes one mask per position: bit `letter` is set if a matching word has that letter there
+		uint32_t letterSupport(std::string_view pattern, uint32_t position) const;
+		bool insert(WordId id, std::string_view word); // Adds a word to its length. Returns false if it is too long or already there. Not safe to call concurrently with itself or erase.
+		bool erase(WordId id, std::string_view word); // Removes a word from its length. Returns false if it was not there.
+		MemoryStats getMemoryStats(uint32_t length) const;
+
+		static uint32_t packedWidth(uint32_t length) { return length == 0 || length > MAX_PACKED_WIDTH ? 0 : length <= 8 ? 8 : length <= 16 ? 16 : length <= 32 ? 32 : 64; }
+		static int letterIndex(uint8_t c) { return c >= CYRILLIC_A - ALPHABET_SIZE && c < CYRILLIC_A ? c - (CYRILLIC_A - ALPHABET_SIZE) : -1; } // -1 if `c` is not an upper case cyrillic letter
+
+	private:
+
+		struct LengthBucket
+		{
+			uint32_t numWords = 0;
+			uint32_t numBlocks = 0; // 64 bit blocks per bitmap
+			MappedArray<WordId> ids; // Maps from bit position to word id
+			MappedArray<uint32_t> counts; // Number of set bits in each bitmap
+			MappedArray<uint64_t> bitmaps; // Bitmap `pos * ALPHABET_SIZE + letter` starts at block (pos * ALPHABET_SIZE + letter) * numBlocks
+			uint32_t width = 0; // packedWidth of the length
+			MappedArray<uint8_t> packed; // The word of bit `i` at i * width
+
+			const uint64_t* bitmap(uint32_t bitmapIndex) const { return bitmaps.data() + size_t(bitmapIndex) * numBlocks; }
+		};
+
+		/* The words of one length. Replaced as a whole, so readers always see a bucket and its appended words together. */
+		struct Length
+		{
+			std::shared_ptr<const LengthBucket> bucket;
+			std::shared_ptr<const LengthBucket> appended; // Every id is above the ids of `bucket`
+		};
+
+		static std::vector<std::vector<WordId>> groupByLength(const StringTable& words, uint32_t longestWord);
+		static void buildBucket(LengthBucket& bucket, uint32_t length, std::vector<WordId> ids, const StringTable& words);
+		static bool isValidBucket(const WordId* ids, const uint64_t* bitmaps, const LengthBucket& bucket, size_t numBitmaps, size_t numWords);
+		static std::shared_ptr<const LengthBucket> emptyBucket();
+		static std::shared_ptr<const Length> makeLength(std::shared_ptr<const LengthBucket> bucket, std::shared_ptr<const LengthBucket> appended = nullptr); // nullptr means no appended words
+		static std::shared_ptr<const LengthBucket> insertWord(const LengthBucket& old, WordId id, std::string_view word); // Copy of `old` with the word. nullptr if it was there.
+		static std::shared_ptr<const LengthBucket> eraseWord(const LengthBucket& old, WordId id); // Copy of `old` without the word. nullptr if it was not there.
+		static std::shared_ptr<const LengthBucket> concatBuckets(const LengthBucket& first, const LengthBucket& second, uint32_t length); // The ids of `second` have to be above those of `first`
+		static void insertBit(uint64_t* bitmap, size_t numBlocks, uint32_t bit, bool value);
+		static void eraseBit(uint64_t* bitmap, size_t numBlocks, uint32_t bit);
+		static void andBitmaps(const uint64_t* const* sources, size_t numSources, uint64_t* out, size_t numBlocks);
+		static size_t andCount(const uint64_t* const* sources, size_t numSources, size_t numBlocks);
+		static bool intersects(const uint64_t* a, const uint64_t* b, size_t numBlocks);
+
+		/* The bitmaps of the filled positions of a pattern */
+		struct Sources
+		{
+			std::vector<const uint64_t*> bitmaps;
+			uint32_t fewest = UINT32_MAX; // Set bits of the sparsest one
+			uint32_t sparsest = 0; // Index in bitmaps
+			bool empty = false; // No word can match
+		};
+		static Sources getSources(const LengthBucket& bucket, std::string_view pattern);
+		static bool shouldScan(const LengthBucket& bucket, const Sources& sources); // Query plan: scan the sparsest bitmap instead of ANDing all of them
+		template <typename Visit>
+		static void scanSparsest(const LengthBucket& bucket, const Sources& sources, std::string_view pattern, Visit&& visit);
+		static uint32_t supportAt(const LengthBucket& bucket, std::string_view pattern, const std::vector<uint64_t>* matches, uint32_t position);
+
+		// Per bucket parts of the queries. The letter support ones OR their masks into the result.
+		static void findInBucket(const LengthBucket& bucket, std::string_view pattern, std::vector<WordId>& out);
+		static size_t countInBucket(const LengthBucket& bucket, std::string_view pattern);
+		static void letterSupportInBucket(const LengthBucket& bucket, std::string_view pattern, uint32_t* masks);
+		static uint32_t letterSupportInBucket(const LengthBucket& bucket, std::string_view pattern, uint32_t position);
+
+	private:
+
+		std::vector<std::shared_ptr<const Length>> _lengths; // Indexed by length. Read with atomic_load, replaced with atomic_store.
+	};
+}
@@ -0,0 +1,106 @@
+#pragma once
+#include <inttypes.h>
+
+namespace utils
+{
+	/*
+	* Pseudo random bijection on [0, size) defined by a seed.
+	* A 4 round Feistel network permutes the smallest power of four which holds `size` and values outside
+	* of the range are mapped again (cycle walking), so every index is computed in O(1) without any memory.
+	* Seed 0 is the identity. within() applies the same keys to a smaller range, e.g. one score tier of a pattern.
+	*/
+	class IndexPermutation
+	{
+	public:
+
+		IndexPermutation() = default;
+		IndexPermutation(uint64_t size, uint64_t seed) :
+			_size(size),
+			_identity(seed == 0 || size < 2)
+		{
+			if (_identity)
+				return;
+
+			_halfBits = getHalfBits(size);
+			_halfMask = (1ull << _halfBits) - 1;
+
+			uint64_t state = seed;
+			for (auto& key : _keys)
+				key = splitMix64(state);
+		}
+
+		uint64_t operator()(uint64_t index) const
+		{
+			if (_identity)
+				return index;
+
+			do
+			{
+				index = encrypt(index, _halfBits, _halfMask);
+			} while (index >= _size);
+
+			return index;
+		}
+
+		uint64_t within(uint64_t index, uint64_t size) const { return within(index, size, getHalfBits(size)); } // Bijection on [0, size) with the same keys
+		uint64_t within(uint64_t index, uint64_t size, uint32_t halfBits) const // halfBits has to be getHalfBits(size)
+		{
+			if (_identity || size < 2)
+				return index;
+
+			const uint64_t halfMask = (1ull << halfBits) - 1;
+			do
+			{
+				index = encrypt(index, halfBits, halfMask);
+			} while (index >= size);
+
+			return index;
+		}
+
+		uint64_t size() const { return _size; }
+
+		static uint32_t getHalfBits(uint64_t size) // Of the smallest power of four which holds `size`
+		{
+			uint32_t halfBits = 1;
+			while ((1ull << (2 * halfBits)) < size)
+				++halfBits;
+			return halfBits;
+		}
+
+	private:
+
+		const static uint32_t ROUNDS = 4;
+
+		static uint64_t mix64(uint64_t x)
+		{
+			x ^= x >> 30;
+			x *= 0xBF58476D1CE4E5B9ull;
+			x ^= x >> 27;
+			x *= 0x94D049BB133111EBull;
+			x ^= x >> 31;
+			return x;
+		}
+		static uint64_t splitMix64(uint64_t& state) { return mix64(state += 0x9E3779B97F4A7C15ull); }
+
+		uint64_t encrypt(uint64_t x, uint32_t halfBits, uint64_t halfMask) const
+		{
+			uint64_t left = x >> halfBits;
+			uint64_t right = x & halfMask;
+			for (uint32_t round = 0; round < ROUNDS; ++round)
+			{
+				const uint64_t next = left ^ (mix64(right ^ _keys[round]) & halfMask);
+				left = right;
+				right = next;
+			}
+			return (left << halfBits) | right;
+		}
+
+	private:
+
+		uint64_t _size = 0;
+		uint32_t _halfBits = 1;
+		uint64_t _halfMask = 1;
+		uint64_t _keys[ROUNDS] = {};
+		bool _identity = true;
+	};
+}
@@ -0,0 +1,121 @@
+/*
+* Fill service daemon: loads the dictionary once and answers the requests of serviceprotocol.hpp.
+* Usage: crosswordd [--config config.ini] [--socket path] [--threads n] [--fills n] [--log file]
+* With --socket it listens on a Unix domain socket until SIGINT or SIGTERM. Without it the requests are read from
+* stdin and answered on stdout until stdin ends, and the log goes to --log (default: crosswordd.log) instead of the console.
+*/
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <signal.h>
+#endif
+
+#include "../dictionary.hpp"
+#include "../fillservice.hpp"
+#include "../logger.hpp"
+
+struct Arguments
+{
+	std::string configPath = utils::Dictionary::DEFAULT_CONFIG_PATH;
+	std::string socketPath;
+	std::string logPath = "crosswordd.log";
+	FillService::Options options;
+};
+
+static bool parseArguments(int argc, char** argv, Arguments& arguments)
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		const std::string argument = argv[i];
+		if (i + 1 >= argc)
+			return false;
+		if (argument == "--config")
+			arguments.configPath = argv[++i];
+		else if (argument == "--socket")
+			arguments.socketPath = argv[++i];
+		else if (argument == "--threads")
+			arguments.options.numThreads = size_t(std::max(0, std::atoi(argv[++i])));
+		else if (argument == "--fills")
+			arguments.options.maxConcurrentFills = size_t(std::max(0, std::atoi(argv[++i])));
+		else if (argument == "--log")
+			arguments.logPath = argv[++i];
+		else
+			return false;
+	}
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	Arguments arguments;
+	if (!parseArguments(argc, argv, arguments))
+	{
+		std::fprintf(stderr, "Usage: %s [--config config.ini] [--socket path] [--threads n] [--fills n] [--log file]\n", argv[0]);
+		return 1;
+	}
+
+	const bool pipeMode = arguments.socketPath.empty();
+	if (pipeMode)
+	{
+		// stdout carries the responses
+		utils::Logger::getInstance().clearSinks();
+		utils::Logger::getInstance().addSink(std::make_unique<utils::FileSink>(arguments.logPath));
+#ifdef _WIN32
+		_setmode(_fileno(stdin), _O_BINARY);
+		_setmode(_fileno(stdout), _O_BINARY);
+#endif
+		std::ios::sync_with_stdio(false); // Gives std::cin its own buffer, so the frames sent together are read together
+	}
+
+#ifndef _WIN32
+	// Blocked before any thread starts, so only the signal thread below receives them
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+#endif
+
+	utils::Dictionary dictionary(arguments.configPath);
+	FillService service(dictionary, arguments.options);
+
+	bool served = true;
+	if (pipeMode)
+	{
+		service.serve(std::cin, std::cout);
+	}
+	else
+	{
+#ifndef _WIN32
+		std::atomic<bool> listened{ false };
+		std::thread signalThread([&service, &listened, signals]()
+		{
+			int signal = 0;
+			sigwait(&signals, &signal);
+			if (listened)
+				return; // Woken by main below
+			VLOG_INFO("[INFO]: crosswordd: Got signal " << signal << ". Stopping." << std::endl);
+			service.stop();
+		});
+#endif
+		served = service.listen(arguments.socketPath);
+#ifndef _WIN32
+		// listen can return before stop does, or fail without a signal. The thread has to be done before the service goes away.
+		listened = true;
+		pthread_kill(signalThread.native_handle(), SIGTERM);
+		signalThread.join();
+#endif
+	}
+
+	VLOG_FLUSH();
+	return served ? 0 : 1;
+}
@@ -0,0 +1,119 @@
+#pragma once
+#include <inttypes.h>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+namespace utils
+{
+	/*
+	* Frames of the local fill service (see FillService).
+	* Every request and every response is a ServiceFrameHeader followed by `size` payload bytes. The peer is on the same
+	* machine, so all values are stored in native byte order. A response carries the id and the type of its request.
+	* Responses come back in the order the requests finish, not in the order they were sent.
+	*
+	* Request payloads:
+	*   SERVICE_FILL      ServiceFillRequest, the crossword name, the .ctb image
+	*   SERVICE_VALIDATE  ServiceCrosswordRequest, the crossword name, the .ctb image
+	*   SERVICE_RENDER    ServiceRenderRequest, the crossword name, the .ctb image
+	*   SERVICE_METRICS   nothing
+	* Response payloads when the status is SERVICE_OK:
+	*   SERVICE_FILL      ServiceFillResult, the .ctb image of the filled crossword (only the result if the status is SERVICE_NOT_SOLVED)
+	*   SERVICE_VALIDATE  ServiceValidateResult, then numRepeats uint32_t slot indices (Crossword::getWords) of the repeated words
+	*   SERVICE_RENDER    the SVG document
+	*   SERVICE_METRICS   the process metrics in the Prometheus text format
+	* Any other status comes with an error message as the payload.
+	*/
+
+	const uint32_t SERVICE_MAGIC = 0x56535743; // "CWSV"
+	const uint16_t SERVICE_VERSION = 1; // Increase on every change of the frames
+
+	enum ServiceRequestType : uint8_t
+	{
+		SERVICE_FILL,
+		SERVICE_VALIDATE,
+		SERVICE_RENDER,
+		SERVICE_METRICS,
+		SERVICE_NUM_REQUEST_TYPES
+	};
+
+	enum ServiceStatus : uint8_t
+	{
+		SERVICE_OK,
+		SERVICE_NOT_SOLVED, // The fill found no solution or hit maxNodes
+		SERVICE_BAD_REQUEST, // Unknown type or a payload which could not be parsed
+		SERVICE_BUSY, // The queue was full. Send the request again later.
+		SERVICE_SHUTTING_DOWN
+	};
+
+	struct ServiceFrameHeader
+	{
+		uint32_t magic;
+		uint16_t version;
+		uint8_t type; // ServiceRequestType
+		uint8_t status; // ServiceStatus. 0 in requests.
+		uint32_t id; // Chosen by the client
+		uint32_t size; // Of the payload
+	};
+	static_assert(sizeof(ServiceFrameHeader) == 16, "ServiceFrameHeader has to stay packed");
+
+	struct ServiceCrosswordRequest
+	{
+		uint32_t nameSize; // The name follows this struct and the .ctb image follows the name
+		uint32_t reserved;
+	};
+
+	struct ServiceFillRequest
+	{
+		uint64_t seed; // CrosswordFiller::Options::seed
+		uint64_t maxNodes; // 0 uses the service default
+		uint8_t allowRepeats;
+		uint8_t deterministic;
+		uint8_t reserved[6];
+		ServiceCrosswordRequest crossword;
+	};
+
+	struct ServiceRenderRequest
+	{
+		uint8_t drawLetters;
+		uint8_t reserved[7];
+		ServiceCrosswordRequest crossword;
+	};
+
+	struct ServiceFillResult
+	{
+		uint64_t nodes;
+		uint64_t backtracks;
+		uint64_t backjumps;
+		uint64_t nogoodHits;
+		double queueSeconds; // From the arrival of the request until a worker took it
+		double searchSeconds;
+	};
+
+	struct ServiceValidateResult
+	{
+		uint8_t valid; // Crossword::isValid
+		uint8_t reserved[3];
+		uint32_t numWords;
+		uint32_t numBoxes;
+		uint32_t rows;
+		uint32_t cols;
+		uint32_t numRepeats;
+		double averageWordLength;
+		double boxedAreaCoef;
+	};
+
+	/* Appends the header and the payload parts of one frame to `out` */
+	inline void appendServiceFrame(std::vector<uint8_t>& out, uint8_t type, uint8_t status, uint32_t id, const void* payload, size_t size,
+		const void* tail = nullptr, size_t tailSize = 0)
+	{
+		const ServiceFrameHeader header{ SERVICE_MAGIC, SERVICE_VERSION, type, status, id, uint32_t(size + tailSize) };
+		const size_t start = out.size();
+		out.resize(start + sizeof(header) + size + tailSize);
+		std::memcpy(out.data() + start, &header, sizeof(header));
+		if (size)
+			std::memcpy(out.data() + start + sizeof(header), payload, size);
+		if (tailSize)
+			std::memcpy(out.data() + start + sizeof(header) + size, tail, tailSize);
+	}
+}
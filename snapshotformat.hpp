@@ -0,0 +1,125 @@
+#pragma once
+#include <inttypes.h>
+#include <cstddef>
+#include <cstring>
+#include <ostream>
+#include <algorithm>
+
+namespace utils
+{
+	/*
+	* Layout of the binary dictionary snapshot:
+	* SnapshotHeader followed by the sections listed in it. Every section starts at an 8 byte boundary,
+	* so arrays can be used straight from the memory mapping. All values are stored in native byte order.
+	*/
+
+	const char SNAPSHOT_MAGIC[8] = { 'C', 'W', 'D', 'I', 'C', 'T', 0, 0 };
+	const uint32_t SNAPSHOT_VERSION = 4; // Increase on every change of the layout
+
+	enum SnapshotSectionId : uint32_t
+	{
+		SNAPSHOT_WORD_OFFSETS,
+		SNAPSHOT_WORD_DATA,
+		SNAPSHOT_DIRTY_OFFSETS,
+		SNAPSHOT_DIRTY_DATA,
+		SNAPSHOT_EXPLANATION_OFFSETS,
+		SNAPSHOT_EXPLANATION_DATA,
+		SNAPSHOT_EXPLANATION_IDS,
+		SNAPSHOT_SORTED_IDS,
+		SNAPSHOT_PATTERN_INDEX,
+		SNAPSHOT_TIER_STARTS,
+		SNAPSHOT_NUM_SECTIONS
+	};
+
+	struct SnapshotSection
+	{
+		uint64_t offset; // From the start of the file
+		uint64_t size; // In bytes
+	};
+
+	struct SnapshotHeader
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t longestWord;
+		uint64_t numWords;
+		uint64_t sourceSize; // Size of the text dictionary the snapshot was built from
+		int64_t sourceWriteTime; // Last write time of the text dictionary the snapshot was built from
+		uint64_t scoresSize; // Same for the scores file. Zeros without one.
+		int64_t scoresWriteTime;
+		uint64_t scoreSettings; // Dictionary::getScoreSettings of the dictionary which ranked the words
+		SnapshotSection sections[SNAPSHOT_NUM_SECTIONS];
+	};
+
+	/* Sequential writer which keeps track of the position and pads to the alignment the reader expects */
+	class SnapshotWriter
+	{
+	public:
+
+		explicit SnapshotWriter(std::ostream& out) : _out(out) {}
+
+		void write(const void* data, size_t bytes)
+		{
+			_out.write(static_cast<const char*>(data), std::streamsize(bytes));
+			_position += bytes;
+		}
+		void align(size_t alignment = 8)
+		{
+			static const char zeros[8] = {};
+			while (_position % alignment)
+				write(zeros, std::min<size_t>(alignment - _position % alignment, sizeof(zeros)));
+		}
+		SnapshotSection writeSection(const void* data, size_t bytes)
+		{
+			align();
+			SnapshotSection section{ _position, bytes };
+			write(data, bytes);
+			return section;
+		}
+
+		uint64_t position() const { return _position; }
+		bool good() const { return _out.good(); }
+
+	private:
+
+		std::ostream& _out;
+		uint64_t _position = 0;
+	};
+
+	/* Bounds checked sequential reader over a section of the snapshot */
+	class SnapshotReader
+	{
+	public:
+
+		SnapshotReader(const uint8_t* data, size_t size) : _data(data), _size(size) {}
+
+		template <typename T>
+		const T* read(size_t count) // Returns nullptr if there are less than `count` elements left
+		{
+			const size_t bytes = count * sizeof(T);
+			if (_failed || count > _size / sizeof(T) || bytes > _size - _position)
+			{
+				_failed = true;
+				return nullptr;
+			}
+			const T* result = reinterpret_cast<const T*>(_data + _position);
+			_position += bytes;
+			return result;
+		}
+		void align(size_t alignment = 8)
+		{
+			_position += (alignment - _position % alignment) % alignment;
+			if (_position > _size)
+				_failed = true;
+		}
+
+		bool failed() const { return _failed; }
+
+	private:
+
+		const uint8_t* _data;
+		size_t _size;
+		size_t _position = 0;
+		bool _failed = false;
+	};
+}
@@ -0,0 +1,95 @@
+#pragma once
+#include <inttypes.h>
+#include <cstddef>
+#include <string_view>
+#include <iterator>
+
+#include "mappedarray.hpp"
+
+namespace utils
+{
+	/*
+	* Table of strings stored back to back in one buffer.
+	* String `i` spans [offsets[i], offsets[i + 1]) of the buffer, so looking one up never allocates.
+	*/
+	class StringTable
+	{
+	public:
+
+		class const_iterator
+		{
+		public:
+			using iterator_category = std::random_access_iterator_tag;
+			using value_type = std::string_view;
+			using difference_type = std::ptrdiff_t;
+			using pointer = void;
+			using reference = std::string_view;
+
+			const_iterator(const StringTable* table, size_t index) : _table(table), _index(index) {}
+
+			std::string_view operator*() const { return (*_table)[_index]; }
+			const_iterator& operator++() { ++_index; return *this; }
+			const_iterator& operator--() { --_index; return *this; }
+			const_iterator& operator+=(difference_type n) { _index += n; return *this; }
+			const_iterator operator+(difference_type n) const { return const_iterator(_table, _index + n); }
+			difference_type operator-(const const_iterator& other) const { return difference_type(_index) - difference_type(other._index); }
+			bool operator==(const const_iterator& other) const { return _index == other._index; }
+			bool operator!=(const const_iterator& other) const { return _index != other._index; }
+			bool operator<(const const_iterator& other) const { return _index < other._index; }
+
+		private:
+			const StringTable* _table;
+			size_t _index;
+		};
+
+	public:
+
+		StringTable() { clear(); }
+
+		void push_back(std::string_view str)
+		{
+			_data.append(str.data(), str.size());
+			_offsets.push_back(_data.size());
+		}
+		void append(const StringTable& other) // Adds every string of `other` at the end
+		{
+			const uint64_t base = _data.size();
+			_data.append(other._data.data(), other._data.size());
+			for (size_t i = 1; i < other._offsets.size(); ++i)
+				_offsets.push_back(base + other._offsets[i]);
+		}
+		void clear()
+		{
+			_data.clear();
+			_offsets.clear();
+			_offsets.push_back(0);
+		}
+		void shrink_to_fit()
+		{
+			_data.shrink_to_fit();
+			_offsets.shrink_to_fit();
+		}
+		void view(const uint64_t* offsets, size_t size, const char* data, size_t dataSize) // `offsets` has to hold size + 1 elements
+		{
+			_offsets.view(offsets, size + 1);
+			_data.view(data, dataSize);
+		}
+
+		size_t size() const { return _offsets.size() - 1; }
+		bool empty() const { return size() == 0; }
+		size_t memoryUsage() const { return _offsets.memoryUsage() + _data.memoryUsage(); }
+
+		std::string_view operator[](size_t i) const { return std::string_view(_data.data() + _offsets[i], size_t(_offsets[i + 1] - _offsets[i])); }
+
+		const_iterator begin() const { return const_iterator(this, 0); }
+		const_iterator end() const { return const_iterator(this, size()); }
+
+		const MappedArray<uint64_t>& offsets() const { return _offsets; }
+		const MappedArray<char>& data() const { return _data; }
+
+	private:
+
+		MappedArray<uint64_t> _offsets; // size() + 1 elements
+		MappedArray<char> _data;
+	};
+}
@@ -0,0 +1,166 @@
+#include "svgwriter.hpp"
+
+#include <algorithm>
+#include <charconv>
+
+namespace SVG
+{
+
+void SVGWriter::beginTag(std::string_view name)
+{
+	_buffer += '<';
+	_buffer.append(name.data(), name.size());
+	_buffer += ' ';
+	_openElements.emplace_back(name);
+}
+
+void SVGWriter::attribute(std::string_view name, std::string_view value)
+{
+	beginAttribute(name);
+	content(value);
+	endAttribute();
+}
+
+void SVGWriter::attribute(std::string_view name, double value)
+{
+	beginAttribute(name);
+	appendNumber(value);
+	endAttribute();
+}
+
+/* std::to_string(double) is printf("%f"), which is to_chars with fixed notation and precision 6 */
+void SVGWriter::appendNumber(double value)
+{
+	char digits[400]; // DBL_MAX has 309 integer digits
+	const auto result = std::to_chars(digits, digits + sizeof(digits), value, std::chars_format::fixed, 6);
+	_buffer.append(digits, size_t(result.ptr - digits));
+}
+
+/* UTF-8 of every Windows-1251 byte, built once. Markup characters are escaped and the ones XML does not allow are dropped. */
+struct WinToUtf8Table
+{
+	std::string_view map[256];
+	char storage[256][4];
+
+	WinToUtf8Table()
+	{
+		for (int c = 0; c < 256; ++c)
+		{
+			uint32_t codePoint = c < 128 ? uint32_t(c) : '?';
+			if (c >= 192)
+				codePoint = 0x410 + (c - 192); // А..я
+			else if (c == 0xA8)
+				codePoint = 0x401; // Ё
+			else if (c == 0xB8)
+				codePoint = 0x451; // ё
+
+			char* out = storage[c];
+			if (codePoint < 128)
+			{
+				out[0] = char(codePoint);
+				map[c] = std::string_view(out, 1);
+			}
+			else
+			{
+				out[0] = char(0xC0 | (codePoint >> 6));
+				out[1] = char(0x80 | (codePoint & 0x3F));
+				map[c] = std::string_view(out, 2);
+			}
+		}
+		for (int c = 0; c < 32; ++c)
+			if (c != '\t' && c != '\n' && c != '\r')
+				map[c] = std::string_view();
+		map[uint8_t('&')] = "&amp;";
+		map[uint8_t('<')] = "&lt;";
+		map[uint8_t('>')] = "&gt;";
+		map[uint8_t('"')] = "&quot;";
+	}
+};
+
+void SVGWriter::winText(std::string_view text)
+{
+	static const WinToUtf8Table table;
+	for (const char c : text)
+	{
+		const std::string_view utf8 = table.map[uint8_t(c)];
+		_buffer.append(utf8.data(), utf8.size());
+	}
+}
+
+/* SVG_element keeps its attributes in a std::map, so they come out sorted by name */
+void SVGWriter::open(std::string_view name, const Attribute* attributes, size_t numAttributes)
+{
+	_sorted.assign(attributes, attributes + numAttributes);
+	std::sort(_sorted.begin(), _sorted.end(), [](const Attribute& a, const Attribute& b) { return a.name < b.name; });
+
+	beginTag(name);
+	for (const auto& attribute : _sorted)
+		this->attribute(attribute.name, attribute.value);
+	endTag();
+}
+
+void SVGWriter::open(std::string_view name, std::initializer_list<Attribute> attributes)
+{
+	open(name, attributes.begin(), attributes.size());
+}
+
+void SVGWriter::close()
+{
+	if (_openElements.empty())
+		return;
+
+	_buffer += "</";
+	_buffer += _openElements.back();
+	_buffer += '>';
+	_openElements.pop_back();
+}
+
+/* The helpers write their attributes already in name order */
+void GetRoot(SVGWriter& out, double width, double height)
+{
+	out.beginTag("svg");
+	out.beginAttribute("height");
+	out.appendNumber(height);
+	out.content("mm");
+	out.endAttribute();
+	out.attribute("version", "1.1");
+	out.beginAttribute("viewBox");
+	out.content("0 0 ");
+	out.appendNumber(width);
+	out.content(" ");
+	out.appendNumber(height);
+	out.endAttribute();
+	out.beginAttribute("width");
+	out.appendNumber(width);
+	out.content("mm");
+	out.endAttribute();
+	out.attribute("xmlns", "http://www.w3.org/2000/svg");
+	out.endTag();
+}
+
+void GetText(SVGWriter& out, double x, double y, std::string_view content)
+{
+	out.beginTag("text");
+	out.attribute("text-anchor", "middle");
+	out.attribute("x", x);
+	out.attribute("y", y);
+	out.endTag();
+	out.content(content);
+	out.close();
+}
+
+void GetBox(SVGWriter& out, double x, double y, double szW, double szH, double stroke_width)
+{
+	out.beginTag("rect");
+	out.attribute("fill", "white");
+	out.attribute("height", szH);
+	out.attribute("stroke", "black");
+	out.attribute("stroke-width", stroke_width);
+	out.attribute("width", szW);
+	out.attribute("x", x);
+	out.attribute("y", y);
+	out.endTag();
+	out.close();
+}
+
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <inttypes.h>
+#include <cstddef>
+#include <initializer_list>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace SVG
+{
+	/*
+	* Append-only SVG emitter. Elements are written straight into one reusable buffer instead of being built as a tree
+	* of SVG_element nodes, and the buffer reaches the stream in one write without a flush per tag.
+	* The markup is the same as SVG_element::print: attributes in name order, each followed by a space, and numbers
+	* formatted like std::to_string (fixed with 6 decimals) but without a temporary string.
+	*/
+	class SVGWriter
+	{
+	public:
+
+		struct Attribute
+		{
+			std::string_view name;
+			std::string_view value;
+		};
+
+	public:
+
+		void open(std::string_view name, std::initializer_list<Attribute> attributes); // Attribute names have to be different
+		void open(std::string_view name, const Attribute* attributes, size_t numAttributes);
+		void content(std::string_view text) { _buffer.append(text.data(), text.size()); }
+		void winText(std::string_view text); // Windows-1251 text, written escaped and in UTF-8
+		void close(); // Ends the innermost open element
+		void element(std::string_view name, std::initializer_list<Attribute> attributes, std::string_view text = {}) { open(name, attributes); content(text); close(); }
+
+		/* Building blocks of the helpers below. Attributes have to be written in name order. */
+		void beginTag(std::string_view name); // Opens the element: `<name `
+		void attribute(std::string_view name, std::string_view value); // `name="value" `
+		void attribute(std::string_view name, double value);
+		void beginAttribute(std::string_view name) { _buffer.append(name.data(), name.size()); _buffer += "=\""; } // The value is appended with content and appendNumber
+		void endAttribute() { _buffer += "\" "; }
+		void endTag() { _buffer += '>'; }
+
+		void appendNumber(double value); // Same digits as std::to_string(value)
+
+		size_t depth() const { return _openElements.size(); }
+		std::string_view view() const { return _buffer; }
+		void writeTo(std::ostream& out) const { out.write(_buffer.data(), std::streamsize(_buffer.size())); }
+		void clear() { _buffer.clear(); _openElements.clear(); } // Keeps the memory for the next document
+		void reserve(size_t bytes) { _buffer.reserve(bytes); }
+
+	private:
+
+		std::string _buffer;
+		std::vector<std::string> _openElements; // Names, innermost last
+		std::vector<Attribute> _sorted; // Reused by open
+	};
+
+	/* Same markup as the SVG_element helpers of the same name */
+	void GetRoot(SVGWriter& out, double width, double height); // Opens the root element. Close it with out.close().
+	void GetText(SVGWriter& out, double x = 0, double y = 0, std::string_view content = "empty");
+	void GetBox(SVGWriter& out, double x = 0, double y = 0, double szW = 10, double szH = 10, double stroke_width = 2);
+}
@@ -0,0 +1,125 @@
+#include "threadpool.hpp"
+
+namespace utils
+{
+
+static thread_local const ThreadPool* currentPool = nullptr;
+static thread_local int currentIndex = -1;
+
+ThreadPool::ThreadPool(size_t numThreads)
+{
+	if (numThreads == 0)
+		numThreads = 1;
+
+	for (size_t i = 0; i < numThreads; ++i)
+		_queues.emplace_back(new WorkQueue);
+
+	for (size_t i = 0; i < numThreads; ++i)
+		_workers.emplace_back(&ThreadPool::workerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+	wait();
+	{
+		std::lock_guard<std::mutex> lock(_sleepMutex);
+		_stop = true;
+	}
+	_wakeUp.notify_all();
+	for (auto& worker : _workers)
+		worker.join();
+}
+
+int ThreadPool::currentWorker()
+{
+	return currentIndex;
+}
+
+void ThreadPool::submit(Task task)
+{
+	size_t index = currentPool == this ? size_t(currentIndex) : _nextQueue++ % _queues.size();
+
+	++_pending;
+	{
+		std::lock_guard<std::mutex> lock(_queues[index]->mutex);
+		_queues[index]->tasks.push_back(std::move(task));
+	}
+	{
+		// Taking the lock makes sure a worker which just found nothing to do is already waiting
+		std::lock_guard<std::mutex> lock(_sleepMutex);
+	}
+	_wakeUp.notify_one();
+}
+
+void ThreadPool::wait()
+{
+	std::unique_lock<std::mutex> lock(_sleepMutex);
+	_allDone.wait(lock, [this] { return _pending == 0; });
+}
+
+bool ThreadPool::tryPop(size_t index, Task& task)
+{
+	auto& queue = *_queues[index];
+	std::lock_guard<std::mutex> lock(queue.mutex);
+	if (queue.tasks.empty())
+		return false;
+
+	task = std::move(queue.tasks.back());
+	queue.tasks.pop_back();
+	return true;
+}
+
+bool ThreadPool::trySteal(size_t thief, Task& task)
+{
+	for (size_t i = 1; i < _queues.size(); ++i)
+	{
+		auto& queue = *_queues[(thief + i) % _queues.size()];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.tasks.empty())
+			continue;
+
+		task = std::move(queue.tasks.front());
+		queue.tasks.pop_front();
+		return true;
+	}
+	return false;
+}
+
+void ThreadPool::workerLoop(size_t index)
+{
+	currentPool = this;
+	currentIndex = int(index);
+
+	Task task;
+	while (true)
+	{
+		if (tryPop(index, task) || trySteal(index, task))
+		{
+			task();
+			task = nullptr;
+
+			if (--_pending == 0)
+			{
+				std::lock_guard<std::mutex> lock(_sleepMutex);
+				_allDone.notify_all();
+			}
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(_sleepMutex);
+		if (_stop)
+			return;
+
+		// Tasks are pushed before the submitter takes _sleepMutex, so checking the queues under the lock cannot miss a wake up
+		bool hasWork = false;
+		for (auto& queue : _queues)
+		{
+			std::lock_guard<std::mutex> queueLock(queue->mutex);
+			hasWork |= !queue->tasks.empty();
+		}
+		if (!hasWork)
+			_wakeUp.wait(lock);
+	}
+}
+
+}
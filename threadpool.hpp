@@ -0,0 +1,63 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace utils
+{
+	/*
+	* Work-stealing thread pool.
+	* Every worker has its own deque. Tasks submitted from a worker go to the back of its deque and the worker pops from the back,
+	* so subtasks run depth first on the thread that created them. Idle workers steal from the front of the other deques.
+	*/
+	class ThreadPool
+	{
+	public:
+
+		using Task = std::function<void()>;
+
+	public:
+
+		explicit ThreadPool(size_t numThreads = std::thread::hardware_concurrency());
+		~ThreadPool();
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		void submit(Task task);
+		void wait(); // Blocks until every submitted task (including the ones submitted by tasks) has finished
+
+		size_t size() const { return _workers.size(); }
+		static int currentWorker(); // Index of the calling worker in its pool or -1 if not called from a worker
+
+	private:
+
+		struct WorkQueue
+		{
+			std::mutex mutex;
+			std::deque<Task> tasks;
+		};
+
+		void workerLoop(size_t index);
+		bool tryPop(size_t index, Task& task);
+		bool trySteal(size_t thief, Task& task);
+
+	private:
+
+		std::vector<std::unique_ptr<WorkQueue>> _queues;
+		std::vector<std::thread> _workers;
+
+		std::mutex _sleepMutex;
+		std::condition_variable _wakeUp;
+		std::condition_variable _allDone;
+
+		std::atomic<size_t> _pending{ 0 }; // Submitted but not finished tasks
+		std::atomic<size_t> _nextQueue{ 0 }; // Round robin for tasks submitted from outside the pool
+		std::atomic<bool> _stop{ false };
+	};
+}